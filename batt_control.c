@@ -0,0 +1,160 @@
+/**
+ * Battery voltage compensation of the motor powers.
+ *
+ * The motor powers are PWM duty cycles, so a motor gets the duty times the
+ * battery voltage: with a full battery (4.2 V) the robot is ~25% faster than
+ * at the end of a game (3.4 V) and the camera's timing is off.
+ *
+ * The ADC converts the battery voltage in the background: batt_tick (every
+ * BATTC_PERIOD, see main.c) takes the result of the conversion it started
+ * the period before and starts the next one, so nothing waits for the ADC.
+ * The voltage is filtered in fixed point (an exponential average) and turned
+ * into a scale factor that set_motors (see drive_control.c) applies to every
+ * motor power (see batt_scale).
+ *
+ * Only the ADC's channel 0 is used, the ADC's settings are left to
+ * drivers/adc.c. Without the settings the conversion needs, there is no
+ * compensation: the battery voltage reads 0 and the powers are not scaled.
+ */
+
+#include "batt_control.h"
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+uint16_t batt_convert(uint16_t res);
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The ADC has the settings the conversion needs (see batt_control_init) */
+uint8_t batt_adc_ok = 0;
+
+/* The filtered voltage (mV, shifted left by BATTC_FILTER_SHIFT) and in mV */
+uint32_t batt_filter = 0;
+uint16_t batt_mv = 0;
+
+/**
+ * The scale factor (BATTC_GAIN_ONE is 1). Written in the main loop with the
+ * interrupts disabled, read also in the compare interrupts (see
+ * drive_target_stop).
+ */
+uint16_t batt_gain = BATTC_GAIN_ONE;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the ADC channel and take the first sample (waits for one
+ * conversion). The ADC must be enabled already (board_init) with the
+ * settings the conversion needs (BATTC_ADC_CTRLB and BATTC_ADC_REFSEL).
+ *
+ * Returns: uint8_t, 0 if the ADC's settings do not fit (no compensation)
+ */
+uint8_t batt_control_init()
+{
+    /* The filter starts from the first sample */
+    batt_mv = 0;
+    batt_gain = BATTC_GAIN_ONE;
+
+    batt_adc_ok = (BATTC_ADC.CTRLA & ADC_ENABLE_bm) &&
+        (BATTC_ADC.CTRLB & BATTC_ADC_CTRLB_gm) == BATTC_ADC_CTRLB &&
+        (BATTC_ADC.REFCTRL & ADC_REFSEL_gm) == BATTC_ADC_REFSEL;
+    if(!batt_adc_ok) return 0;
+
+    BATTC_ADC.CH0.CTRL = ADC_CH_INPUTMODE_SINGLEENDED_gc;
+    BATTC_ADC.CH0.MUXCTRL = BATTC_ADC_PIN;
+    BATTC_ADC.CH0.INTCTRL = 0;
+
+    BATTC_ADC.CH0.CTRL |= ADC_CH_START_bm;
+    _delay_us(BATTC_CONVERSION_US);
+    batt_tick();
+
+    return 1;
+}
+
+/**
+ * Sampling period - filter the last conversion and start the next one. Must
+ * be called every BATTC_PERIOD.
+ */
+void batt_tick()
+{
+    if(!batt_adc_ok) return;
+
+    if(BATTC_ADC.CH0.INTFLAGS & ADC_CH_CHIF_bm){
+        BATTC_ADC.CH0.INTFLAGS = ADC_CH_CHIF_bm;
+        uint16_t mv = batt_convert(BATTC_ADC.CH0.RES);
+
+        if(batt_mv == 0){
+            batt_filter = (uint32_t) mv << BATTC_FILTER_SHIFT;
+        }else{
+            batt_filter = batt_filter - (batt_filter >> BATTC_FILTER_SHIFT) +
+                mv;
+        }
+        batt_mv = (uint16_t) (batt_filter >> BATTC_FILTER_SHIFT);
+
+        uint16_t v = batt_mv;
+        if(v < BATTC_MIN_MV) v = BATTC_MIN_MV;
+        if(v > BATTC_MAX_MV) v = BATTC_MAX_MV;
+        uint16_t gain = (uint16_t) ((uint32_t) BATTC_NOMINAL_MV*
+                BATTC_GAIN_ONE/v);
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            batt_gain = gain;
+        }
+    }
+
+    BATTC_ADC.CH0.CTRL |= ADC_CH_START_bm;
+}
+
+/**
+ * Get the state of the compensation.
+ *
+ * Returns: uint8_t, 0 if the ADC's settings do not fit (the battery voltage
+ *          reads 0 and the powers are not scaled, see batt_control_init)
+ */
+uint8_t batt_get_ok()
+{
+    return batt_adc_ok;
+}
+
+/**
+ * Get the battery voltage.
+ *
+ * Returns: uint16_t, filtered battery voltage in mV
+ */
+uint16_t batt_get_mv()
+{
+    return batt_mv;
+}
+
+/**
+ * Scale a motor power to the nominal battery voltage: the power times
+ * BATTC_NOMINAL_MV over the battery voltage.
+ *
+ * Parameters: pwr - int16_t, Motor power at BATTC_NOMINAL_MV
+ *
+ * Returns: int16_t, motor power at the battery voltage (at most
+ *          BATTC_MAX_PWR)
+ */
+int16_t batt_scale(int16_t pwr)
+{
+    int32_t scaled = (int32_t) pwr*batt_gain/BATTC_GAIN_ONE;
+
+    if(scaled > BATTC_MAX_PWR){
+        scaled = BATTC_MAX_PWR;
+    }else if(scaled < -BATTC_MAX_PWR){
+        scaled = -BATTC_MAX_PWR;
+    }
+
+    return (int16_t) scaled;
+}
+
+/**
+ * Convert an ADC result to the battery voltage.
+ *
+ * Parameters: res - uint16_t, ADC result (12 bit, unsigned mode)
+ *
+ * Returns: uint16_t, battery voltage in mV
+ */
+uint16_t batt_convert(uint16_t res)
+{
+    if(res < BATTC_ADC_OFFSET) return 0;
+
+    return (uint16_t) ((uint32_t) (res - BATTC_ADC_OFFSET)*
+            BATTC_FULL_SCALE_MV/4096);
+}
@@ -0,0 +1,87 @@
+#ifndef BATT_CONTROL_H
+#define BATT_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The ADC and its input pin for the battery voltage. The battery is measured
+ * through a divider (BATTC_DIVIDER, e.g. 20k over 10k), so that a full
+ * battery stays under the reference (VCC/1.6).
+ *
+ * NOTE: Only channel 0 is set up here, the ADC itself belongs to
+ *       drivers/adc.c (set up in board_init, see main.c), which must not use
+ *       CH0.
+ * NOTE: The pin and the divider are not verified - check them on the board's
+ *       schematic (or measure the voltage on the pin) before relying on the
+ *       compensation.
+ */
+#define BATTC_ADC ADCA
+#define BATTC_ADC_PIN ADC_CH_MUXPOS_PIN1_gc
+#define BATTC_DIVIDER 3
+
+/**
+ * The ADC settings the conversion needs (checked in batt_control_init): 12
+ * bit right adjusted results in the unsigned mode and the VCC/1.6 reference.
+ * Any prescaler converts well within BATTC_PERIOD.
+ */
+#define BATTC_ADC_CTRLB_gm (ADC_CONMODE_bm | ADC_RESOLUTION_gm)
+#define BATTC_ADC_CTRLB ADC_RESOLUTION_12BIT_gc
+#define BATTC_ADC_REFSEL ADC_REFSEL_INTVCC_gc
+
+/* The supply voltage (mV) - the ADC's reference is VCC/1.6 */
+#define BATTC_VCC_MV 3300
+
+/**
+ * The ADC's result at 0 V (the unsigned mode's offset, about 5% of the
+ * range). Not verified (205 is 5% of 4096) - measure it on the robot with
+ * the input grounded.
+ */
+#define BATTC_ADC_OFFSET 205
+
+/* The battery voltage (mV) at the full 12 bit range */
+#define BATTC_FULL_SCALE_MV ((uint32_t) BATTC_VCC_MV*10/16*BATTC_DIVIDER)
+
+/**
+ * One conversion (us, see batt_control_init). With a slower ADC clock the
+ * first sample comes with the next batt_tick.
+ */
+#define BATTC_CONVERSION_US 100
+
+/**
+ * Sampling period (ms) - batt_tick should be called with this period. The
+ * filter averages over about 2^BATTC_FILTER_SHIFT periods (~160 ms), so the
+ * PWM ripple is smoothed out but the sag under load is followed.
+ */
+#define BATTC_PERIOD 20
+#define BATTC_FILTER_SHIFT 3
+
+/**
+ * The motor powers are scaled to BATTC_NOMINAL_MV (a 1S LiPo, see
+ * batt_scale): the motors get the same voltage as from a battery at the
+ * nominal voltage, so the drive control's tuning (and the camera's timing)
+ * holds from a full to an empty battery. The voltage is limited to
+ * BATTC_MIN_MV...BATTC_MAX_MV for the scaling (e.g. on the programmer's
+ * supply).
+ */
+#define BATTC_NOMINAL_MV 3700
+#define BATTC_MIN_MV 3000
+#define BATTC_MAX_MV 4400
+
+/* The scale factor's fixed point one and the biggest motor power (see
+ * motor_set in the drivers) */
+#define BATTC_GAIN_ONE 4096
+#define BATTC_MAX_PWR 1000
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+uint8_t batt_control_init();
+void batt_tick();
+uint8_t batt_get_ok();
+uint16_t batt_get_mv();
+int16_t batt_scale(int16_t pwr);
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * Radio baud rate switching (CMD_BAUD).
+ *
+ * The link runs at RADIOC_BAUD after the start-up. The camera can move a
+ * robot to a faster rate (see baud_rates) - the camera's message rate and
+ * the robot's telemetry are limited by the serial link between the robot and
+ * its XBee, not by the air. The switch is negotiated, so that a robot that
+ * does not make it is not lost:
+ *
+ *  1. The camera proposes a rate (CMD_BAUD: rate/100,0) at the old rate.
+ *  2. The robot replies (CMD_BAUD: rate/100,BAUDC_REPLY_SWITCHING), then
+ *     switches its XBee over the AT command mode (guard time, "+++", guard
+ *     time, ATBD and ATCN) and its USART (radio_init).
+ *  3. The camera switches its own XBee and confirms at the new rate
+ *     (CMD_BAUD: rate/100,1), the robot replies BAUDC_REPLY_DONE.
+ *  4. Without the confirmation in BAUDC_TIMEOUT the robot switches back to
+ *     the old rate and replies BAUDC_REPLY_DONE with the old rate.
+ *
+ * An unsupported rate is refused (BAUDC_REPLY_REFUSED), so is every rate if
+ * the current one is not in baud_rates (the robot could not fall back). A
+ * proposal of the current rate is replied to with BAUDC_REPLY_DONE right
+ * away.
+ *
+ * The robot drops its active command and its transmit slot (see main.c) and
+ * does not send anything else until its XBee has the new rate (see
+ * baud_switching), so the camera gets the robot back standing still and
+ * sending freely. The switch takes a bit over 2*BAUDC_GUARD_TIME.
+ *
+ * See serial-control/pisibot.py (switch_baud) for the camera side and
+ * sim/sim_swarm.c (-B) for the simulation.
+ */
+
+#include "baud_control.h"
+
+/* STURCTS ------------------------------------------------------------------*/
+/* A supported rate and the XBee's command line for it (BD 6 and 7 are the
+ * standard 57600 and 115200, a larger BD is the rate itself in hex) */
+typedef struct baud_rate_struct{
+    uint32_t baud;
+    const char *command;
+} baud_rate_t;
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+uint8_t baud_find(uint32_t baud);
+void baud_reply(uint32_t baud, uint8_t reply);
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+const baud_rate_t baud_rates[BAUDC_RATE_COUNT] = {
+    {57600, "ATBD6,CN\r"},
+    {115200, "ATBD7,CN\r"},
+    {230400, "ATBD38400,CN\r"}
+};
+
+/* The switch: the state, when it started, the new and the old rate (index
+ * in baud_rates) */
+uint8_t baud_state = BAUDC_IDLE;
+uint32_t baud_time = 0;
+uint8_t baud_new = 0;
+uint8_t baud_old = 0;
+
+/* Set while switching back to the old rate */
+uint8_t baud_fallback = 0;
+
+char baud_msg_buf[BAUDC_MSG_BUF_LEN];
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the switching (the link is at RADIOC_BAUD).
+ */
+void baud_control_init()
+{
+    baud_state = BAUDC_IDLE;
+    baud_fallback = 0;
+}
+
+/**
+ * Handle a CMD_BAUD command.
+ *
+ * Parameters:
+ *      rate - int16_t, The rate in hundreds (e.g. 1152 for 115200)
+ *      request - uint8_t, See baudc_request_enum
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if a switch was started
+ */
+uint8_t baud_request(int16_t rate, uint8_t request)
+{
+    uint32_t baud = (uint32_t) rate*100;
+    uint8_t index = baud_find(baud);
+
+    if(request == BAUDC_CONFIRM){
+        if(baud_state == BAUDC_WAIT && index == baud_new){
+            baud_state = BAUDC_IDLE;
+            baud_reply(baud, BAUDC_REPLY_DONE);
+        }else if(baud_state == BAUDC_IDLE && baud == radio_get_baud()){
+            /* The reply to the first confirmation was lost */
+            baud_reply(baud, BAUDC_REPLY_DONE);
+        }
+        return 0;
+    }
+
+    if(baud_state != BAUDC_IDLE) return 0;
+
+    if(baud == radio_get_baud()){
+        baud_reply(baud, BAUDC_REPLY_DONE);
+        return 0;
+    }
+    /* Without the current rate in baud_rates there is no fallback (e.g.
+     * RADIOC_BAUD is not in the table) */
+    uint8_t old = baud_find(radio_get_baud());
+    if(index == BAUDC_RATE_COUNT || old == BAUDC_RATE_COUNT){
+        baud_reply(baud, BAUDC_REPLY_REFUSED);
+        return 0;
+    }
+
+    baud_old = old;
+    baud_new = index;
+    baud_fallback = 0;
+    baud_state = BAUDC_REPLY;
+    baud_reply(baud, BAUDC_REPLY_SWITCHING);
+
+    return 1;
+}
+
+/**
+ * Step the switch. Should be called every few ms.
+ */
+void baud_tick()
+{
+    if(baud_state == BAUDC_IDLE) return;
+
+    uint32_t now = millis();
+
+    if(baud_state == BAUDC_REPLY){
+        /* The guard time starts after the reply */
+        if(radio_tx_free() < RADIOC_TX_BUF_LEN-1) return;
+
+        baud_state = BAUDC_GUARD;
+        baud_time = now;
+    }else if(baud_state == BAUDC_GUARD){
+        if(now - baud_time < BAUDC_GUARD_TIME) return;
+
+        radio_send("+++");
+        baud_state = BAUDC_COMMAND;
+        baud_time = now;
+    }else if(baud_state == BAUDC_COMMAND){
+        if(now - baud_time < BAUDC_GUARD_TIME) return;
+
+        radio_send(baud_rates[baud_new].command);
+        baud_state = BAUDC_APPLY;
+        baud_time = now;
+    }else if(baud_state == BAUDC_APPLY){
+        if(radio_tx_free() < RADIOC_TX_BUF_LEN-1 ||
+                now - baud_time < BAUDC_APPLY_TIME){
+            return;
+        }
+
+        /* The XBee's replies ("OK") are dropped with the receive buffer */
+        radio_set_baud(baud_rates[baud_new].baud);
+        baud_time = now;
+
+        if(baud_fallback){
+            baud_state = BAUDC_IDLE;
+            baud_reply(baud_rates[baud_new].baud, BAUDC_REPLY_DONE);
+        }else{
+            baud_state = BAUDC_WAIT;
+        }
+    }else if(baud_state == BAUDC_WAIT){
+        if(now - baud_time < BAUDC_TIMEOUT) return;
+
+        /* No confirmation - back to the old rate (after the telemetry that
+         * is still being sent) */
+        baud_new = baud_old;
+        baud_fallback = 1;
+        baud_state = BAUDC_REPLY;
+    }
+}
+
+/**
+ * Check if the robot has to keep quiet (the XBee's guard times). Nothing but
+ * the switch should be sent meanwhile.
+ *
+ * Returns: 0 or 1 (uint8_t)
+ */
+uint8_t baud_switching()
+{
+    return baud_state != BAUDC_IDLE && baud_state != BAUDC_WAIT;
+}
+
+/**
+ * Find a supported rate.
+ *
+ * Parameters: baud - uint32_t, The rate
+ *
+ * Returns: uint8_t, index in baud_rates or BAUDC_RATE_COUNT if not supported
+ */
+uint8_t baud_find(uint32_t baud)
+{
+    uint8_t i = 0;
+    for(; i < BAUDC_RATE_COUNT; i++){
+        if(baud_rates[i].baud == baud) break;
+    }
+
+    return i;
+}
+
+/**
+ * Send a CMD_BAUD reply.
+ *
+ * Parameters:
+ *      baud - uint32_t, The rate
+ *      reply - uint8_t, See baudc_reply_enum
+ */
+void baud_reply(uint32_t baud, uint8_t reply)
+{
+    int32_t data[2] = {(int32_t) (baud/100), reply};
+
+    if(make_msg(baud_msg_buf, BAUDC_MSG_BUF_LEN, CMD_BAUD, data, 2)){
+        radio_send(baud_msg_buf);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef BAUD_CONTROL_H
+#define BAUD_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include "drivers/board.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "radio_control.h"
+#include "cmd_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The XBee's guard time (ms): the silence before and after "+++" that puts
+ * it into the command mode. Must be longer than the XBee's GT (1 s by
+ * default, set with XCTU).
+ */
+#define BAUDC_GUARD_TIME 1100
+
+/* The XBee applies the new rate after its command line (ms) */
+#define BAUDC_APPLY_TIME 50
+
+/**
+ * How long (ms) the robot waits for the camera's confirmation at the new
+ * rate before it falls back to the old one.
+ */
+#define BAUDC_TIMEOUT 3000
+
+/* The supported rates (see baud_rates in baud_control.c) */
+#define BAUDC_RATE_COUNT 3
+
+/* Reply buffer (see make_msg in cmd_control.c) */
+#define BAUDC_MSG_BUF_LEN 40
+
+/* ENUMS --------------------------------------------------------------------*/
+/* The second argument of CMD_BAUD */
+enum baudc_request_enum{
+    BAUDC_PROPOSE = 0,
+    BAUDC_CONFIRM = 1
+};
+
+/* The second argument of the robot's CMD_BAUD reply */
+enum baudc_reply_enum{
+    BAUDC_REPLY_SWITCHING = 0,
+    BAUDC_REPLY_DONE = 1,
+    BAUDC_REPLY_REFUSED = 2
+};
+
+/* The switch (see baud_tick) */
+enum baudc_state_enum{
+    BAUDC_IDLE = 0,
+    BAUDC_REPLY = 1,
+    BAUDC_GUARD = 2,
+    BAUDC_COMMAND = 3,
+    BAUDC_APPLY = 4,
+    BAUDC_WAIT = 5
+};
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void baud_control_init();
+uint8_t baud_request(int16_t rate, uint8_t request);
+void baud_tick();
+uint8_t baud_switching();
+
+#endif
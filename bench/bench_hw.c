@@ -0,0 +1,137 @@
+/**
+ * The drivers and the firmware modules the benchmarked functions call but
+ * that are not benchmarked (see bench_main.c). The inputs are set by the
+ * benchmark and the outputs go nowhere, so only the benchmarked function's
+ * own cycles are counted.
+ */
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <string.h>
+#include "drivers/board.h"
+#include "drivers/com.h"
+#include "drivers/motor.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "bench_hw.h"
+#include "batt_control.h"
+#include "gyro_control.h"
+#include "killsw_control.h"
+#include "power_control.h"
+#include "radio_control.h"
+#include "task_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+uint32_t bench_millis = 0;
+int16_t bench_left_enc = 0;
+int16_t bench_right_enc = 0;
+
+/* The next string radio_receive returns (NULL - nothing received) */
+const char *bench_rx = NULL;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/* Board */
+uint32_t millis(void)
+{
+    return bench_millis;
+}
+
+/* Motors and encoders */
+void motor_init(void)
+{
+}
+
+void motor_set(int16_t pwr_left, int16_t pwr_right)
+{
+    (void) pwr_left;
+    (void) pwr_right;
+}
+
+void quadrature_init(void)
+{
+}
+
+int16_t get_left_enc(void)
+{
+    return bench_left_enc;
+}
+
+int16_t get_right_enc(void)
+{
+    return bench_right_enc;
+}
+
+void left_enc_reset(void)
+{
+    bench_left_enc = 0;
+}
+
+void right_enc_reset(void)
+{
+    bench_right_enc = 0;
+}
+
+/* Radio */
+uint8_t radio_receive(char *str, uint16_t size)
+{
+    if(bench_rx == NULL) return 0;
+
+    strncpy(str, bench_rx, size-1);
+    str[size-1] = 0;
+    bench_rx = NULL;
+
+    return 1;
+}
+
+uint8_t radio_send(const char *str)
+{
+    (void) str;
+    return 1;
+}
+
+uint8_t radio_tx_free()
+{
+    return RADIOC_TX_BUF_LEN-1;
+}
+
+/* Kill switch, power, tasks, the gyro and the battery */
+uint8_t killsw_fired()
+{
+    return 0;
+}
+
+uint16_t power_get_idle_permille()
+{
+    return 500;
+}
+
+task_t *task_get(uint8_t task_id)
+{
+    (void) task_id;
+    return NULL;
+}
+
+int32_t gyro_get_z_mdps()
+{
+    return -90000;
+}
+
+uint16_t batt_get_mv()
+{
+    return 3700;
+}
+
+/* The scaling of a nearly empty battery (3.3 V), the same math as
+ * batt_scale */
+int16_t batt_scale(int16_t pwr)
+{
+    int32_t scaled = (int32_t) pwr*
+        (BATTC_NOMINAL_MV*(int32_t) BATTC_GAIN_ONE/3300)/BATTC_GAIN_ONE;
+
+    if(scaled > BATTC_MAX_PWR){
+        scaled = BATTC_MAX_PWR;
+    }else if(scaled < -BATTC_MAX_PWR){
+        scaled = -BATTC_MAX_PWR;
+    }
+
+    return (int16_t) scaled;
+}
@@ -0,0 +1,14 @@
+#ifndef BENCH_HW_H
+#define BENCH_HW_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+/* The inputs of the benchmarked functions (see bench_hw.c) */
+extern uint32_t bench_millis;
+extern int16_t bench_left_enc;
+extern int16_t bench_right_enc;
+extern const char *bench_rx;
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * Cycle counts of the firmware's hot paths. Runs in an AVR instruction set
+ * simulator (simavr, see CMakeLists.txt) - the results are exact and do not
+ * need a robot.
+ *
+ * Every benchmark calls a function BENCH_CALLS times with changing inputs
+ * (see bench_hw.c) and measures every call with a 16 bit timer running at
+ * the CPU clock. The cost of reading the timer is measured first and taken
+ * off, so the numbers are the cycles of the call itself (including the call
+ * and the return).
+ *
+ * The results go to the USART (simavr prints it), one CSV line per
+ * benchmark after the header:
+ *      cycles,function,calls,min,avg,max
+ *
+ * NOTE: simavr has no xmega core, so the image is built for a classic AVR
+ *       (BENCH_MCU in CMakeLists.txt). The xmega does PUSH, ST and the calls
+ *       in fewer cycles, so the xmega numbers are a few percent lower - but
+ *       the changes between two firmware versions are the same.
+ */
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "bench_hw.h"
+#include "cmd_control.h"
+#include "drive_control.h"
+#include "telem_control.h"
+#include "trace_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Calls per benchmark */
+#define BENCH_CALLS 64
+
+/* USART baud rate (simavr does not care) */
+#define BENCH_BAUD 57600
+
+/* The received radio strings (see make_msg in serial-control/telemetry.py) */
+#define BENCH_MSG_DRIVE "0000450106C8,12C7F"
+#define BENCH_MSG_MOTORS "0000450308-1F4,1F4E5"
+#define BENCH_MSG_BAD "0000450106C8,12C00"
+#define BENCH_MSG_OTHERS "0000460106C8,12C80" "00004702065A,19071" \
+    "0000480308-1F4,1F4E8" "0000450207-5A,1909D"
+#define BENCH_MSG_MULTI "0000FF0A2C45040C151C233-1F4,1F41C8,12C25A,190" \
+    "3-1F4,1F4AB"
+
+#if defined(__AVR_XMEGA__)
+#error "The benchmark image is for the simulator (see BENCH_MCU)"
+#endif
+
+/* STURCTS ------------------------------------------------------------------*/
+/* The cycles of one benchmark */
+typedef struct bench_struct{
+    uint16_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+} bench_t;
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void bench_uart_init();
+void bench_putc(char c);
+void bench_puts(const char *str);
+void bench_put_u32(uint32_t value);
+void bench_add(bench_t *bench, uint32_t cycles);
+void bench_print(const char *name, bench_t *bench);
+void bench_get_cmd(const char *name, const char *rx);
+
+/* The private functions and globals of the benchmarked modules */
+uint8_t check_checksum(char *radio_buf, uint8_t data_len);
+int16_t pid_control(uint16_t c_pwr, int16_t *pwr_left, int16_t *pwr_right);
+extern char *radio_buf_ptr;
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The cycles of reading the timer (see bench_start and bench_stop) */
+uint16_t bench_overhead = 0;
+
+char bench_buf[TELEMC_BUF_LEN];
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/* Start counting the cycles */
+static inline __attribute__((always_inline)) void bench_start()
+{
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    __asm__ __volatile__("" ::: "memory");
+}
+
+/* Cycles since bench_start (at most one overflow, ~130k cycles) */
+static inline __attribute__((always_inline)) uint32_t bench_stop()
+{
+    __asm__ __volatile__("" ::: "memory");
+    uint16_t cnt = TCNT1;
+    uint32_t cycles = cnt;
+    if(TIFR1 & _BV(TOV1)) cycles += 65536UL;
+
+    return cycles - bench_overhead;
+}
+
+/* Measure one call */
+#define BENCH(bench, call) do{ \
+    bench_start(); \
+    call; \
+    bench_add((bench), bench_stop()); \
+}while(0)
+
+void bench_uart_init()
+{
+    UBRR0 = F_CPU/16/BENCH_BAUD - 1;
+    UCSR0B = _BV(TXEN0);
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+}
+
+void bench_putc(char c)
+{
+    while(!(UCSR0A & _BV(UDRE0)));
+    UDR0 = c;
+}
+
+void bench_puts(const char *str)
+{
+    for(; *str != 0; str++) bench_putc(*str);
+}
+
+void bench_put_u32(uint32_t value)
+{
+    char buf[11];
+    ultoa(value, buf, 10);
+    bench_puts(buf);
+}
+
+/**
+ * Add a call to a benchmark.
+ *
+ * Parameters:
+ *      bench - bench_t*, The benchmark
+ *      cycles - uint32_t, The call's cycles
+ */
+void bench_add(bench_t *bench, uint32_t cycles)
+{
+    if(bench->calls == 0 || cycles < bench->min) bench->min = cycles;
+    if(cycles > bench->max) bench->max = cycles;
+    bench->sum += cycles;
+    bench->calls++;
+}
+
+/**
+ * Print a benchmark's line (see the file comment).
+ *
+ * Parameters:
+ *      name - const char*, The benchmark
+ *      bench - bench_t*, The benchmark's cycles
+ */
+void bench_print(const char *name, bench_t *bench)
+{
+    bench_puts("cycles,");
+    bench_puts(name);
+    bench_putc(',');
+    bench_put_u32(bench->calls);
+    bench_putc(',');
+    bench_put_u32(bench->min);
+    bench_putc(',');
+    bench_put_u32(bench->calls ? bench->sum / bench->calls : 0);
+    bench_putc(',');
+    bench_put_u32(bench->max);
+    bench_puts("\n");
+}
+
+/**
+ * Benchmark get_cmd on a received radio string: all the calls until the
+ * string is parsed (get_cmd returns one message per call) are one sample.
+ *
+ * Parameters:
+ *      name - const char*, The benchmark
+ *      rx - const char*, The received string
+ */
+void bench_get_cmd(const char *name, const char *rx)
+{
+    bench_t bench = {0};
+
+    uint8_t i = 0;
+    for(; i < BENCH_CALLS; i++){
+        uint32_t cycles = 0;
+
+        bench_rx = rx;
+        do{
+            bench_start();
+            get_cmd();
+            cycles += bench_stop();
+        }while(*radio_buf_ptr != 0);
+
+        bench_add(&bench, cycles);
+    }
+
+    bench_print(name, &bench);
+}
+
+int main(void)
+{
+    bench_uart_init();
+
+    /* Timer 1 counts the CPU cycles */
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+
+    /* The cost of reading the timer */
+    bench_start();
+    bench_overhead = (uint16_t) bench_stop();
+
+    drive_control_init();
+    init_cmd_control();
+    telem_control_init();
+    trace_control_init();
+
+    bench_puts("cycles,function,calls,min,avg,max\n");
+
+    uint8_t i;
+    bench_t bench;
+
+    /* Parser */
+    char msg[] = BENCH_MSG_DRIVE;
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        BENCH(&bench, check_checksum(msg, 6));
+    }
+    bench_print("check_checksum", &bench);
+
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        BENCH(&bench, get_cmd());
+    }
+    bench_print("get_cmd idle", &bench);
+
+    bench_get_cmd("get_cmd drive", BENCH_MSG_DRIVE);
+    bench_get_cmd("get_cmd motors", BENCH_MSG_MOTORS);
+    bench_get_cmd("get_cmd bad checksum", BENCH_MSG_BAD);
+    bench_get_cmd("get_cmd 4 robots", BENCH_MSG_OTHERS);
+    bench_get_cmd("get_cmd multi", BENCH_MSG_MULTI);
+
+    /* Motion control - the encoders move like when driving at ~400 */
+    int16_t pwr_left, pwr_right;
+    bench_left_enc = 0;
+    bench_right_enc = 0;
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_left_enc -= 7;
+        bench_right_enc -= (i & 1) ? 8 : 6;
+        BENCH(&bench, pid_control(400, &pwr_left, &pwr_right));
+    }
+    bench_print("pid_control", &bench);
+
+    drive_control_reset();
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_left_enc -= 7;
+        bench_right_enc -= (i & 1) ? 8 : 6;
+        BENCH(&bench, drive(400, 400));
+    }
+    bench_print("drive", &bench);
+
+    drive_control_reset();
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_left_enc -= 7;
+        bench_right_enc -= (i & 1) ? 8 : 6;
+        BENCH(&bench, drive_mm(1000, 400, DRIVEC_STOP_COAST));
+    }
+    bench_print("drive_mm", &bench);
+
+    drive_control_reset();
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_left_enc -= 7;
+        bench_right_enc += (i & 1) ? 8 : 6;
+        BENCH(&bench, turn_deg(90, 400, DRIVEC_STOP_COAST));
+    }
+    bench_print("turn_deg", &bench);
+
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_left_enc -= 7;
+        bench_right_enc -= (i & 1) ? 8 : 6;
+        BENCH(&bench, update_pose());
+    }
+    bench_print("update_pose", &bench);
+
+    /* Telemetry and the flight recorder */
+    int32_t data[8] = {0x1F, 12345, -500, 500, 1000, -1000, 180, 42};
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        data[1] += 10;
+        BENCH(&bench, make_msg(bench_buf, TELEMC_BUF_LEN, CMD_TELEM, data,
+                    8));
+    }
+    bench_print("make_msg 8 args", &bench);
+
+    telem_subscribe(TELEM_ENC | TELEM_DIST | TELEM_PID | TELEM_PWR |
+            TELEM_POSE | TELEM_TIMING | TELEM_GYRO | TELEM_BATT, 1);
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_millis += TELEMC_PERIOD;
+        BENCH(&bench, telem_tick());
+    }
+    bench_print("telem_tick all", &bench);
+
+    trace_arm(0, 0, 0);
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_millis += 2;
+        BENCH(&bench, trace_record());
+    }
+    bench_print("trace_record", &bench);
+
+    trace_rec_start();
+    bench = (bench_t) {0};
+    for(i = 0; i < BENCH_CALLS; i++){
+        bench_millis += 2;
+        bench_left_enc -= 7;
+        bench_right_enc -= (i & 1) ? 8 : 6;
+        BENCH(&bench, trace_record());
+    }
+    bench_print("trace_record input", &bench);
+
+    /* Wait for the last byte - simavr stops when the CPU sleeps for good */
+    while(!(UCSR0A & _BV(UDRE0)));
+    cli();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sleep_cpu();
+
+    return 0;
+}
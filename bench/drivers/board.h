@@ -0,0 +1,14 @@
+/**
+ * Board driver functions the benchmarked modules use (see bench_hw.c). The
+ * benchmark image does not use the Pisibot drivers - they are written for the
+ * xmega.
+ */
+#ifndef BENCH_DRIVERS_BOARD_H
+#define BENCH_DRIVERS_BOARD_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+uint32_t millis(void);
+
+#endif
@@ -0,0 +1,9 @@
+/* Radio driver (cmd_control.h and radio_control.h include it). The
+ * benchmarked modules use none of it - they receive with radio_receive (see
+ * bench_hw.c). */
+#ifndef BENCH_DRIVERS_COM_H
+#define BENCH_DRIVERS_COM_H
+
+#include <stdint.h>
+
+#endif
@@ -0,0 +1,15 @@
+/* Motor and encoder driver functions (see bench_hw.c) */
+#ifndef BENCH_DRIVERS_MOTOR_H
+#define BENCH_DRIVERS_MOTOR_H
+
+#include <stdint.h>
+
+void motor_init(void);
+void motor_set(int16_t pwr_left, int16_t pwr_right);
+void quadrature_init(void);
+int16_t get_left_enc(void);
+int16_t get_right_enc(void);
+void left_enc_reset(void);
+void right_enc_reset(void);
+
+#endif
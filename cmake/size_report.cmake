@@ -0,0 +1,63 @@
+# Per-symbol RAM/flash breakdown of the firmware with a budget check.
+#
+# Run by the size-report target (see CMakeLists.txt):
+#   cmake -DELF=<file.elf> -DNM=avr-nm -DSIZE=avr-size
+#         -DRAM_BUDGET=<bytes> -DFLASH_BUDGET=<bytes> -P size_report.cmake
+#
+# RAM is .data+.bss (the stack needs the rest of the SRAM), flash is
+# .text+.data (the initial values of .data are stored in flash). Fails if
+# either of them is over the budget.
+
+cmake_policy(SET CMP0007 NEW)
+
+execute_process(COMMAND ${SIZE} -A ${ELF} OUTPUT_VARIABLE size_out
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${SIZE} failed for ${ELF}")
+endif()
+
+set(text 0)
+set(data 0)
+set(bss 0)
+string(REPLACE "\n" ";" size_lines "${size_out}")
+foreach(line ${size_lines})
+    if(line MATCHES "^\\.(text|data|bss)[ \t]+([0-9]+)")
+        set(${CMAKE_MATCH_1} ${CMAKE_MATCH_2})
+    endif()
+endforeach()
+
+execute_process(COMMAND ${NM} --size-sort -S -t d ${ELF}
+    OUTPUT_VARIABLE nm_out RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${NM} failed for ${ELF}")
+endif()
+
+# Biggest symbols first
+string(REPLACE "\n" ";" nm_lines "${nm_out}")
+list(REVERSE nm_lines)
+
+message("RAM (.data/.bss) symbols:")
+foreach(line ${nm_lines})
+    if(line MATCHES "^[0-9]+ 0*([0-9]+) [bBdD] (.+)$")
+        message("  ${CMAKE_MATCH_1}\t${CMAKE_MATCH_2}")
+    endif()
+endforeach()
+
+message("Flash (.text) symbols:")
+foreach(line ${nm_lines})
+    if(line MATCHES "^[0-9]+ 0*([0-9]+) [tTrR] (.+)$")
+        message("  ${CMAKE_MATCH_1}\t${CMAKE_MATCH_2}")
+    endif()
+endforeach()
+
+math(EXPR ram "${data} + ${bss}")
+math(EXPR flash "${text} + ${data}")
+message("RAM: ${ram}/${RAM_BUDGET} bytes (.data ${data}, .bss ${bss})")
+message("Flash: ${flash}/${FLASH_BUDGET} bytes")
+
+if(ram GREATER RAM_BUDGET)
+    message(FATAL_ERROR "RAM budget exceeded: ${ram} > ${RAM_BUDGET}")
+endif()
+if(flash GREATER FLASH_BUDGET)
+    message(FATAL_ERROR "Flash budget exceeded: ${flash} > ${FLASH_BUDGET}")
+endif()
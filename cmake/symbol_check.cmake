@@ -0,0 +1,49 @@
+# Fails if the firmware links the soft-float library or the printf family.
+#
+# Run after every firmware build (see CMakeLists.txt):
+#   cmake -DELF=<file.elf> -DNM=avr-nm -P symbol_check.cmake
+#
+# The control math is fixed point (see DRIVEC_PID_SCALE in drive_control.h)
+# and the text replies are built with put_text and put_dec (cmd_control.c).
+# A float or a sprintf anywhere pulls in a few KB of flash and the slowest
+# calls of the loop - find the caller with -Wl,--trace-symbol=<symbol>.
+
+cmake_policy(SET CMP0007 NEW)
+
+set(forbidden
+    # Soft-float (libgcc and avr-libc's libm)
+    "^__(add|sub|mul|div|neg)sf3$"
+    "^__(fix|fixuns)sf[sd]i$"
+    "^__float(un)?[sd]isf$"
+    "^__(cmp|eq|ne|lt|le|gt|ge|unord)sf2$"
+    "^__fp_"
+    "^(l?round|trunc|floor|ceil|fabs|sqrt|sin|cos|tan|atan2?|pow|exp|log)f?$"
+    # The printf family and the float conversions
+    "printf$"
+    "^dtostr"
+)
+
+execute_process(COMMAND ${NM} ${ELF} OUTPUT_VARIABLE nm_out
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${NM} failed for ${ELF}")
+endif()
+
+set(found)
+string(REPLACE "\n" ";" nm_lines "${nm_out}")
+foreach(line ${nm_lines})
+    if(line MATCHES "^[0-9a-fA-F]* *[a-zA-Z] (.+)$")
+        set(symbol ${CMAKE_MATCH_1})
+        foreach(pattern ${forbidden})
+            if(symbol MATCHES "${pattern}")
+                list(APPEND found ${symbol})
+            endif()
+        endforeach()
+    endif()
+endforeach()
+
+if(found)
+    list(REMOVE_DUPLICATES found)
+    string(REPLACE ";" " " found "${found}")
+    message(FATAL_ERROR "${ELF} links soft-float or printf: ${found}")
+endif()
@@ -13,12 +13,19 @@
  */
 
 #include "cmd_control.h"
+#include "radio_control.h"
+#include "trace_control.h"
 
 /* PRIVATE PROTOTYPES -------------------------------------------------------*/
 uint8_t jump_to_preamble(char **radio_buf);
 uint8_t get_byte(char *radio_buf, uint16_t offset);
 uint8_t check_checksum(char *radio_buf, uint8_t data_len);
 uint8_t get_data(char *radio_buf, uint8_t data_len);
+uint8_t get_args(char *data_str, uint8_t data_len);
+uint8_t get_record(char *radio_buf, uint8_t data_len, uint8_t *cmd_type);
+uint8_t put_hex(char *buf, uint32_t value, uint8_t digits);
+void cmd_stats_window();
+void cmd_drop(uint8_t reason);
 
 /* PRIVATE GLOBALS ----------------------------------------------------------*/
 /* Current command */
@@ -30,6 +37,13 @@ char radio_buffer[CMDC_MAX_BUF_LEN];
 /* Radio buffer pointer - used to parse the buffer */
 char *radio_buf_ptr = radio_buffer;
 
+/* Radio link statistics and the counts of the current window */
+cmd_stats_t cmd_stats;
+uint32_t cmd_stats_start = 0;
+uint16_t cmd_stats_msgs = 0;
+uint16_t cmd_stats_accepted = 0;
+uint16_t cmd_stats_dropped = 0;
+
 /* FUNCTIONS ----------------------------------------------------------------*/
 /**
  * Initialize command control.
@@ -45,6 +59,23 @@ void init_cmd_control()
     for(; i < CMDC_MAX_DATA_ARG_LEN; i++){
         cmd.data[i] = 0;
     }
+
+    memset(&cmd_stats, 0, sizeof(cmd_stats));
+    cmd_stats.accepted_permille = 1000;
+    cmd_stats_start = millis();
+    cmd_stats_msgs = 0;
+    cmd_stats_accepted = 0;
+    cmd_stats_dropped = 0;
+}
+
+/**
+ * Drop the rest of the radio buffer (the messages that have not been parsed
+ * yet), e.g. after an emergency stop.
+ */
+void flush_cmds()
+{
+    radio_buffer[0] = 0;
+    radio_buf_ptr = radio_buffer;
 }
 
 /**
@@ -65,7 +96,8 @@ void init_cmd_control()
  * L cannot represent the value 0 (cannot be 00).
  *
  * Data must be atleast 1 symbol. Multiple argument command data must be
- * separated with ARG_DELIM (see cmd_control.h). The argument limit is 256.
+ * separated with ARG_DELIM (see cmd_control.h). The argument limit is
+ * CMDC_MAX_DATA_ARG_LEN (see cmd_control.h).
  *
  * Checksum is calculated by adding all symbols' ASCII values after preambles
  * and doing a remainder division on that sum by 255 (or simply put:
@@ -96,42 +128,80 @@ void init_cmd_control()
  */
 cmd_t *get_cmd()
 {
-    if(!radio_gets(radio_buf_ptr) && *radio_buf_ptr == 0) return NULL;
+    /*
+     * A new radio buffer replaces the rest of the old one. It is always
+     * written to the beginning of radio_buffer - the parse position moves
+     * forward with every skipped message and would walk past the end of
+     * radio_buffer on a busy channel.
+     */
+    cmd_stats_window();
+
+    if(radio_receive(radio_buffer, CMDC_MAX_BUF_LEN)){
+        radio_buf_ptr = radio_buffer;
+        trace_rec_rx(radio_buffer);
+        cmd_stats.strings++;
+    }else if(*radio_buf_ptr == 0){
+        return NULL;
+    }else{
+        trace_rec_rx("");
+    }
 
     /* Check message length */
     uint16_t radio_buf_len = strnlen(radio_buf_ptr, CMDC_MAX_BUF_LEN);
     if(radio_buf_len < CMDC_MIN_BUF_LEN || radio_buf_len == CMDC_MAX_BUF_LEN){
+        /* The rest of a parsed string is always short */
+        if(radio_buf_ptr == radio_buffer) cmd_drop(CMDC_DROP_SHORT);
+
         /* Clearing out the buffer for indicating that parsing is completed */
         radio_buffer[0] = 0;
         radio_buf_ptr = radio_buffer;
         return NULL;
     }
 
-    /* Find the next message */
-    if(!jump_to_preamble(&radio_buf_ptr)){
-        radio_buffer[0] = 0;
-        radio_buf_ptr = radio_buffer;
-        return NULL;
-    }
+    /*
+     * Find the next message to this robot. The messages to (and from) the
+     * other robots are skipped in one go - only the ID is checked, and on a
+     * busy channel every one of them would otherwise cost a parser run.
+     */
+    while(1){
+        uint8_t at_start = (radio_buf_ptr == radio_buffer);
+        if(!jump_to_preamble(&radio_buf_ptr)){
+            if(at_start) cmd_drop(CMDC_DROP_PREAMBLE);
+
+            radio_buffer[0] = 0;
+            radio_buf_ptr = radio_buffer;
+            return NULL;
+        }
+        if(strnlen(radio_buf_ptr, CMDC_MIN_BUF_LEN) < CMDC_MIN_BUF_LEN){
+            cmd_drop(CMDC_DROP_SHORT);
+
+            radio_buffer[0] = 0;
+            radio_buf_ptr = radio_buffer;
+            return NULL;
+        }
+
+        /* Check ID */
+        uint8_t id = get_byte(radio_buf_ptr, OFFSET_ID);
+        if(id == ROBOT_ID || id == 255) break;
 
-    /* Check ID */
-    uint8_t id = get_byte(radio_buf_ptr, OFFSET_ID);
-    if(id != ROBOT_ID && id != 255){
         /* Indicator for moving to the next message */
         radio_buf_ptr += 4;
-        return NULL;
+        cmd_stats.foreign++;
+        cmd_stats_msgs++;
     }
 
     /* Get length of data substring in the message */
     uint8_t data_len = get_byte(radio_buf_ptr, OFFSET_LEN);
     if(!data_len){
         radio_buf_ptr += 4;
+        cmd_drop(CMDC_DROP_LEN);
         return NULL;
     }
 
     /* Check checksum */
     if(!check_checksum(radio_buf_ptr, data_len)){
         radio_buf_ptr += 4;
+        cmd_drop(CMDC_DROP_CHECKSUM);
         return NULL;
     }
 
@@ -139,21 +209,85 @@ cmd_t *get_cmd()
     uint8_t cmd_type = get_byte(radio_buf_ptr, OFFSET_TYPE);
     if(cmd_type > CMDC_LAST_CMD_TYPE){
         radio_buf_ptr += 4;
+        cmd_drop(CMDC_DROP_TYPE);
         return NULL;
     }
 
     /* Get command data and data array length (cmd.data_len) */
-    if(!get_data(radio_buf_ptr, data_len)){
+    if(cmd_type == CMD_MULTI){
+        /* Only this robot's record (and its type) */
+        uint8_t record = get_record(radio_buf_ptr, data_len, &cmd_type);
+        if(record != 1){
+            radio_buf_ptr += 4;
+            if(record == CMDC_NO_RECORD){
+                cmd_stats.foreign++;
+                cmd_stats_msgs++;
+            }else{
+                cmd_drop(CMDC_DROP_DATA);
+            }
+            return NULL;
+        }
+    }else if(!get_data(radio_buf_ptr, data_len)){
         radio_buf_ptr += 4;
+        cmd_drop(CMDC_DROP_DATA);
         return NULL;
     }
 
     cmd.type = cmd_type;
     cmd.done = 0;
     radio_buf_ptr += 4;
+    cmd_stats.accepted++;
+    cmd_stats_msgs++;
+    cmd_stats_accepted++;
     return &cmd;
 }
 
+/**
+ * Get the radio link statistics (see cmd_stats_t in cmd_control.h).
+ *
+ * Returns: pointer to cmd_stats_t
+ */
+cmd_stats_t *get_cmd_stats()
+{
+    return &cmd_stats;
+}
+
+/**
+ * Close the statistics window (see CMDC_STATS_WINDOW) if it is over. A window
+ * without any accepted or dropped messages keeps the last ratio.
+ */
+void cmd_stats_window()
+{
+    uint32_t window = millis() - cmd_stats_start;
+    if(window < CMDC_STATS_WINDOW) return;
+
+    cmd_stats.msgs_per_s = (uint16_t) ((uint32_t) cmd_stats_msgs*1000 /
+            window);
+
+    uint16_t own = cmd_stats_accepted + cmd_stats_dropped;
+    if(own > 0){
+        cmd_stats.accepted_permille = (uint16_t) ((uint32_t)
+                cmd_stats_accepted*1000 / own);
+    }
+
+    cmd_stats_start += window;
+    cmd_stats_msgs = 0;
+    cmd_stats_accepted = 0;
+    cmd_stats_dropped = 0;
+}
+
+/**
+ * Count a dropped message (or string).
+ *
+ * Parameters: reason - uint8_t, See cmdc_drop_enum in cmd_control.h
+ */
+void cmd_drop(uint8_t reason)
+{
+    cmd_stats.dropped[reason]++;
+    cmd_stats_msgs++;
+    cmd_stats_dropped++;
+}
+
 /**
  * Jump to nearest preamble. See the CMDC_PREAMBLE constant in cmd_control.h
  *
@@ -227,8 +361,23 @@ uint8_t get_byte(char *radio_buf, uint16_t offset)
  */
 uint8_t get_data(char *radio_buf, uint8_t data_len)
 {
-    char *data_str = radio_buf+OFFSET_DATA;
+    return get_args(radio_buf+OFFSET_DATA, data_len);
+}
 
+/**
+ * Parse the arguments (see get_data) into the global cmd struct.
+ *
+ * Parameters:
+ *      data_str - string, The arguments (hexadecimal, separated by
+ *                 ARG_DELIM). NOTE: data_str[data_len] is overwritten with 0.
+ *      data_len - uint8_t, Length of the arguments substring
+ *
+ * Returns:
+ *      0 if data conversion was unsuccessful
+ *      1 if data conversion was successful
+ */
+uint8_t get_args(char *data_str, uint8_t data_len)
+{
     uint16_t data_str_len = strnlen(data_str, CMDC_MAX_BUF_LEN);
     if(data_str_len < data_len || data_str_len == CMDC_MAX_BUF_LEN){
         return 0;
@@ -245,6 +394,10 @@ uint8_t get_data(char *radio_buf, uint8_t data_len)
             }
         }
 
+        if(arg_count > CMDC_MAX_DATA_ARG_LEN){
+            return 0;
+        }
+
         for(i = arg_count; i > 0; i--){
             char *last_delim_ptr = strrchr(data_str, ARG_DELIM);
 
@@ -283,6 +436,74 @@ uint8_t get_data(char *radio_buf, uint8_t data_len)
     return 0;
 }
 
+/**
+ * Get this robot's record from a multi-robot frame (CMD_MULTI). One frame to
+ * the broadcast ID carries the commands of several robots, so a fleet update
+ * has only one preamble, header and checksum. The data substring is:
+ *
+ *      FFNNOO...OORR...R
+ *
+ *      FF - the ID of the first robot in the table (2 symbols)
+ *      NN - robot count in the table (2 symbols)
+ *      OO - the offset of every robot's record from the start of the data
+ *           substring (2 symbols each, robots FF, FF+1, ...). A record ends
+ *           where the next robot's record starts (the last one at the end of
+ *           the data). An empty record - nothing for that robot.
+ *      R - the record: the command type (1 symbol, so types up to 15) and
+ *          the arguments like in any other message
+ *
+ * The robot finds its record in the table by its ID, without going through
+ * the other records. Example (motors 300,300 to 0x45 and -300,300 to 0x47,
+ * nothing to 0x46):
+ *
+ *      0000 FF0A1B 4503 0A1212 312C,12C 3-12C,12C FC
+ *      (without the spaces: 0000FF0A1B45030A1212312C,12C3-12C,12CFC)
+ *
+ * NOTE: A record cannot be a CMD_MULTI.
+ *
+ * Parameters:
+ *      radio_buf - string, Radio buffer (must be jumped to the beginning of
+ *                  the desired message, see jump_to_preamble function)
+ *      data_len - uint8_t, length of data substring in the message
+ *      cmd_type - uint8_t*, Where to write the command type of the record
+ *
+ * Returns:
+ *      0 if the record (or the table) is invalid
+ *      1 if the record was parsed (into the global cmd struct)
+ *      CMDC_NO_RECORD if there is nothing for this robot in the frame
+ */
+uint8_t get_record(char *radio_buf, uint8_t data_len, uint8_t *cmd_type)
+{
+    uint8_t first_id = get_byte(radio_buf, OFFSET_DATA+CMDC_MULTI_FIRST_ID);
+    uint8_t count = get_byte(radio_buf, OFFSET_DATA+CMDC_MULTI_COUNT);
+    uint8_t index = (uint8_t) (ROBOT_ID - first_id);
+    uint16_t table_end = CMDC_MULTI_TABLE + 2*(uint16_t) count;
+    if(table_end > data_len) return 0;
+    if(index >= count) return CMDC_NO_RECORD;
+
+    uint16_t table = OFFSET_DATA + CMDC_MULTI_TABLE + 2*(uint16_t) index;
+    uint8_t start = get_byte(radio_buf, table);
+    uint8_t end = (index+1 < count) ? get_byte(radio_buf, table+2) :
+        data_len;
+
+    /* The type and at least one symbol of arguments */
+    if(start < table_end || end > data_len || end < start) return 0;
+    if(end == start) return CMDC_NO_RECORD;
+    if(end < start+2) return 0;
+
+    char type = radio_buf[OFFSET_DATA+start];
+    if(type >= '0' && type <= '9'){
+        *cmd_type = (uint8_t) (type - '0');
+    }else if(type >= 'A' && type <= 'F'){
+        *cmd_type = (uint8_t) (type - 'A' + 10);
+    }else{
+        return 0;
+    }
+    if(*cmd_type > CMDC_LAST_CMD_TYPE || *cmd_type == CMD_MULTI) return 0;
+
+    return get_args(radio_buf+OFFSET_DATA+start+1, (uint8_t) (end-start-1));
+}
+
 /**
  * Verify the checksum of the message. Checksum is calculated by adding all
  * symbols ASCII values after preambles and doing a remainder division on that
@@ -365,3 +586,135 @@ uint8_t check_checksum(char *radio_buf, uint8_t data_len)
     return 0;
 }
 
+
+/**
+ * Make a message in the same format that get_cmd parses (see get_cmd), e.g.
+ * for sending telemetry to the camera computer. The ID in the message is the
+ * robot's own ID.
+ *
+ * NOTE: The message ends with CMDC_MSG_END (see cmd_control.h) and the string
+ *       is null terminated.
+ *
+ * Parameters:
+ *      buf - string, Where to write the message
+ *      buf_len - uint16_t, Size of buf
+ *      type - uint8_t, Message type
+ *      data - int32_t*, Message data/arguments (written in hexadecimal,
+ *             separated with ARG_DELIM)
+ *      data_len - uint8_t, Argument count. Must be at least 1.
+ *
+ * Returns: uint16_t, message length (0 if the message did not fit into buf or
+ *          the data substring would be longer than 255 symbols)
+ */
+uint16_t make_msg(char *buf, uint16_t buf_len, uint8_t type, int32_t *data,
+        uint8_t data_len)
+{
+    /* Longest argument: "-" and 8 hex digits and ARG_DELIM */
+    uint16_t max_len = OFFSET_DATA + (uint16_t) data_len*10 + 2 +
+        sizeof(CMDC_MSG_END);
+    if(data_len == 0 || buf_len < max_len) return 0;
+
+    strcpy(buf, CMDC_PREAMBLE);
+    put_hex(buf+OFFSET_ID, ROBOT_ID, 2);
+    put_hex(buf+OFFSET_TYPE, type, 2);
+
+    uint16_t i = OFFSET_DATA;
+    uint8_t arg = 0;
+    for(; arg < data_len; arg++){
+        if(arg > 0) buf[i++] = ARG_DELIM;
+
+        uint32_t value = (uint32_t) data[arg];
+        if(data[arg] < 0){
+            buf[i++] = '-';
+            value = -value;
+        }
+
+        /* Skip the leading zeros */
+        uint8_t digits = 1;
+        while(digits < 8 && (value >> (4*digits)) != 0) digits++;
+
+        i += put_hex(buf+i, value, digits);
+    }
+
+    uint16_t data_str_len = i - OFFSET_DATA;
+    if(data_str_len > 255) return 0;
+    put_hex(buf+OFFSET_LEN, data_str_len, 2);
+
+    /* Checksum (see check_checksum) */
+    uint16_t checksum = 0;
+    uint16_t j = OFFSET_ID;
+    for(; j < i; j++){
+        checksum += buf[j];
+    }
+    i += put_hex(buf+i, checksum % 255, 2);
+
+    strcpy(buf+i, CMDC_MSG_END);
+
+    return i + sizeof(CMDC_MSG_END)-1;
+}
+
+/**
+ * Write a value in (uppercase) hexadecimal.
+ *
+ * Parameters:
+ *      buf - string, Where to write the digits (not null terminated)
+ *      value - uint32_t, The value
+ *      digits - uint8_t, How many digits to write (the value is cut if it
+ *               does not fit)
+ *
+ * Returns: uint8_t, digit count
+ */
+uint8_t put_hex(char *buf, uint32_t value, uint8_t digits)
+{
+    uint8_t i = digits;
+    while(i > 0){
+        uint8_t nibble = value & 0x0F;
+        buf[--i] = (char) (nibble < 10 ? '0'+nibble : 'A'+nibble-10);
+        value >>= 4;
+    }
+
+    return digits;
+}
+
+/**
+ * Write a text into buf. Together with put_dec for building the text replies
+ * (the firmware does not link the printf family).
+ *
+ * Parameters:
+ *      buf - string, Where to write the text
+ *      text - string, The text
+ *
+ * Returns: string, the end of buf (the null terminator) for the next put_*
+ */
+char *put_text(char *buf, const char *text)
+{
+    while(*text != 0) *buf++ = *text++;
+    *buf = 0;
+
+    return buf;
+}
+
+/**
+ * Write a value in decimal into buf (see put_text).
+ *
+ * Parameters:
+ *      buf - string, Where to write the digits
+ *      value - uint32_t, The value
+ *
+ * Returns: string, the end of buf (the null terminator) for the next put_*
+ */
+char *put_dec(char *buf, uint32_t value)
+{
+    /* The digits are found from the lowest */
+    char digits[10];
+    uint8_t i = 0;
+    do{
+        digits[i++] = (char) ('0' + value % 10);
+        value /= 10;
+    }while(value != 0);
+
+    while(i > 0) *buf++ = digits[--i];
+    *buf = 0;
+
+    return buf;
+}
@@ -4,16 +4,20 @@
 /* LIBRARY INCLUDES ---------------------------------------------------------*/
 #include <string.h>
 #include <stdlib.h>
+#include "drivers/board.h"
 #include "drivers/com.h"
 
 /* CONSTANTS ----------------------------------------------------------------*/
 /**
- * The robot's ID.
+ * The robot's ID. Can also be given when compiling (e.g. -DROBOT_ID=0x46),
+ * the simulator (see sim/sim_swarm.c) gives every robot its own ID that way.
  *
  * NOTE: The message is in hexadecimal, so it is easier to store the id also in
  * hexadecimal.
  */
+#ifndef ROBOT_ID
 #define ROBOT_ID 0x45
+#endif
 
 /* The preamble for every message/command */
 #define CMDC_PREAMBLE "0000"
@@ -27,32 +31,44 @@
 /* The maximum length of the whole radio buffer/channel string */
 #define CMDC_MAX_BUF_LEN 1024
 
-/* The maximum argument count for cmd_t.data array */
-#define CMDC_MAX_DATA_ARG_LEN 256
+/**
+ * The maximum argument count for cmd_t.data array. Messages with more
+ * arguments are rejected. No command needs more than 4 arguments, and every
+ * argument costs 2 bytes of SRAM.
+ */
+#define CMDC_MAX_DATA_ARG_LEN 8
 
 /**
  * The last command type - if the command type is bigger in the message than
  * the value defined here, then the message will be rejectd
  */
-#define CMDC_LAST_CMD_TYPE 3
+#define CMDC_LAST_CMD_TYPE 11
+
+/**
+ * The multi-robot frame (CMD_MULTI, see get_record in cmd_control.c): the
+ * offsets of the header and the offset table in the data substring.
+ */
+#define CMDC_MULTI_FIRST_ID 0
+#define CMDC_MULTI_COUNT 2
+#define CMDC_MULTI_TABLE 4
+
+/* get_record: the multi-robot frame has nothing for this robot */
+#define CMDC_NO_RECORD 2
+
+/**
+ * The message rate and the accepted ratio (see cmd_stats_t) are calculated
+ * over CMDC_STATS_WINDOW (ms).
+ */
+#define CMDC_STATS_WINDOW 1000
 
 /* Delimeter for separating command's data, which has multiple arguments */
 #define ARG_DELIM ','
 
-/* STURCTS ------------------------------------------------------------------*/
 /**
- * The command data type.
- *
- * NOTE: the data_len field should not be confused with data length in the
- * message (data length byte). Here the data_len refers to the data array
- * length, not to the length of data substring.
+ * The end of the messages the robot sends (see make_msg). The messages to the
+ * robot end with a letter instead (see RADIOC_RX_END in radio_control.h).
  */
-typedef struct cmd_struct{
-    uint8_t type;
-    int16_t data[CMDC_MAX_DATA_ARG_LEN];
-    uint8_t done;
-    uint8_t data_len;
-} cmd_t;
+#define CMDC_MSG_END "\n\r"
 
 /* ENUMS --------------------------------------------------------------------*/
 /* Command types enum */
@@ -60,7 +76,30 @@ enum cmdc_cmd_enum{
     CMD_END = 0,
     CMD_DRIVE = 1,
     CMD_TURN = 2,
-    CMD_MOTORS = 3
+    CMD_MOTORS = 3,
+    CMD_QUERY = 4,
+    CMD_TELEM = 5,
+    CMD_TRACE = 6,
+    CMD_HEARTBEAT = 7,
+    CMD_SLOT = 8,
+    CMD_SYNC = 9,
+    CMD_MULTI = 10,
+    CMD_BAUD = 11
+};
+
+/**
+ * Query types enum - the first argument of a CMD_QUERY command. Queries do
+ * not affect the active (motion) command, the robot just replies over the
+ * radio.
+ */
+enum cmdc_query_enum{
+    QUERY_POWER = 0,
+    QUERY_TASKS = 1,
+    QUERY_PROF = 2,
+    QUERY_PROF_RESET = 3,
+    QUERY_RADIO = 4,
+    QUERY_MEM = 5,
+    QUERY_GYRO = 6
 };
 
 /**
@@ -75,9 +114,67 @@ enum cmdc_offset_enum{
     OFFSET_DATA = 10
 };
 
+/**
+ * Why get_cmd dropped a message (or a whole radio string), see cmd_stats_t.
+ * A message to another robot is not dropped, it is skipped (foreign).
+ */
+enum cmdc_drop_enum{
+    CMDC_DROP_SHORT = 0,
+    CMDC_DROP_PREAMBLE = 1,
+    CMDC_DROP_LEN = 2,
+    CMDC_DROP_CHECKSUM = 3,
+    CMDC_DROP_TYPE = 4,
+    CMDC_DROP_DATA = 5,
+    CMDC_DROP_COUNT = 6
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * The command data type.
+ *
+ * NOTE: the data_len field should not be confused with data length in the
+ * message (data length byte). Here the data_len refers to the data array
+ * length, not to the length of data substring.
+ */
+typedef struct cmd_struct{
+    uint8_t type;
+    int16_t data[CMDC_MAX_DATA_ARG_LEN];
+    uint8_t done;
+    uint8_t data_len;
+} cmd_t;
+
+/**
+ * Radio link statistics (see get_cmd_stats). The counters wrap around.
+ *
+ *      strings - received radio strings
+ *      accepted - valid messages to this robot (or broadcasts)
+ *      foreign - messages to the other robots
+ *      dropped - invalid messages/strings by the reason (see cmdc_drop_enum):
+ *                SHORT - the string (or the last message in it) is too short,
+ *                PREAMBLE - no preamble in the whole string, LEN - no data
+ *                length, CHECKSUM, TYPE - unknown type, DATA - bad arguments
+ *      msgs_per_s - messages (all of them) per second in the last window
+ *      accepted_permille - accepted per mille of the accepted and dropped
+ *                          ones in the last window (with any)
+ */
+typedef struct cmd_stats_struct{
+    uint16_t strings;
+    uint16_t accepted;
+    uint16_t foreign;
+    uint16_t dropped[CMDC_DROP_COUNT];
+    uint16_t msgs_per_s;
+    uint16_t accepted_permille;
+} cmd_stats_t;
+
 /* PUBLIC PROTOTYPES --------------------------------------------------------*/
 void init_cmd_control();
 cmd_t *get_cmd();
+void flush_cmds();
+cmd_stats_t *get_cmd_stats();
+uint16_t make_msg(char *buf, uint16_t buf_len, uint8_t type, int32_t *data,
+        uint8_t data_len);
+char *put_text(char *buf, const char *text);
+char *put_dec(char *buf, uint32_t value);
 
 #endif
 
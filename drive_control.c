@@ -3,16 +3,68 @@
  */
 
 #include "drive_control.h"
+#include "prof_control.h"
+#include "killsw_control.h"
+#include "batt_control.h"
 
 /* PRIVATE PROTOTYPES -------------------------------------------------------*/
 void pwr_limit(int16_t *pwr);
-void fpwr_limit(float *pwr);
+int16_t pid_scale(int32_t k, uint16_t c_pwr);
+int16_t sin_q14(uint8_t angle);
+void set_motors(int16_t pwr_left, int16_t pwr_right);
+void set_stop_motors(int16_t pwr_left, int16_t pwr_right);
+uint32_t drive_clicks(uint32_t distance_mm);
+void drive_target_arm(uint32_t clicks, int8_t left_dir, int8_t right_dir,
+        uint8_t stop);
+void drive_target_disarm();
+void drive_target_stop();
+uint8_t drive_stop();
 
 /* PRIVATE GLOBALS ----------------------------------------------------------*/
 /* PID control variables */
 int16_t last_error;
 int32_t error_integral;
 
+/* Pose (odometry) variables - see update_pose */
+int16_t pose_last_left_enc = 0;
+int16_t pose_last_right_enc = 0;
+int32_t pose_x = 0;
+int32_t pose_y = 0;
+int16_t pose_heading = 0;
+int8_t pose_half = 0;
+
+/* The target stop (see drive_target_arm) */
+volatile uint8_t drive_target = DRIVEC_TARGET_OFF;
+
+/**
+ * The stop after the target (see drive_stop): the stop mode, the wheels'
+ * directions (1 forward, -1 backwards), the wheels that stand still (bits,
+ * 1 << SIDE), if the stop has started, when and the encoders at the last
+ * control step
+ */
+uint8_t drive_stop_mode = DRIVEC_STOP_COAST;
+int8_t drive_stop_dir[2];
+uint8_t drive_stop_still = 0;
+uint8_t drive_stop_started = 0;
+uint32_t drive_stop_start = 0;
+int16_t drive_stop_enc[2];
+
+/**
+ * Quarter of a sine wave for the pose calculation: sin(i*2*pi/256)*2^14,
+ * i = 0...64 (so 256 steps is a full circle)
+ */
+const int16_t sin_table[65] PROGMEM = {
+    0, 402, 804, 1205, 1606, 2006, 2404, 2801,
+    3196, 3590, 3981, 4370, 4756, 5139, 5520, 5897,
+    6270, 6639, 7005, 7366, 7723, 8076, 8423, 8765,
+    9102, 9434, 9760, 10080, 10394, 10702, 11003, 11297,
+    11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+    13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978,
+    15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+    16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379,
+    16384
+};
+
 /* FUNCTIONS ----------------------------------------------------------------*/
 /**
  * Get absolute value of left encoder. Using uint32_t as it ensures that we 
@@ -41,7 +93,7 @@ uint32_t get_right_abs_enc()
 uint32_t get_left_abs_distance_mm()
 {
     uint32_t left_enc = get_left_abs_enc()*DRIVEC_CLICK_MULTIPLIER;
-    return (uint32_t) (roundf(left_enc / DRIVEC_CLICK_CONST));
+    return left_enc / DRIVEC_CLICK_CONST;
 }
 
 
@@ -54,7 +106,7 @@ uint32_t get_left_abs_distance_mm()
 uint32_t get_right_abs_distance_mm()
 {
     uint32_t right_enc = get_right_abs_enc()*DRIVEC_CLICK_MULTIPLIER;
-    return (uint32_t) (roundf(right_enc / DRIVEC_CLICK_CONST));
+    return right_enc / DRIVEC_CLICK_CONST;
 }
 
 /**
@@ -73,7 +125,7 @@ int32_t get_left_distance_mm()
      */
     int32_t right_enc = (int32_t) (-get_left_enc());
     right_enc *= DRIVEC_CLICK_MULTIPLIER;
-    return (int32_t) (roundf(right_enc / DRIVEC_CLICK_CONST));
+    return right_enc / DRIVEC_CLICK_CONST;
 }
 
 /**
@@ -92,7 +144,53 @@ int32_t get_right_distance_mm()
      */
     int32_t right_enc = (int32_t) (-get_right_enc());
     right_enc *= DRIVEC_CLICK_MULTIPLIER;
-    return (int32_t) (roundf(right_enc / DRIVEC_CLICK_CONST));
+    return right_enc / DRIVEC_CLICK_CONST;
+}
+
+/**
+ * Set the motor powers - motor_set that respects the kill switch: while the
+ * kill switch has fired (see killsw_control.c), the motors stay stopped. So
+ * do they after the target stop (see drive_target_arm) until the next reset,
+ * only the stop itself sets them (see set_stop_motors). The powers are scaled
+ * to the battery voltage (see batt_scale).
+ *
+ * NOTE: The check and motor_set are done with interrupts disabled, so the
+ *       kill switch and the compare interrupts cannot fire in between.
+ *
+ * Parameters:
+ *      pwr_left - int16_t, Left motor power
+ *      pwr_right - int16_t, Right motor power
+ */
+void set_motors(int16_t pwr_left, int16_t pwr_right)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(killsw_fired() || drive_target >= DRIVEC_TARGET_HIT){
+            pwr_left = 0;
+            pwr_right = 0;
+        }
+
+        motor_set(batt_scale(pwr_left), batt_scale(pwr_right));
+    }
+}
+
+/**
+ * Set the motor powers of the stop after the target (see drive_stop) - like
+ * set_motors, but the target stop does not keep the motors stopped.
+ *
+ * Parameters:
+ *      pwr_left - int16_t, Left motor power
+ *      pwr_right - int16_t, Right motor power
+ */
+void set_stop_motors(int16_t pwr_left, int16_t pwr_right)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(killsw_fired()){
+            pwr_left = 0;
+            pwr_right = 0;
+        }
+
+        motor_set(batt_scale(pwr_left), batt_scale(pwr_right));
+    }
 }
 
 /**
@@ -101,11 +199,114 @@ int32_t get_right_distance_mm()
  */
 void drive_control_reset()
 {
-    motor_set(0, 0);
-    last_error = 0.0f;
+    drive_target_disarm();
+    set_motors(0, 0);
+    last_error = 0;
     error_integral = 0;
+    drive_control_enc_reset();
+}
+
+/**
+ * Reset the encoders. The clicks since the last pose update are added to the
+ * pose first, so the pose is not affected by the reset.
+ */
+void drive_control_enc_reset()
+{
+    update_pose();
     left_enc_reset();
     right_enc_reset();
+    pose_last_left_enc = 0;
+    pose_last_right_enc = 0;
+}
+
+/**
+ * Get sin(angle) from the sine table.
+ *
+ * Parameters: angle - uint8_t, Angle (256 is a full circle)
+ *
+ * Returns: int16_t, sin(angle)*2^14
+ */
+int16_t sin_q14(uint8_t angle)
+{
+    if(angle <= 64){
+        return (int16_t) pgm_read_word(&sin_table[angle]);
+    }else if(angle <= 128){
+        return (int16_t) pgm_read_word(&sin_table[128-angle]);
+    }else if(angle <= 192){
+        return -(int16_t) pgm_read_word(&sin_table[angle-128]);
+    }
+
+    return -(int16_t) pgm_read_word(&sin_table[256-angle]);
+}
+
+/**
+ * Update the pose (odometry) with the clicks since the last update. Should be
+ * called regularly - often enough that the heading does not change much
+ * between two calls (e.g. every control step).
+ *
+ * The pose is relative to where the robot was when it was switched on: x axis
+ * is the robot's starting direction, y axis points to the left and heading
+ * grows counter clockwise. x and y are in 2^14 clicks, heading in the
+ * difference of the wheels' clicks (see DRIVEC_REV_CLICKS in
+ * drive_control.h).
+ */
+void update_pose()
+{
+    /* See get_left_distance_mm for the signs */
+    int16_t left_enc = -get_left_enc();
+    int16_t right_enc = -get_right_enc();
+
+    int16_t d_left = left_enc - pose_last_left_enc;
+    int16_t d_right = right_enc - pose_last_right_enc;
+    pose_last_left_enc = left_enc;
+    pose_last_right_enc = right_enc;
+
+    pose_heading += d_right - d_left;
+    if(pose_heading >= DRIVEC_REV_CLICKS){
+        pose_heading -= DRIVEC_REV_CLICKS;
+    }else if(pose_heading < 0){
+        pose_heading += DRIVEC_REV_CLICKS;
+    }
+
+    /* The odd half click is carried over, otherwise x and y would lose up
+     * to half a click every step */
+    int16_t sum = d_left + d_right + pose_half;
+    int16_t d = sum / 2;
+    pose_half = (int8_t) (sum - 2*d);
+    uint8_t angle = (uint8_t) ((pose_heading*256L) / DRIVEC_REV_CLICKS);
+
+    pose_x += (int32_t) d * sin_q14((uint8_t) (angle + 64));
+    pose_y += (int32_t) d * sin_q14(angle);
+}
+
+/**
+ * Get the pose x coordinate (see update_pose).
+ *
+ * Returns: int32_t, x in mm
+ */
+int32_t get_pose_x_mm()
+{
+    return ((pose_x >> 14) * DRIVEC_CLICK_MULTIPLIER) / DRIVEC_CLICK_CONST;
+}
+
+/**
+ * Get the pose y coordinate (see update_pose).
+ *
+ * Returns: int32_t, y in mm
+ */
+int32_t get_pose_y_mm()
+{
+    return ((pose_y >> 14) * DRIVEC_CLICK_MULTIPLIER) / DRIVEC_CLICK_CONST;
+}
+
+/**
+ * Get the pose heading (see update_pose).
+ *
+ * Returns: int16_t, heading in degrees (0...359, counter clockwise)
+ */
+int16_t get_pose_heading_deg()
+{
+    return (int16_t) ((pose_heading*360L) / DRIVEC_REV_CLICKS);
 }
 
 /**
@@ -117,6 +318,10 @@ void drive_control_init()
     motor_init();
     /* Set up encoders - they read how many clicks has the motor done */
     quadrature_init();
+#if DRIVEC_TARGET_IRQ
+    /* The target stop uses a high level interrupt (see drive_target_arm) */
+    PMIC.CTRL |= PMIC_HILVLEN_bm;
+#endif
     /* Reset all drive control variables */
     drive_control_reset();
 }
@@ -140,49 +345,236 @@ void pwr_limit(int16_t *pwr)
 }
 
 /**
- * Limit the power to DRIVEC_MAX_PWR (see drive_control.h) if the power exceeds
- * the DRIVEC_MAX_PWR.
+ * Convert a distance to clicks, rounded up - the same clicks at which
+ * get_left_abs_distance_mm and get_right_abs_distance_mm reach the distance.
  *
- * Parameters: pwr - float*, Pointer to the value that is going to be
- *                   throttled
+ * Parameters: distance_mm - uint32_t, Distance in mm
+ *
+ * Returns: uint32_t, clicks
  */
-void fpwr_limit(float *pwr)
+uint32_t drive_clicks(uint32_t distance_mm)
 {
-    if(pwr == NULL) return;
-    
-    if(*pwr > DRIVEC_MAX_PWR){
-        *pwr = DRIVEC_MAX_PWR;
-    }else if(*pwr < -DRIVEC_MAX_PWR){
-        *pwr = -DRIVEC_MAX_PWR;
+    return (distance_mm*DRIVEC_CLICK_CONST + DRIVEC_CLICK_MULTIPLIER-1) /
+        DRIVEC_CLICK_MULTIPLIER;
+}
+
+/**
+ * Arm the target stop: the motors are stopped in the encoder compare
+ * interrupt right when either wheel has driven clicks (see DRIVEC_QDEC_LEFT
+ * in drive_control.h). The control task only checks the distance every
+ * CONTROL_PERIOD (and later when the other tasks are busy), so without it
+ * the robot would drive on for up to a control period.
+ *
+ * The encoders count from 0 (see drive_control_reset) and down when the
+ * wheel drives forward. A target out of the 16 bit counter's range is left
+ * to the distance check in drive_mm and turn_deg.
+ *
+ * Parameters:
+ *      clicks - uint32_t, The target (both wheels)
+ *      left_dir - int8_t, Left wheel direction (1 forward, -1 backwards)
+ *      right_dir - int8_t, Right wheel direction
+ *      stop - uint8_t, How to stop (see drivec_stop_enum)
+ */
+void drive_target_arm(uint32_t clicks, int8_t left_dir, int8_t right_dir,
+        uint8_t stop)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        drive_stop_mode = stop;
+        drive_stop_dir[0] = left_dir;
+        drive_stop_dir[1] = right_dir;
+        drive_stop_started = 0;
+        drive_target = DRIVEC_TARGET_ARMED;
+    }
+
+#if DRIVEC_TARGET_IRQ
+    if(clicks == 0 || clicks > INT16_MAX) return;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        DRIVEC_QDEC_LEFT.CCA = (uint16_t) (-left_dir*(int16_t) clicks);
+        DRIVEC_QDEC_RIGHT.CCA = (uint16_t) (-right_dir*(int16_t) clicks);
+        DRIVEC_QDEC_LEFT.INTFLAGS = TC0_CCAIF_bm;
+        DRIVEC_QDEC_RIGHT.INTFLAGS = TC0_CCAIF_bm;
+        DRIVEC_QDEC_LEFT.INTCTRLB =
+            (DRIVEC_QDEC_LEFT.INTCTRLB & ~TC0_CCAINTLVL_gm) |
+            TC_CCAINTLVL_HI_gc;
+        DRIVEC_QDEC_RIGHT.INTCTRLB =
+            (DRIVEC_QDEC_RIGHT.INTCTRLB & ~TC0_CCAINTLVL_gm) |
+            TC_CCAINTLVL_HI_gc;
+    }
+#else
+    (void) clicks;
+#endif
+}
+
+/**
+ * Disarm the target stop (and let the motors run again after it).
+ */
+void drive_target_disarm()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+#if DRIVEC_TARGET_IRQ
+        DRIVEC_QDEC_LEFT.INTCTRLB &= ~TC0_CCAINTLVL_gm;
+        DRIVEC_QDEC_RIGHT.INTCTRLB &= ~TC0_CCAINTLVL_gm;
+#endif
+        drive_target = DRIVEC_TARGET_OFF;
+    }
+}
+
+/**
+ * A wheel has reached the target - stop the motors, or start braking with
+ * the reverse power, and keep the control steps from driving on (see
+ * set_motors). The control steps carry on with the stop (see drive_stop).
+ *
+ * NOTE: Called from the compare interrupts (and with interrupts disabled).
+ */
+void drive_target_stop()
+{
+#if DRIVEC_TARGET_IRQ
+    DRIVEC_QDEC_LEFT.INTCTRLB &= ~TC0_CCAINTLVL_gm;
+    DRIVEC_QDEC_RIGHT.INTCTRLB &= ~TC0_CCAINTLVL_gm;
+#endif
+
+    if(drive_target != DRIVEC_TARGET_ARMED) return;
+    drive_target = DRIVEC_TARGET_HIT;
+
+    if(drive_stop_mode == DRIVEC_STOP_COAST || killsw_fired()){
+        motor_set(0, 0);
+    }else{
+        motor_set(batt_scale(-drive_stop_dir[0]*DRIVEC_BRAKE_PWR),
+                batt_scale(-drive_stop_dir[1]*DRIVEC_BRAKE_PWR));
     }
 }
 
+/**
+ * Stop after the target, one control step at a time (see DRIVEC_BRAKE_GAIN
+ * in drive_control.h):
+ *  * DRIVEC_STOP_COAST - the motors are switched off, the robot coasts on
+ *  * DRIVEC_STOP_BRAKE - a counter power proportional to the wheel's speed
+ *  * DRIVEC_STOP_REVERSE - DRIVEC_BRAKE_PWR backwards
+ * A brake lets a wheel go when it no longer turns forward (in its
+ * direction) and is over when both wheels stand still or after
+ * DRIVEC_STOP_MAX_TIME.
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if the stop is over
+ */
+uint8_t drive_stop()
+{
+    /* The distance check got there first */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        drive_target_stop();
+    }
+
+    if(drive_target == DRIVEC_TARGET_DONE) return 1;
+
+    int16_t enc[2] = {get_left_enc(), get_right_enc()};
+    uint32_t now = millis();
+
+    if(drive_stop_mode != DRIVEC_STOP_COAST && !drive_stop_started){
+        /* The reverse power is on (see drive_target_stop) */
+        drive_stop_started = 1;
+        drive_stop_start = now;
+        drive_stop_still = 0;
+        drive_stop_enc[0] = enc[0];
+        drive_stop_enc[1] = enc[1];
+        return 0;
+    }
+
+    int16_t pwr[2] = {0, 0};
+    uint8_t i = 0;
+    for(; i < 2 && drive_stop_mode != DRIVEC_STOP_COAST; i++){
+        /* See get_left_distance_mm for the sign */
+        int16_t moved = drive_stop_enc[i] - enc[i];
+        drive_stop_enc[i] = enc[i];
+
+        if(drive_stop_dir[i]*moved <= 0) drive_stop_still |= 1 << i;
+        if(drive_stop_still & (1 << i)) continue;
+
+        if(drive_stop_mode == DRIVEC_STOP_BRAKE){
+            pwr[i] = -moved*DRIVEC_BRAKE_GAIN;
+            pwr_limit(&pwr[i]);
+        }else{
+            pwr[i] = -drive_stop_dir[i]*DRIVEC_BRAKE_PWR;
+        }
+    }
+
+    if(drive_stop_mode == DRIVEC_STOP_COAST || drive_stop_still == 3 ||
+            now - drive_stop_start >= DRIVEC_STOP_MAX_TIME){
+        set_stop_motors(0, 0);
+        drive_target = DRIVEC_TARGET_DONE;
+        return 1;
+    }
+
+    set_stop_motors(pwr[0], pwr[1]);
+    return 0;
+}
+
+/**
+ * Scale the weighted PID errors by the power: k*c_pwr/DRIVEC_PID_SCALE,
+ * rounded to the nearest. The result is limited to +-2*DRIVEC_MAX_PWR - a
+ * bigger lead power would not change the PID powers (they are limited to
+ * DRIVEC_MAX_PWR).
+ *
+ * Parameters:
+ *      k - int32_t, The weighted errors (the PID constants times the errors,
+ *          see pid_control)
+ *      c_pwr - uint16_t, Constant power (at most DRIVEC_MAX_PWR)
+ *
+ * Returns: int16_t, the lead power (u)
+ */
+int16_t pid_scale(int32_t k, uint16_t c_pwr)
+{
+    /* k*c_pwr would overflow - the lead power is over the limit anyway */
+    if(k > INT32_MAX/DRIVEC_MAX_PWR){
+        return 2*DRIVEC_MAX_PWR;
+    }else if(k < -INT32_MAX/DRIVEC_MAX_PWR){
+        return -2*DRIVEC_MAX_PWR;
+    }
+
+    int32_t u = k*c_pwr;
+    if(u >= 0){
+        u = (u + DRIVEC_PID_SCALE/2) / DRIVEC_PID_SCALE;
+    }else{
+        u = (u - DRIVEC_PID_SCALE/2) / DRIVEC_PID_SCALE;
+    }
+
+    if(u > 2*DRIVEC_MAX_PWR){
+        return 2*DRIVEC_MAX_PWR;
+    }else if(u < -2*DRIVEC_MAX_PWR){
+        return -2*DRIVEC_MAX_PWR;
+    }
+
+    return (int16_t) u;
+}
+
 /**
  * Calculate PID control powers
  *
  * Parameters:
  *      c_pwr - uint16_t, Constant power the PID control power calculation is
  *              based on
- *      pwr_left - float*, Pointer to variable where the PID controlled
+ *      pwr_left - int16_t*, Pointer to variable where the PID controlled
  *                 left power is going to be saved
- *      pwr_right - float*, Pointer to variable where the PID controlled
+ *      pwr_right - int16_t*, Pointer to variable where the PID controlled
  *                  right power is going to be saved
  *
- * Returns: float, the PID controlled lead power (u)
+ * Returns: int16_t, the PID controlled lead power (u)
  */
 /* For debug */
 int16_t error;
+int16_t debug_u;
 int16_t debug_pwr_right, debug_pwr_left;
-float pid_control(uint16_t c_pwr, float *fpwr_left, float *fpwr_right)
+int16_t pid_control(uint16_t c_pwr, int16_t *pwr_left, int16_t *pwr_right)
 {
+    PROF_BEGIN();
+
     error = (int16_t) (get_left_abs_enc() - get_right_abs_enc());
     
     /* Choose either PD or PI control */ 
     /**
      * PD (Proportional Derivative) control
      */
-    float u = DRIVEC_P_CONST*c_pwr*error +
-              DRIVEC_D_CONST*c_pwr*(last_error - error);
+    int32_t k = (int32_t) DRIVEC_P_CONST*error +
+                (int32_t) DRIVEC_D_CONST*(last_error - error);
     
     /**
      * PI (Proportinal Integral) control
@@ -190,24 +582,29 @@ float pid_control(uint16_t c_pwr, float *fpwr_left, float *fpwr_right)
     /*
     if((error_integral > 0 && error < 0) || (error_integral < 0 && error > 0)){
         error_integral = 0;
-    }else if(error_integral < (int32_t) roundf(DRIVEC_I_MAX*c_pwr)){
+    }else if(error_integral < DRIVEC_I_MAX*c_pwr/DRIVEC_PID_SCALE){
         error_integral += error;
     }
-    float u = DRIVEC_P_CONST*c_pwr*error + DRIVEC_I_CONST*c_pwr*error_integral;
+    int32_t k = (int32_t) DRIVEC_P_CONST*error +
+                DRIVEC_I_CONST*error_integral;
     */
+    int16_t u = pid_scale(k, c_pwr);
     
     /* Make the adjustments */ 
-    *fpwr_left = roundf(c_pwr - u);
-    *fpwr_right = roundf(c_pwr + u);
+    *pwr_left = (int16_t) (c_pwr - u);
+    *pwr_right = (int16_t) (c_pwr + u);
     
     /* Limiting the PID powers to DRIVEC_MAX_PWR */
-    fpwr_limit(fpwr_left);
-    fpwr_limit(fpwr_right);
+    pwr_limit(pwr_left);
+    pwr_limit(pwr_right);
 
-    debug_pwr_left = (int16_t) *fpwr_left;
-    debug_pwr_right = (int16_t) *fpwr_right;
+    debug_pwr_left = *pwr_left;
+    debug_pwr_right = *pwr_right;
+    debug_u = u;
     
     last_error = error;
+
+    PROF_END(PROF_PID_CONTROL);
     
     return u;    
 }
@@ -237,24 +634,24 @@ void drive(int16_t pwr_left, int16_t pwr_right)
         /**
          * PID (Proportional Integral Derivative) control
          */
-        float fpwr_left = 0.0f;
-        float fpwr_right = 0.0f;
-        float u = pid_control(pwr, &fpwr_left, &fpwr_right);
+        int16_t pid_pwr_left = 0;
+        int16_t pid_pwr_right = 0;
+        int16_t u = pid_control(pwr, &pid_pwr_left, &pid_pwr_right);
         
         /* Let's drive */
         if(u > 0){
             /* Turn left */
-            motor_set((int16_t) (direction * fpwr_left), direction * pwr);
+            set_motors(direction * pid_pwr_left, direction * pwr);
         }else if(u < 0){
             /* Turn right */ 
-            motor_set(direction * pwr, (int16_t) (direction * fpwr_right));
+            set_motors(direction * pwr, direction * pid_pwr_right);
         }else{
             /* Drive straight */
-            motor_set(direction * pwr, direction * pwr);
+            set_motors(direction * pwr, direction * pwr);
         }
 
     }else{
-        motor_set(pwr_left, pwr_right);
+        set_motors(pwr_left, pwr_right);
     }
 }
 
@@ -270,15 +667,17 @@ void drive(int16_t pwr_left, int16_t pwr_right)
  *      pwr - int16_t, The power that goes to the motors or simply put: motor
  *            speed. Should be positive. NOTE: The value is throttled by the
  *            constant DRIVEC_MAX_PWR (see drive_control.h)
+ *      stop - uint8_t, How to stop at the end (see drive_stop)
  * 
  * Returns: 0 or 1 (uint8_t) - 0 indicating that task is not completed (aka the
  *          given distance is not yet driven); 1 indicating that he task is
- *          completed (the given distance has been driven)
+ *          completed (the given distance has been driven and the stop is
+ *          over)
  */
-uint8_t drive_mm(int16_t distance_mm, int16_t pwr)
+uint8_t drive_mm(int16_t distance_mm, int16_t pwr, uint8_t stop)
 {
     if(distance_mm == 0 || pwr == 0){
-        motor_set(0, 0);
+        set_motors(0, 0);
         return 1; 
     }
 
@@ -287,29 +686,35 @@ uint8_t drive_mm(int16_t distance_mm, int16_t pwr)
 
     uint16_t abs_distance_mm = abs(distance_mm);
     int16_t direction = (distance_mm > 0) ? 1 : -1;
+
+    /* The first step of the command */
+    if(drive_target == DRIVEC_TARGET_OFF){
+        drive_target_arm(drive_clicks(abs_distance_mm), direction, direction,
+                stop);
+    }
     
     /**
      * PID (Proportional Integral Derivative) control
      */
-    float fpwr_left = 0.0f;
-    float fpwr_right = 0.0f;
-    float u = pid_control(pwr, &fpwr_left, &fpwr_right);
+    int16_t pid_pwr_left = 0;
+    int16_t pid_pwr_right = 0;
+    int16_t u = pid_control(pwr, &pid_pwr_left, &pid_pwr_right);
     
     /* Let's drive */
-    if(get_left_abs_distance_mm() >= abs_distance_mm || 
+    if(drive_target >= DRIVEC_TARGET_HIT ||
+            get_left_abs_distance_mm() >= abs_distance_mm ||
             get_right_abs_distance_mm() >= abs_distance_mm){
-        motor_set(0, 0);
-        return 1;
+        return drive_stop();
     }else{
         if(u > 0){
             /* Turn left */
-            motor_set((int16_t) (direction*fpwr_left), direction*pwr);
+            set_motors(direction*pid_pwr_left, direction*pwr);
         }else if(u < 0){
             /* Turn right */ 
-            motor_set(direction*pwr, (int16_t) (direction*fpwr_right));
+            set_motors(direction*pwr, direction*pid_pwr_right);
         }else{
             /* Drive straight */
-            motor_set(direction*pwr, direction*pwr);
+            set_motors(direction*pwr, direction*pwr);
         }
     }
 
@@ -326,6 +731,7 @@ uint8_t drive_mm(int16_t distance_mm, int16_t pwr)
  *      pwr - int16_t, The power that goes to the motors or simply put: motor
  *            speed. Should be positive. NOTE: The value is throttled by the
  *            constant DRIVEC_MAX_PWR (see drive_control.h)
+ *      stop - uint8_t, How to stop at the end (see drive_stop)
  *
  * Basic logic (might be wrong):
  * Robot's radius from robt's center to wheel center is 44.65 mm. Thus rotating
@@ -343,12 +749,12 @@ uint8_t drive_mm(int16_t distance_mm, int16_t pwr)
  * Returns: 0 or 1 (uint8_t) - 0 indicating that task is not completed (aka the
  *                             given distance is not yet driven); 1 indicating
  *                             that the task is completed (the given distance
- *                             has been driven)
+ *                             has been driven and the stop is over)
  */
-uint8_t turn_deg(int32_t deg, int16_t pwr)
+uint8_t turn_deg(int32_t deg, int16_t pwr, uint8_t stop)
 {
     if(deg == 0 || pwr == 0){
-        motor_set(0, 0);
+        set_motors(0, 0);
         return 1;
     }
 
@@ -359,40 +765,68 @@ uint8_t turn_deg(int32_t deg, int16_t pwr)
      * PID (Proportional Integral Derivative) control specially for turning
      */
     /*error = (int16_t) (get_left_abs_enc() - get_right_abs_enc());
-    float u = DRIVEC_P_CONST*pwr*error +
-              DRIVEC_D_CONST*pwr*(last_error - error);*/
+    int16_t u = pid_scale((int32_t) DRIVEC_P_CONST*error +
+                (int32_t) DRIVEC_D_CONST*(last_error - error), pwr);*/
     
     /* Make the adjustments */ 
-    /*float fpwr_left;
+    /*int16_t pid_pwr_left;
 
     if(deg < 0){
-        fpwr_left = roundf(-pwr+u);
+        pid_pwr_left = -pwr+u;
     }else{
-        fpwr_left = roundf(pwr-u);
+        pid_pwr_left = pwr-u;
     }*/
     
     /* Limiting the PID powers to DRIVEC_MAX_PWR */
-    /*fpwr_limit(&fpwr_left);
+    /*pwr_limit(&pid_pwr_left);
 
-    debug_pwr_left = (int16_t) fpwr_left;*/
+    debug_pwr_left = pid_pwr_left;*/
 
     uint32_t circle_distance_mm = labs(deg);
-    circle_distance_mm = (uint32_t) roundf(circle_distance_mm*779/1000);
+    circle_distance_mm = circle_distance_mm*779/1000;
+
+    /* The first step of the command (deg < 0 drives the left wheel
+     * backwards) */
+    if(drive_target == DRIVEC_TARGET_OFF){
+        int8_t left_dir = (deg < 0) ? -1 : 1;
+        drive_target_arm(drive_clicks(circle_distance_mm), left_dir,
+                -left_dir, stop);
+    }
 
-    if(get_left_abs_distance_mm() >= circle_distance_mm || 
+    if(drive_target >= DRIVEC_TARGET_HIT ||
+            get_left_abs_distance_mm() >= circle_distance_mm ||
             get_right_abs_distance_mm() >= circle_distance_mm){
-        motor_set(0, 0); 
-        return 1;
+        return drive_stop();
     }else{
         if(deg < 0){
-            motor_set(-pwr, pwr);
-            /* motor_set((int16_t) fpwr_left, pwr); */
+            set_motors(-pwr, pwr);
+            /* motor_set(pid_pwr_left, pwr); */
         }else{
-            motor_set(pwr, -pwr);
-            /* motor_set((int16_t) fpwr_left, -pwr); */
+            set_motors(pwr, -pwr);
+            /* motor_set(pid_pwr_left, -pwr); */
         }
     }
 
     /* last_error = error; */
     return 0;
 }
+
+#if DRIVEC_TARGET_IRQ
+/**
+ * Encoder compare interrupts - a wheel has reached the target (see
+ * drive_target_arm).
+ */
+ISR(DRIVEC_QDEC_LEFT_CCA_vect)
+{
+    PROF_ISR_BEGIN();
+    drive_target_stop();
+    PROF_ISR_END(PROF_ISR_ENCODER);
+}
+
+ISR(DRIVEC_QDEC_RIGHT_CCA_vect)
+{
+    PROF_ISR_BEGIN();
+    drive_target_stop();
+    PROF_ISR_END(PROF_ISR_ENCODER);
+}
+#endif
@@ -2,9 +2,13 @@
 #define DRIVE_CONTROL_H
 
 /* LIBRARY INCLUDES ---------------------------------------------------------*/
-#include <math.h>
 #include <stdlib.h>
+#include <avr/pgmspace.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include "drivers/motor.h"
+#include "drivers/board.h"
 
 /* CONSTANTS ----------------------------------------------------------------*/
 /**
@@ -16,15 +20,19 @@
 /**
  * NOTE: Only one (either PI or PD control) can be used. Comment/uncomment the
  * necessary parts in pid_control function (in drive_control.c)
+ *
+ * The constants are in 1/DRIVEC_PID_SCALE (fixed point, the firmware has no
+ * floating point math), e.g. DRIVEC_P_CONST 500 is 0.05.
  */
+#define DRIVEC_PID_SCALE 10000L
 /* The proportional constant for PID control */
-#define DRIVEC_P_CONST 0.05f
+#define DRIVEC_P_CONST 500
 /* The derivative constant for PD control */
-#define DRIVEC_D_CONST 0.1f
+#define DRIVEC_D_CONST 1000
 /* The integral constant for PI control */
-#define DRIVEC_I_CONST 0.0006f
+#define DRIVEC_I_CONST 6
 /* The maximum for the integral in PI control (percentage of the power) */
-#define DRIVEC_I_MAX 0.2f
+#define DRIVEC_I_MAX 2000
 
 /**
  * The constant for converting clicks to mm.
@@ -55,9 +63,81 @@
 /* The multiplier needed to avoid floating point math */
 #define DRIVEC_CLICK_MULTIPLIER 1000
 
+/**
+ * The difference of the wheels' clicks (right-left) for one full revolution
+ * of the robot. See turn_deg in drive_control.c - when turning on one place,
+ * both wheels drive 360*0.779 mm for a full revolution (in the opposite
+ * directions), so the difference is twice that:
+ *   2*360*0.779 mm * 7.744 click/mm ~= 4343 clicks
+ */
+#define DRIVEC_REV_CLICKS 4343L
+
+/**
+ * The quadrature decoders' timers/counters (see quadrature_init in the motor
+ * driver) - get_left_enc and get_right_enc read their CNT. drive_mm and
+ * turn_deg put the target into their compare channel A, so the motors are
+ * stopped in the compare interrupt right when a wheel gets there (see
+ * drive_target_arm in drive_control.c).
+ *
+ * NOTE: Must be the same timers as in the driver. The driver must not use
+ *       their compare channel A.
+ */
+#define DRIVEC_QDEC_LEFT TCC0
+#define DRIVEC_QDEC_LEFT_CCA_vect TCC0_CCA_vect
+#define DRIVEC_QDEC_RIGHT TCD0
+#define DRIVEC_QDEC_RIGHT_CCA_vect TCD0_CCA_vect
+
+/**
+ * The target stop in the compare interrupts is compiled in only if
+ * DRIVEC_TARGET_IRQ is 1. With 0 (e.g. the cycle benchmark image on a classic
+ * AVR, see bench/CMakeLists.txt) only the distance check of the control step
+ * stops drive_mm and turn_deg.
+ */
+#ifndef DRIVEC_TARGET_IRQ
+#define DRIVEC_TARGET_IRQ 1
+#endif
+
+/**
+ * Stopping at the end of drive_mm and turn_deg (see drive_stop in
+ * drive_control.c). motor_set(0, 0) lets the H-bridge coast - only the
+ * friction stops the motors. The brakes work against the wheels' movement
+ * (read from the encoders) until they stand still:
+ *  * DRIVEC_BRAKE_GAIN - the brake's power per click per control step of
+ *    the wheel speed (like a short brake: the faster the wheel turns, the
+ *    harder it brakes)
+ *  * DRIVEC_BRAKE_PWR - the reverse pulse's power (also the first control
+ *    step of both brakes)
+ *  * DRIVEC_STOP_MAX_TIME - the longest brake (ms)
+ */
+#define DRIVEC_BRAKE_GAIN 300
+#define DRIVEC_BRAKE_PWR DRIVEC_MAX_PWR
+#define DRIVEC_STOP_MAX_TIME 200
+
+/* ENUMS --------------------------------------------------------------------*/
+/* The target stop of drive_mm and turn_deg (see drive_target_arm) */
+enum drivec_target_enum{
+    DRIVEC_TARGET_OFF = 0,
+    DRIVEC_TARGET_ARMED = 1,
+    DRIVEC_TARGET_HIT = 2,
+    DRIVEC_TARGET_DONE = 3
+};
+
+/* How drive_mm and turn_deg stop (see DRIVEC_BRAKE_GAIN) */
+enum drivec_stop_enum{
+    DRIVEC_STOP_COAST = 0,
+    DRIVEC_STOP_BRAKE = 1,
+    DRIVEC_STOP_REVERSE = 2
+};
+
 /* PUBLIC PROTOTYPES --------------------------------------------------------*/
 void drive_control_init();
 void drive_control_reset();
+void drive_control_enc_reset();
+
+void update_pose();
+int32_t get_pose_x_mm();
+int32_t get_pose_y_mm();
+int16_t get_pose_heading_deg();
 
 uint32_t get_left_abs_enc();
 uint32_t get_right_abs_enc();
@@ -69,11 +149,12 @@ int32_t get_left_distance_mm();
 int32_t get_right_distance_mm();
 
 void drive(int16_t pwr_left, int16_t pwr_right);
-uint8_t drive_mm(int16_t distance_mm, int16_t pwr);
-uint8_t turn_deg(int32_t deg, int16_t pwr);
+uint8_t drive_mm(int16_t distance_mm, int16_t pwr, uint8_t stop);
+uint8_t turn_deg(int32_t deg, int16_t pwr, uint8_t stop);
 
 /* For debug */
 extern int16_t error;
+extern int16_t debug_u;
 extern int16_t debug_pwr_right, debug_pwr_left;
 
 #endif
@@ -1,3 +1,3 @@
 #!/bin/sh
 
-$EDITOR main.c drive_control.c drive_control.h cmd_control.c cmd_control.h
+$EDITOR main.c drive_control.c drive_control.h cmd_control.c cmd_control.h task_control.c task_control.h timer_control.c timer_control.h power_control.c power_control.h prof_control.c prof_control.h radio_control.c radio_control.h telem_control.c telem_control.h trace_control.c trace_control.h killsw_control.c killsw_control.h mem_control.c mem_control.h
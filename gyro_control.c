@@ -0,0 +1,261 @@
+/**
+ * Gyro sampling in the background.
+ *
+ * gyro_tick (every GYROC_PERIOD, see main.c) only starts a read of the
+ * gyro's outputs with the TWI master driver (Atmel AVR1308,
+ * drivers/drivers/twi_master_driver.c), its interrupt handler does the rest
+ * of the transfer a byte at a time, so nothing waits for the bus. A finished
+ * read is published in a double buffer: the interrupt copies the driver's
+ * read buffer into the spare sample and then flips gyro_seq. The next read
+ * into the other sample is started from the main loop again, so a gyro_get
+ * in the main loop never copies a half written sample and needs no locking.
+ *
+ * The gyro is set up (see gyro_config) with the first transfer and again
+ * after every failed one (e.g. the gyro has reset). A transfer that is still
+ * in progress at the next period is an overrun, one that hangs (a slave
+ * holding the bus) is aborted after GYROC_TIMEOUT.
+ *
+ * The XMEGA DMA has no TWI triggers, so the transfer is interrupt driven.
+ */
+
+#include <string.h>
+#include "gyro_control.h"
+#include "prof_control.h"
+#include "drivers/drivers/twi_master_driver.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* The longest write (the register address and the control registers) */
+#define GYROC_TX_LEN 5
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void gyro_twi_reset();
+void gyro_start(uint8_t *tx, uint8_t tx_len, uint8_t rx_len);
+void gyro_config();
+void gyro_read(uint32_t now);
+void gyro_done(uint8_t ok);
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The transfer in progress (see gyroc_state_enum) and when it started */
+volatile uint8_t gyro_state = GYROC_IDLE;
+uint32_t gyro_start_time = 0;
+
+/* Set when the gyro has been set up */
+volatile uint8_t gyro_configured = 0;
+
+/* The TWI master driver's state (the transfer's buffers and result) */
+TWI_Master_t gyro_twi;
+
+/**
+ * The double buffer: the latest sample is gyro_samples[gyro_seq & 1], the
+ * interrupt reads into the other one. gyro_have is set with the first one.
+ */
+gyro_sample_t gyro_samples[2];
+volatile uint8_t gyro_seq = 0;
+volatile uint8_t gyro_have = 0;
+
+gyro_stats_t gyro_stats;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the gyro sampling (nothing is read until the first gyro_tick).
+ */
+void gyro_control_init()
+{
+    gyro_seq = 0;
+    gyro_have = 0;
+
+    gyro_stats_t stats = {0};
+    gyro_stats = stats;
+
+    gyro_twi_reset();
+    PMIC.CTRL |= PMIC_MEDLVLEN_bm;
+}
+
+/**
+ * Sampling period - start the next read (or set the gyro up). Must be called
+ * every GYROC_PERIOD.
+ */
+void gyro_tick()
+{
+    uint32_t now = millis();
+
+    if(gyro_state != GYROC_IDLE){
+        if(now - gyro_start_time < GYROC_TIMEOUT){
+            gyro_stats.overruns++;
+            return;
+        }
+
+        /* The transfer hangs - start over (gyro_done counts the errors too) */
+        gyro_twi_reset();
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            gyro_stats.errors++;
+        }
+    }
+
+    gyro_start_time = now;
+    if(gyro_configured){
+        gyro_read(now);
+    }else{
+        gyro_config();
+    }
+}
+
+/**
+ * Get the latest sample without waiting for the bus.
+ *
+ * Parameters: sample - gyro_sample_t*, Where to copy the sample (left as it
+ *                      is if there is none yet)
+ *
+ * Returns: 0 or 1 (uint8_t) - 0 if the sample is stale (older than
+ *          GYROC_STALE_TIME) or there is none
+ */
+uint8_t gyro_get(gyro_sample_t *sample)
+{
+    if(!gyro_have){
+        gyro_stats.stale++;
+        return 0;
+    }
+
+    *sample = gyro_samples[gyro_seq & 1];
+
+    if(millis() - sample->time > GYROC_STALE_TIME){
+        gyro_stats.stale++;
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Get the latest turning rate (see gyro_get).
+ *
+ * Returns: int32_t, counter clockwise turning rate in mdeg/s (0 if there is
+ *          no sample yet)
+ */
+int32_t gyro_get_z_mdps()
+{
+    gyro_sample_t sample = {{0, 0, 0}, 0};
+    gyro_get(&sample);
+
+    return (int32_t) sample.rate[GYROC_Z]*GYROC_MDPS_PER_DIGIT_X2/2;
+}
+
+/**
+ * Get the sampling statistics.
+ *
+ * Returns: pointer to gyro_stats_t
+ */
+gyro_stats_t *gyro_get_stats()
+{
+    return &gyro_stats;
+}
+
+/**
+ * (Re)start the TWI master: drop the transfer in progress and force the bus
+ * state to idle. The gyro is set up again with the next transfer.
+ */
+void gyro_twi_reset()
+{
+    GYROC_TWI.MASTER.CTRLA = 0;
+    TWI_MasterInit(&gyro_twi, &GYROC_TWI, TWI_MASTER_INTLVL_MED_gc,
+            GYROC_TWI_BAUD);
+
+    /* TWI_MasterInit leaves the driver's state as it is */
+    gyro_twi.status = TWIM_STATUS_READY;
+    gyro_state = GYROC_IDLE;
+    gyro_configured = 0;
+}
+
+/**
+ * Start a transfer with the driver (gyro_state must be set already, the
+ * interrupt can finish the transfer right away).
+ *
+ * Parameters:
+ *      tx - uint8_t*, The bytes to write (the register address first)
+ *      tx_len - uint8_t, How many
+ *      rx_len - uint8_t, How many bytes to read after them
+ */
+void gyro_start(uint8_t *tx, uint8_t tx_len, uint8_t rx_len)
+{
+    if(!TWI_MasterWriteRead(&gyro_twi, GYROC_ADDR, tx, tx_len, rx_len)){
+        /* The driver is still busy - start over in the next period */
+        gyro_twi_reset();
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            gyro_stats.errors++;
+        }
+    }
+}
+
+/**
+ * Start writing the gyro's control registers.
+ */
+void gyro_config()
+{
+    uint8_t tx[GYROC_TX_LEN] = {GYROC_REG_CTRL1 | GYROC_REG_AUTOINC,
+        GYROC_CTRL1, GYROC_CTRL2, GYROC_CTRL3, GYROC_CTRL4};
+
+    gyro_state = GYROC_CONFIG;
+    gyro_start(tx, GYROC_TX_LEN, 0);
+}
+
+/**
+ * Start reading the outputs (into the driver's read buffer, see gyro_done).
+ *
+ * Parameters: now - uint32_t, millis
+ */
+void gyro_read(uint32_t now)
+{
+    uint8_t tx = GYROC_REG_OUT | GYROC_REG_AUTOINC;
+
+    gyro_samples[(gyro_seq+1) & 1].time = now;
+    gyro_state = GYROC_READ;
+    gyro_start(&tx, 1, sizeof(gyro_samples[0].rate));
+}
+
+/**
+ * The transfer is over (called from the interrupt): publish the sample. The
+ * outputs are little endian (the gyro's default), the same as the rate
+ * fields.
+ *
+ * Parameters: ok - uint8_t, 0 if the transfer failed
+ */
+void gyro_done(uint8_t ok)
+{
+    if(!ok){
+        gyro_stats.errors++;
+        gyro_configured = 0;
+    }else if(gyro_state == GYROC_READ){
+        gyro_sample_t *sample = &gyro_samples[(gyro_seq+1) & 1];
+        memcpy(sample->rate, (const uint8_t *) gyro_twi.readData,
+                sizeof(sample->rate));
+
+        gyro_seq++;
+        gyro_have = 1;
+        gyro_stats.samples++;
+    }else{
+        gyro_configured = 1;
+    }
+
+    gyro_state = GYROC_IDLE;
+}
+
+/**
+ * TWI master interrupt - the driver does the next step of the transfer (the
+ * next byte to write, the repeated start for reading, the next byte read or
+ * the stop), a finished transfer is published.
+ *
+ * NOTE: The driver's TWI_MasterReady is not used - it tests the status
+ *       against TWIM_STATUS_READY, which is 0.
+ */
+ISR(GYROC_TWI_vect)
+{
+    PROF_ISR_BEGIN();
+
+    TWI_MasterInterruptHandler(&gyro_twi);
+
+    if(gyro_state != GYROC_IDLE && gyro_twi.status == TWIM_STATUS_READY){
+        gyro_done(gyro_twi.result == TWIM_RESULT_OK);
+    }
+
+    PROF_ISR_END(PROF_ISR_GYRO);
+}
@@ -0,0 +1,116 @@
+#ifndef GYRO_CONTROL_H
+#define GYRO_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "drivers/board.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The gyro's TWI (I2C) master. The transfers are done by the TWI master
+ * driver (drivers/drivers/twi_master_driver.c) in the master interrupt (see
+ * gyro_control.c).
+ *
+ * NOTE: drivers/gyro.c must not use this TWI after gyro_control_init (its
+ *       blocking reads are not used). It is compiled with GYRO_NO_TWI_ISR
+ *       (see CMakeLists.txt), the vector is taken here.
+ */
+#define GYROC_TWI TWIC
+#define GYROC_TWI_vect TWIC_TWIM_vect
+
+/* TWI clock (Hz) and the BAUD register for it */
+#define GYROC_TWI_HZ 400000
+#define GYROC_TWI_BAUD ((F_CPU/(2UL*GYROC_TWI_HZ)) - 5)
+
+/**
+ * The gyro (an L3GD20, 0x6A if its SA0 is low): the bus address, the first
+ * control register (written at the start, see gyro_config) and the first
+ * output register (X_L, the outputs are read in one 6 byte transfer). The
+ * MSB of a register address makes the gyro step through the registers.
+ */
+#define GYROC_ADDR 0x6B
+#define GYROC_REG_CTRL1 0x20
+#define GYROC_REG_OUT 0x28
+#define GYROC_REG_AUTOINC 0x80
+
+/**
+ * The gyro's settings: CTRL_REG1 (380 Hz output rate, all axes on),
+ * CTRL_REG2 and CTRL_REG3 (defaults) and CTRL_REG4 (500 deg/s full scale,
+ * 17.5 mdeg/s per digit).
+ */
+#define GYROC_CTRL1 0x8F
+#define GYROC_CTRL2 0x00
+#define GYROC_CTRL3 0x00
+#define GYROC_CTRL4 0x10
+#define GYROC_MDPS_PER_DIGIT_X2 35
+
+/**
+ * Sampling period (ms) - gyro_tick should be called with this period. A
+ * 6 byte read takes ~0.25 ms at GYROC_TWI_HZ.
+ */
+#define GYROC_PERIOD 5
+
+/* A sample older than this (ms) is stale (see gyro_get) */
+#define GYROC_STALE_TIME (2*GYROC_PERIOD)
+
+/* A transfer that has not finished in this time (ms) is aborted */
+#define GYROC_TIMEOUT (4*GYROC_PERIOD)
+
+/* ENUMS --------------------------------------------------------------------*/
+/* The axes in gyro_sample_t */
+enum gyroc_axis_enum{
+    GYROC_X = 0,
+    GYROC_Y = 1,
+    GYROC_Z = 2
+};
+
+/* The transfer in progress (see gyro_tick) */
+enum gyroc_state_enum{
+    GYROC_IDLE = 0,
+    GYROC_CONFIG = 1,
+    GYROC_READ = 2
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * One gyro sample.
+ *
+ * Fields:
+ *      rate - X, Y and Z turning rate (raw, see GYROC_MDPS_PER_DIGIT_X2). Z
+ *             grows counter clockwise, the same as the pose heading.
+ *      time - millis when the sample was read
+ */
+typedef struct gyro_sample_struct{
+    int16_t rate[3];
+    uint32_t time;
+} gyro_sample_t;
+
+/**
+ * Sampling statistics.
+ *
+ * Fields:
+ *      samples - samples read
+ *      overruns - periods skipped, because the previous transfer was still
+ *                 in progress
+ *      stale - gyro_get calls that got a stale sample (or none)
+ *      errors - failed transfers (no acknowledge, bus error, timeout)
+ */
+typedef struct gyro_stats_struct{
+    uint16_t samples;
+    uint16_t overruns;
+    uint16_t stale;
+    uint16_t errors;
+} gyro_stats_t;
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void gyro_control_init();
+void gyro_tick();
+uint8_t gyro_get(gyro_sample_t *sample);
+int32_t gyro_get_z_mdps();
+gyro_stats_t *gyro_get_stats();
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Kill switch - stops the motors if there has been no communication between
+ * the robot and the camera for some time.
+ *
+ * The kill switch runs in the timebase overflow interrupt (see
+ * timer_control.c, every ~16.4 ms), so the stop latency does not depend on
+ * the main loop load: the motors are stopped at most one overflow period
+ * after the kill switch time has passed.
+ *
+ * Every valid message (see parser_task in main.c) kicks the kill switch. The
+ * CMD_HEARTBEAT message does only that (and optionally sets the kill switch
+ * time), so the camera does not have to resend motion commands to keep the
+ * robot going:
+ *
+ *      CMD_HEARTBEAT: time_ms (0 keeps the current kill switch time)
+ *
+ * e.g. 0000450701062 (heartbeat to robot 0x45).
+ */
+
+#include "killsw_control.h"
+#include "prof_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Kill switch time in timebase overflows */
+volatile uint16_t killsw_time = 0;
+
+/* Overflows left until the kill switch fires */
+volatile uint16_t killsw_left = 0;
+
+/* Set when the kill switch has fired, cleared by the next kick */
+volatile uint8_t killsw_is_fired = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the kill switch (and start it). Needs the timebase (see
+ * timer_control_init).
+ */
+void killsw_control_init()
+{
+    killsw_set_time(KILLSWC_TIME);
+    killsw_kick();
+
+    /* High level, so a busy lower level interrupt cannot delay the stop */
+    TIMERC_TC.INTFLAGS = TC0_OVFIF_bm;
+    TIMERC_TC.INTCTRLA = TC_OVFINTLVL_HI_gc;
+    PMIC.CTRL |= PMIC_HILVLEN_bm;
+}
+
+/**
+ * Set the kill switch time.
+ *
+ * Parameters: time_ms - uint16_t, Kill switch time in ms. NOTE: Values under
+ *                       KILLSWC_MIN_TIME are set to KILLSWC_MIN_TIME.
+ */
+void killsw_set_time(uint16_t time_ms)
+{
+    if(time_ms < KILLSWC_MIN_TIME) time_ms = KILLSWC_MIN_TIME;
+
+    /* Round up to whole overflows */
+    uint16_t time = (uint16_t) (((uint32_t) time_ms*1000 + TIMERC_OVF_US-1) /
+            TIMERC_OVF_US);
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        killsw_time = time;
+    }
+}
+
+/**
+ * Kick the kill switch - there was a valid message. Also lets the motors run
+ * again if the kill switch has fired.
+ */
+void killsw_kick()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        killsw_left = killsw_time;
+        killsw_is_fired = 0;
+    }
+}
+
+/**
+ * Stop the motors right away (the emergency stop, see radio_control.c). Like
+ * the kill switch firing: the motors are kept stopped until the next kick.
+ *
+ * NOTE: Called from the radio receive interrupt.
+ */
+void killsw_stop()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        motor_set(0, 0);
+        killsw_is_fired = 1;
+    }
+}
+
+/**
+ * Check if the kill switch has fired (since the last kick). While it has,
+ * the motors must be kept stopped (see set_motors in drive_control.c).
+ *
+ * Returns: 0 or 1 (uint8_t)
+ */
+uint8_t killsw_fired()
+{
+    return killsw_is_fired;
+}
+
+/**
+ * Timebase overflow interrupt - count down and stop the motors when the time
+ * is up.
+ */
+ISR(TIMERC_OVF_vect)
+{
+    PROF_ISR_BEGIN();
+
+    if(killsw_left > 0){
+        killsw_left--;
+    }else if(!killsw_is_fired){
+        motor_set(0, 0);
+        killsw_is_fired = 1;
+    }
+
+    PROF_ISR_END(PROF_ISR_TIMER);
+}
@@ -0,0 +1,32 @@
+#ifndef KILLSW_CONTROL_H
+#define KILLSW_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "drivers/motor.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "timer_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * If robot does not recieve any valid messages in KILLSWC_TIME (ms), then it
+ * stops the motors (and drops the active command). Can be changed with the
+ * CMD_HEARTBEAT command.
+ */
+#define KILLSWC_TIME 5000
+
+/* The shortest allowed kill switch time (ms) */
+#define KILLSWC_MIN_TIME 100
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void killsw_control_init();
+void killsw_kick();
+void killsw_stop();
+void killsw_set_time(uint16_t time_ms);
+uint8_t killsw_fired();
+
+#endif
@@ -14,7 +14,6 @@
  */
 
 /* LIBRARY INCLUDES ---------------------------------------------------------*/
-#include <math.h>
 #include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
@@ -24,16 +23,43 @@
 /* CUSTOM INCLUDES ----------------------------------------------------------*/
 #include "drive_control.h"
 #include "cmd_control.h"
+#include "task_control.h"
+#include "power_control.h"
+#include "prof_control.h"
+#include "radio_control.h"
+#include "telem_control.h"
+#include "trace_control.h"
+#include "killsw_control.h"
+#include "mem_control.h"
+#include "slot_control.h"
+#include "baud_control.h"
+#include "gyro_control.h"
+#include "batt_control.h"
 
 /* CONSTANTS ----------------------------------------------------------------*/
-/* Delay in milliseconds for radio communication delay */
-#define COM_DELAY 80
-
 /**
- * If robot does not recieve any commands in KILL_SWITCH_TIME (ms), then it
- * stops all acitivity (drops the active command)
+ * Task periods (ms). See the task table below and task_control.c.
+ *
+ * NOTE: The PID constants (see drive_control.h) are per control step, so
+ *       changing CONTROL_PERIOD also changes the PID tuning. The derivative
+ *       term is the error change over one step, so at 2 ms it is about 4
+ *       times stronger than in the old free running loop (about 0.5 ms a
+ *       round, not measured). In the simulator (sim_bench at 0.5 and 2 ms)
+ *       this only raises the straight driving speed overshoot from 0.5% to
+ *       1.2% (DRIVEC_D_CONST 250 gives 0.6%), the drift and the drive_mm
+ *       and turn_deg errors stay within 0.1 mm and 0.1 deg, so the
+ *       constants are kept. They have not been re-tuned on the robot.
+ * NOTE: The radio's receive interrupt triggers the parser task when a whole
+ *       string has arrived (see radio_rx_trigger), PARSER_PERIOD is only the
+ *       fallback.
  */
-#define KILL_SWITCH_TIME 5000
+#define CONTROL_PERIOD 2
+#define PARSER_PERIOD 5
+#define TELEMETRY_PERIOD TELEMC_PERIOD
+#define SLOT_PERIOD 2
+#define BAUD_PERIOD 10
+#define GYRO_PERIOD GYROC_PERIOD
+#define BATT_PERIOD BATTC_PERIOD
 
 /*
  * TODO:
@@ -63,7 +89,8 @@
  *
  * KNOWN BUGS:
  *   * In radio com there has to be an end letter (e.g. "G") to indicate the
- *     end of the whole buffer (see drivers/com.c:radio_gets()). How to fix: ?
+ *     end of the whole buffer (see radio_receive in radio_control.c). How
+ *     to fix: ?
  *     (it is not critical)
  *
  * FIXED BUGS:
@@ -80,34 +107,103 @@
  *     Should be fixed - rewrote the function without the aid of strtok.
  */
 
-/* CODE ---------------------------------------------------------------------*/
-int main(void)
-{
-    /* Radio communications variables (for sending (debug) messages) */
-    char radio_buffer[512];
-    uint32_t last_radio_com_time = 0;
+/* ENUMS --------------------------------------------------------------------*/
+/* Task IDs (index in the task table) */
+enum main_task_enum{
+    TASK_CONTROL = 0,
+    TASK_PARSER = 1,
+    TASK_TELEMETRY = 2,
+    TASK_SLOT = 3,
+    TASK_BAUD = 4,
+    TASK_GYRO = 5,
+    TASK_BATT = 6,
+    TASK_COUNT = 7
+};
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void control_task();
+void parser_task();
+void telemetry_task();
+uint8_t estop_check();
+void slot_task();
+void baud_task();
+void gyro_task();
+void batt_task();
+void query(uint8_t query_type);
+void trace(cmd_t *trace_cmd);
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/**
+ * The task table (see task_control.h). Deadlines are the same as periods - a
+ * task has to finish before it is released again.
+ */
+task_t tasks[TASK_COUNT] = {
+    {.fn = control_task, .priority = 0,
+        .period = CONTROL_PERIOD, .deadline = CONTROL_PERIOD},
+    {.fn = parser_task, .priority = 2,
+        .period = PARSER_PERIOD, .deadline = PARSER_PERIOD},
+    {.fn = telemetry_task, .priority = 3,
+        .period = TELEMETRY_PERIOD, .deadline = TELEMETRY_PERIOD},
+    {.fn = slot_task, .priority = 1,
+        .period = SLOT_PERIOD, .deadline = SLOT_PERIOD},
+    {.fn = baud_task, .priority = 5,
+        .period = BAUD_PERIOD, .deadline = BAUD_PERIOD},
+    {.fn = gyro_task, .priority = 1,
+        .period = GYRO_PERIOD, .deadline = GYRO_PERIOD},
+    {.fn = batt_task, .priority = 4,
+        .period = BATT_PERIOD, .deadline = BATT_PERIOD}
+};
 
-    /* Kill switch variables */
-    uint32_t last_cmd_time = 0;
+/* Radio communications variables (for replying to queries) */
+char query_buffer[128];
 
-    /* State handling variables */
-    cmd_t *new_cmd = NULL;
-    cmd_t *cmd = NULL;
+/**
+ * State handling variables. The active command is a copy of the parser's
+ * command (see cmd_control.c), so that the messages that do not start a new
+ * command (e.g. CMD_QUERY) do not overwrite it. Motion commands have up to
+ * three arguments: CMD_MOTORS the two powers, CMD_DRIVE and CMD_TURN the
+ * distance or angle, the power and the stop mode (data[2], DRIVEC_STOP_COAST
+ * when not given, see parser_task).
+ */
+struct active_cmd_struct{
+    uint8_t type;
+    int16_t data[3];
+    uint8_t done;
+} active_cmd_buf;
+struct active_cmd_struct *active_cmd = NULL;
 
+/* CODE ---------------------------------------------------------------------*/
+int main(void)
+{
     /* Set the system clock to 32MHz */
     clock_init();
-    /* Set up the LED and buttons */
+    /*
+     * Set up the LED, buttons and the ADC (drivers/adc.c). ADCA channel 0 is
+     * the battery voltage's (see batt_control.h), the drivers must not use
+     * it.
+     */
     board_init();
     /* Init drive control */
     drive_control_init();
+    /* Init the battery voltage compensation of the motor powers (off if
+     * board_init left the ADC unfit for it) */
+    batt_control_init();
     /* Init command control */
     init_cmd_control();
+    /* Init idle sleep (and the timebase) */
+    power_control_init();
+    /* Init telemetry (nothing is sent until the camera subscribes) */
+    telem_control_init();
+    /* Init the flight recorder (not armed until the camera arms it) */
+    trace_control_init();
+    /* Init the gyro sampling (the first sample comes with the gyro task) */
+    gyro_control_init();
 
     /*
      * More accurate radio set up goes through a program called XCTU.
-     * Here we will just set the right baud - right now 57600.
+     * Here we will just set the right baud (RADIOC_BAUD, 57600).
      */
-    radio_init(57600);
+    radio_init(RADIOC_BAUD);
 
     rgb_set(BLUE);
     while(!sw1_read());
@@ -120,74 +216,414 @@ int main(void)
 
     _delay_ms(1000);
 
+    /* From now on everything is sent with radio_send (see radio_control.c) */
+    radio_control_init();
+
+    /* No transmit slots until the camera assigns them (see slot_control.c) */
+    slot_control_init();
+
+    /* RADIOC_BAUD until the camera switches (see baud_control.c) */
+    baud_control_init();
+
+    /* Start the kill switch (see killsw_control.c) */
+    killsw_control_init();
+
+    /* Init the scheduler (all tasks are released right away) */
+    task_control_init(tasks, TASK_COUNT);
+
+    /* Parse a radio string as soon as it has arrived */
+    radio_rx_trigger(TASK_PARSER);
+#if PROF_ENABLED
+    prof_control_reset();
+#endif
 
+    /* Sleep whenever there is nothing to do */
     while(1){
-        /* If there is a new command available, then set it as currently active
-         * command (drop/stop the older command) */
-        if((new_cmd = get_cmd()) != NULL){
-            cmd = new_cmd;
-            new_cmd = NULL;
-            last_cmd_time = millis();
+        PROF_LOOP();
+
+        if(!task_run()){
+            power_idle(task_idle_time());
+        }
+    }
+}
+
+/**
+ * Parser task - if there is a new command available, then set it as currently
+ * active command (drop/stop the older command).
+ */
+void parser_task()
+{
+    estop_check();
+
+    PROF_BEGIN();
+    cmd_t *new_cmd = get_cmd();
+    PROF_END(PROF_GET_CMD);
+
+    if(new_cmd == NULL) return;
+
+    /* An emergency stop while parsing - the command may be older than it */
+    if(estop_check()) return;
+
+    /* Every valid message keeps the robot going */
+    killsw_kick();
+
+    if(new_cmd->type == CMD_HEARTBEAT){
+        if(new_cmd->data[0] > 0) killsw_set_time((uint16_t) new_cmd->data[0]);
+        return;
+    }else if(new_cmd->type == CMD_QUERY){
+        query((uint8_t) new_cmd->data[0]);
+        return;
+    }else if(new_cmd->type == CMD_TELEM){
+        telem_subscribe((uint8_t) new_cmd->data[0],
+                (uint8_t) new_cmd->data[1]);
+        return;
+    }else if(new_cmd->type == CMD_TRACE){
+        trace(new_cmd);
+        return;
+    }else if(new_cmd->type == CMD_SLOT){
+        slot_assign(new_cmd->data[0], new_cmd->data[1]);
+        return;
+    }else if(new_cmd->type == CMD_SYNC){
+        slot_sync(new_cmd->data[0]);
+        return;
+    }else if(new_cmd->type == CMD_BAUD){
+        uint8_t request = new_cmd->data_len > 1 ?
+            (uint8_t) new_cmd->data[1] : BAUDC_PROPOSE;
+
+        /* The robot stands still and sends freely during the switch */
+        if(baud_request(new_cmd->data[0], request)){
+            active_cmd = NULL;
             drive_control_reset();
+            slot_assign(0, 0);
+        }
+        return;
+    }
+
+    active_cmd_buf.type = new_cmd->type;
+    active_cmd_buf.data[0] = new_cmd->data[0];
+    active_cmd_buf.data[1] = new_cmd->data[1];
+    /* CMD_DRIVE and CMD_TURN: the optional stop mode (see drive_stop), an
+     * unknown one coasts */
+    active_cmd_buf.data[2] = DRIVEC_STOP_COAST;
+    if(new_cmd->data_len > 2 && new_cmd->data[2] >= DRIVEC_STOP_COAST &&
+            new_cmd->data[2] <= DRIVEC_STOP_REVERSE){
+        active_cmd_buf.data[2] = new_cmd->data[2];
+    }
+    active_cmd_buf.done = new_cmd->done;
+
+    active_cmd = &active_cmd_buf;
+    drive_control_reset();
+
+    /* Start executing the new command right away */
+    task_trigger(TASK_CONTROL);
+}
+
+/**
+ * Emergency stop (see radio_estop_taken) - the radio ISR has stopped the
+ * motors already, drop the active command and the queued ones.
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if there was an emergency stop
+ */
+uint8_t estop_check()
+{
+    if(!radio_estop_taken()) return 0;
+
+    flush_cmds();
+    active_cmd = NULL;
+    drive_control_reset();
+    trace_trigger(TRACE_TRIG_KILL);
+
+    return 1;
+}
+
+/**
+ * Control task - state handling of the active command (motion control).
+ */
+void control_task()
+{
+    update_pose();
+    /* Also when idle - the trigger might have been the command completion */
+    trace_record();
+
+    if(active_cmd == NULL) return;
 
-            sprintf(radio_buffer, "Got a new cmd\n\r");
+    /* The kill switch has stopped the motors - drop the active command */
+    if(killsw_fired()){
+        active_cmd->type = CMD_END;
+        trace_trigger(TRACE_TRIG_KILL);
+    }
+
+    if(active_cmd->done || active_cmd->type == CMD_END){
+        active_cmd = NULL;
+        drive_control_reset();
+    }else if(active_cmd->type == CMD_DRIVE){
+        PROF_BEGIN();
+        uint8_t done = drive_mm(active_cmd->data[0], active_cmd->data[1],
+                (uint8_t) active_cmd->data[2]);
+        PROF_END(PROF_DRIVE_MM);
+
+        if(done){
+            active_cmd->done = 1;
+            trace_trigger(TRACE_TRIG_DONE);
         }
+    }else if(active_cmd->type == CMD_TURN){
+        PROF_BEGIN();
+        uint8_t done = turn_deg(active_cmd->data[0], active_cmd->data[1],
+                (uint8_t) active_cmd->data[2]);
+        PROF_END(PROF_TURN_DEG);
 
-        /* State handling */
-        if(cmd != NULL){
-	    /* For debugging */
-            /* sprintf(radio_buffer, "ld: %ld, rd: %ld, cmd %d: %d %d %d, t: %ld\n\r",
-                    get_left_distance_mm(), get_right_distance_mm(),
-                    cmd->type, *(cmd->data), *(cmd->data+1), cmd->done,
-                    millis()); */
-
-            sprintf(radio_buffer,
-                    "le: %d, re: %d, err: %d, pwrl: %d, pwrr: %d, t: %ld\n\r",
-                    -get_left_enc(), -get_right_enc(), error, debug_pwr_left,
-                    debug_pwr_right, millis());
-
-            if(cmd->done || cmd->type == CMD_END){
-                cmd = NULL;
-                drive_control_reset();
-            }else if(cmd->type == CMD_DRIVE){
-                if(drive_mm(cmd->data[0], cmd->data[1])) cmd->done = 1;
-            }else if(cmd->type == CMD_TURN){
-                if(turn_deg(cmd->data[0], cmd->data[1])) cmd->done = 1;
-            }else if(cmd->type == CMD_MOTORS){
-                drive(cmd->data[0], cmd->data[1]);
-            }else{
-                cmd = NULL;
-                drive_control_reset();
-            }
+        if(done){
+            active_cmd->done = 1;
+            trace_trigger(TRACE_TRIG_DONE);
+        }
+    }else if(active_cmd->type == CMD_MOTORS){
+        PROF_BEGIN();
+        drive(active_cmd->data[0], active_cmd->data[1]);
+        PROF_END(PROF_DRIVE);
+    }else{
+        active_cmd = NULL;
+        drive_control_reset();
+    }
+}
+
+/**
+ * Telemetry task - send the subscribed signals (see telem_control.c) and the
+ * flight recorder dump (see trace_control.c).
+ */
+void telemetry_task()
+{
+    /* The XBee's guard times (see baud_control.c) */
+    if(baud_switching()) return;
+
+    PROF_BEGIN();
+    telem_tick();
+    PROF_END(PROF_TELEMETRY);
+
+    trace_dump_step();
+}
+
+/**
+ * Slot task - open and close the robot's transmit slot (see slot_control.c).
+ */
+void slot_task()
+{
+    slot_tick();
+}
+
+/**
+ * Baud task - switch the radio baud rate (see baud_control.c).
+ */
+void baud_task()
+{
+    baud_tick();
+}
+
+/**
+ * Gyro task - start the next gyro read (see gyro_control.c).
+ */
+void gyro_task()
+{
+    gyro_tick();
+}
+
+/**
+ * Battery task - sample the battery voltage (see batt_control.c).
+ */
+void batt_task()
+{
+    batt_tick();
+}
+
+/**
+ * Reply to a CMD_QUERY command over the radio.
+ *
+ * Parameters: query_type - uint8_t, What is queried (see cmdc_query_enum in
+ *                          cmd_control.h)
+ */
+void query(uint8_t query_type)
+{
+    if(query_type == QUERY_POWER){
+        uint16_t idle = power_get_idle_permille();
+
+        char *p = put_text(query_buffer, "idle: ");
+        p = put_dec(p, idle/10);
+        p = put_text(p, ".");
+        p = put_dec(p, idle%10);
+        p = put_text(p, "%, mcu: ");
+        p = put_dec(p, power_get_current_ua());
+        p = put_text(p, " uA, batt: ");
+        if(batt_get_ok()){
+            p = put_dec(p, batt_get_mv());
+            put_text(p, " mV\n\r");
         }else{
-            /* sprintf(radio_buffer, "cmd is NULL\n\r"); */
-            sprintf(radio_buffer, "\n\r");
+            /* The ADC does not fit, the powers are not compensated */
+            put_text(p, "off (ADC settings)\n\r");
         }
+        radio_send(query_buffer);
+    }else if(query_type == QUERY_TASKS){
+        uint8_t i = 0;
+        for(; i < TASK_COUNT; i++){
+            task_t *task = task_get(i);
 
-        /* Kill switch logic */
-        if((millis() - last_cmd_time) >= KILL_SWITCH_TIME){
-            cmd->type = CMD_END;
+            char *p = put_text(query_buffer, "task ");
+            p = put_dec(p, i);
+            p = put_text(p, ": runs: ");
+            p = put_dec(p, task->runs);
+            p = put_text(p, ", overruns: ");
+            p = put_dec(p, task->overruns);
+            put_text(p, "\n\r");
+            radio_send(query_buffer);
         }
+    }else if(query_type == QUERY_PROF){
+#if PROF_ENABLED
+        uint8_t i = 0;
+        for(; i < PROF_STAGE_COUNT; i++){
+            prof_stage_t *stage = prof_get_stage(i);
+            if(stage->count == 0) continue;
 
-	/* For debugging */
-        /*if((millis() - last_radio_com_time) >= COM_DELAY
-                || last_radio_com_time == 0){
+            /* Times in us */
+            char *p = put_text(query_buffer, "stage ");
+            p = put_dec(p, i);
+            p = put_text(p, ": n: ");
+            p = put_dec(p, stage->count);
+            p = put_text(p, ", min: ");
+            p = put_dec(p, stage->min/TIMERC_TICKS_PER_US);
+            p = put_text(p, ", avg: ");
+            p = put_dec(p, stage->sum/stage->count/TIMERC_TICKS_PER_US);
+            p = put_text(p, ", max: ");
+            p = put_dec(p, stage->max/TIMERC_TICKS_PER_US);
+            put_text(p, ", h:");
+            radio_send(query_buffer);
 
-            last_radio_com_time = millis();*/
+            uint8_t j = 0;
+            for(; j < PROF_BUCKETS; j++){
+                p = put_text(query_buffer, " ");
+                put_dec(p, stage->hist[j]);
+                radio_send(query_buffer);
+            }
+            radio_send("\n\r");
+        }
+
+        char *p = put_text(query_buffer, "loop: ");
+        p = put_dec(p, prof_get_loop_hz());
+        p = put_text(p, " Hz, isr: ");
+        p = put_dec(p, prof_get_isr_permille(PROF_ISR_TIMER));
+        p = put_text(p, " ");
+        p = put_dec(p, prof_get_isr_permille(PROF_ISR_RADIO));
+        p = put_text(p, " ");
+        p = put_dec(p, prof_get_isr_permille(PROF_ISR_ENCODER));
+        p = put_text(p, " ");
+        p = put_dec(p, prof_get_isr_permille(PROF_ISR_GYRO));
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
+#else
+        radio_send("prof: disabled\n\r");
+#endif
+    }else if(query_type == QUERY_PROF_RESET){
+#if PROF_ENABLED
+        prof_control_reset();
+#endif
+    }else if(query_type == QUERY_RADIO){
+        char *p = put_text(query_buffer, "tx: dropped: ");
+        p = put_dec(p, radio_get_dropped());
+        p = put_text(p, ", max used: ");
+        p = put_dec(p, radio_get_tx_max_used());
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
 
-            /*sprintf(radio_buffer,
-                    "le: %d, re: %d, ld: %ld, rd: %ld, lda: %ld, rda: %ld, e: %d, pwrr: %d, pwrl: %d, t: %ld\n\r",
-                    -get_left_enc(), -get_right_enc(),
-                    get_left_distance_mm(), get_right_distance_mm(),
-                    get_left_abs_distance_mm(), get_right_abs_distance_mm(),
-                    error, debug_pwr_left, debug_pwr_right, millis());*/
+        cmd_stats_t *stats = get_cmd_stats();
+        p = put_text(query_buffer, "rx: strings ");
+        p = put_dec(p, stats->strings);
+        p = put_text(p, ", ok ");
+        p = put_dec(p, stats->accepted);
+        p = put_text(p, ", other ");
+        p = put_dec(p, stats->foreign);
+        p = put_text(p, ", overruns ");
+        p = put_dec(p, radio_get_rx_overruns());
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
 
-           /* sprintf(radio_buffer, "le: %d, re: %d, ld: %ld, rd: %ld\n\r",
-                    -get_left_enc(), -get_right_enc(),
-                    get_left_distance_mm(), get_right_distance_mm());*/
+        p = put_text(query_buffer, "drop: short ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_SHORT]);
+        p = put_text(p, ", preamble ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_PREAMBLE]);
+        p = put_text(p, ", len ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_LEN]);
+        p = put_text(p, ", checksum ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_CHECKSUM]);
+        p = put_text(p, ", type ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_TYPE]);
+        p = put_text(p, ", data ");
+        p = put_dec(p, stats->dropped[CMDC_DROP_DATA]);
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
 
-            /*radio_puts(radio_buffer);*/
-        /*}*/
+        p = put_text(query_buffer, "link: ");
+        p = put_dec(p, stats->msgs_per_s);
+        p = put_text(p, " msg/s, ok ");
+        p = put_dec(p, stats->accepted_permille/10);
+        p = put_text(p, ".");
+        p = put_dec(p, stats->accepted_permille%10);
+        put_text(p, "%\n\r");
+        radio_send(query_buffer);
+    }else if(query_type == QUERY_MEM){
+        char *p = put_text(query_buffer, "ram: static ");
+        p = put_dec(p, mem_get_static());
+        p = put_text(p, ", stack max ");
+        p = put_dec(p, mem_get_stack_max());
+        p = put_text(p, ", free min ");
+        p = put_dec(p, mem_get_free_min());
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
+    }else if(query_type == QUERY_GYRO){
+        gyro_stats_t *stats = gyro_get_stats();
+        int32_t rate = gyro_get_z_mdps();
+
+        char *p = put_text(query_buffer, "gyro: z ");
+        if(rate < 0){
+            p = put_text(p, "-");
+            rate = -rate;
+        }
+        p = put_dec(p, rate);
+        p = put_text(p, " mdeg/s, samples ");
+        p = put_dec(p, stats->samples);
+        p = put_text(p, ", overruns ");
+        p = put_dec(p, stats->overruns);
+        p = put_text(p, ", stale ");
+        p = put_dec(p, stats->stale);
+        p = put_text(p, ", errors ");
+        p = put_dec(p, stats->errors);
+        put_text(p, "\n\r");
+        radio_send(query_buffer);
     }
 }
 
+/**
+ * Handle a CMD_TRACE command (see trace_control.c).
+ *
+ * Parameters: trace_cmd - cmd_t*, The command
+ */
+void trace(cmd_t *trace_cmd)
+{
+    uint8_t action = (uint8_t) trace_cmd->data[0];
+
+    if(action == TRACE_ARM){
+        uint8_t triggers = 0;
+        int16_t error_threshold = 0;
+        uint8_t post_count = 0;
+
+        if(trace_cmd->data_len > 1) triggers = (uint8_t) trace_cmd->data[1];
+        if(trace_cmd->data_len > 2) error_threshold = trace_cmd->data[2];
+        if(trace_cmd->data_len > 3) post_count = (uint8_t) trace_cmd->data[3];
+
+        trace_arm(triggers, error_threshold, post_count);
+    }else if(action == TRACE_TRIGGER){
+        trace_trigger(TRACE_TRIG_MANUAL);
+    }else if(action == TRACE_DUMP){
+        trace_dump();
+    }else if(action == TRACE_STOP){
+        trace_stop();
+    }else if(action == TRACE_RECORD){
+        trace_rec_start();
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ * SRAM usage (stack high-water mark).
+ *
+ * Right after the reset, before the .data and .bss sections are set up, all
+ * the SRAM between the end of .bss (_end) and the top of the stack (__stack)
+ * is painted with MEMC_PAINT. Later the stack can be checked for how deep it
+ * has ever been: the stack grows down from __stack, so the deepest point is
+ * where the paint is still intact from _end up to.
+ *
+ * NOTE: There is no heap (malloc is not used), so everything between _end and
+ *       the stack is free for the stack.
+ * NOTE: If a stack variable happens to hold the value MEMC_PAINT at the
+ *       deepest point, the high-water mark is off by a byte or a few.
+ */
+
+#include "mem_control.h"
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void paint_stack() __attribute__((naked, used, section(".init1")));
+uint8_t *mem_get_paint_end();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Provided by the linker */
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Paint the free SRAM. Runs in the .init1 section, i.e. before the stack
+ * pointer and the zero register are set up, so it must not use them (hence
+ * the assembly).
+ */
+void paint_stack()
+{
+    __asm volatile(
+            "    ldi r30, lo8(_end)\n"
+            "    ldi r31, hi8(_end)\n"
+            "    ldi r24, %0\n"
+            "    ldi r25, hi8(__stack)\n"
+            "    rjmp 2f\n"
+            "1:\n"
+            "    st Z+, r24\n"
+            "2:\n"
+            "    cpi r30, lo8(__stack)\n"
+            "    cpc r31, r25\n"
+            "    brlo 1b\n"
+            "    breq 1b\n"
+            :: "i" (MEMC_PAINT));
+}
+
+/**
+ * Find where the intact paint ends (the deepest point the stack has been).
+ *
+ * Returns: uint8_t*, the first painted byte that has been overwritten
+ */
+uint8_t *mem_get_paint_end()
+{
+    uint8_t *p = &_end;
+
+    while(p <= &__stack && *p == MEMC_PAINT){
+        p++;
+    }
+
+    return p;
+}
+
+/**
+ * Get the static SRAM usage (.data and .bss sections).
+ *
+ * Returns: uint16_t, bytes
+ */
+uint16_t mem_get_static()
+{
+    return (uint16_t) (&_end - &__data_start);
+}
+
+/**
+ * Get the deepest stack usage since the reset (high-water mark).
+ *
+ * Returns: uint16_t, bytes
+ */
+uint16_t mem_get_stack_max()
+{
+    return (uint16_t) (&__stack - mem_get_paint_end() + 1);
+}
+
+/**
+ * Get the smallest free SRAM since the reset (between the .bss section and
+ * the deepest stack point).
+ *
+ * Returns: uint16_t, bytes
+ */
+uint16_t mem_get_free_min()
+{
+    return (uint16_t) (mem_get_paint_end() - &_end);
+}
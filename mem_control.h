@@ -0,0 +1,17 @@
+#ifndef MEM_CONTROL_H
+#define MEM_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <avr/io.h>
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* The value the free SRAM is painted with at start-up (see mem_control.c) */
+#define MEMC_PAINT 0xC5
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+uint16_t mem_get_static();
+uint16_t mem_get_stack_max();
+uint16_t mem_get_free_min();
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * Idle sleep for saving battery.
+ *
+ * When there is nothing to do (no task is ready, see task_control.c), the CPU
+ * is put into IDLE sleep. In IDLE sleep the CPU clock is stopped but all the
+ * peripherals keep running, so any interrupt wakes the CPU up: USART RX,
+ * the millis() timer tick, the timebase alarm (see timer_control.c) etc.
+ *
+ * NOTE: The deeper sleep modes (power-save etc.) would also stop the timers
+ *       that millis(), the motor PWM and the quadrature decoders depend on,
+ *       and the USART could not wake the CPU up. So only IDLE sleep is used.
+ */
+
+#include "power_control.h"
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void power_update_stats();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Timer ticks spent sleeping in the current statistics window */
+uint32_t idle_ticks = 0;
+
+/* Start of the current statistics window (millis) */
+uint32_t stats_window_start = 0;
+
+/* Idle time of the last full statistics window (per mille) */
+uint16_t idle_permille = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize power control (and the timebase it depends on).
+ */
+void power_control_init()
+{
+    timer_control_init();
+
+    idle_ticks = 0;
+    idle_permille = 0;
+    stats_window_start = millis();
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+}
+
+/**
+ * Sleep until an interrupt happens, but not longer than max_ms. Does not
+ * sleep if a task is ready (see task_idle_time in task_control.c).
+ *
+ * Parameters: max_ms - uint16_t, Longest time to sleep in ms (e.g. the time
+ *                      until the next task release). If 0, then the function
+ *                      returns right away. NOTE: The value is throttled by the
+ *                      constant POWERC_MAX_SLEEP_MS (see power_control.h)
+ */
+void power_idle(uint16_t max_ms)
+{
+    if(max_ms == 0) return;
+    if(max_ms > POWERC_MAX_SLEEP_MS) max_ms = POWERC_MAX_SLEEP_MS;
+
+    /**
+     * An interrupt after max_ms was calculated (e.g. radio_rx_trigger) may
+     * have made a task ready, check again with the interrupts off. sei()
+     * runs the next instruction before any interrupt, so an interrupt after
+     * the check wakes sleep_cpu() up.
+     */
+    cli();
+    if(task_idle_time() == 0){
+        sei();
+        return;
+    }
+
+    uint16_t start = timer_ticks();
+    timer_set_alarm(start + max_ms*TIMERC_TICKS_PER_MS);
+
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    idle_ticks += (uint16_t) (timer_ticks() - start);
+
+    power_update_stats();
+}
+
+/**
+ * Close the statistics window if it is over.
+ */
+void power_update_stats()
+{
+    uint32_t window = millis() - stats_window_start;
+    if(window < POWERC_STATS_WINDOW) return;
+
+    /* ticks*1000 / (window*TIMERC_TICKS_PER_MS) */
+    idle_permille = (uint16_t) (idle_ticks / (window*TIMERC_TICKS_PER_US));
+    if(idle_permille > 1000) idle_permille = 1000;
+
+    idle_ticks = 0;
+    stats_window_start += window;
+}
+
+/**
+ * Get the share of time the CPU was sleeping (in the last full statistics
+ * window).
+ *
+ * Returns: uint16_t, idle time in per mille (0...1000)
+ */
+uint16_t power_get_idle_permille()
+{
+    power_update_stats();
+
+    return idle_permille;
+}
+
+/**
+ * Estimate the supply current of the microcontroller based on the idle time
+ * (see POWERC_ACTIVE_UA and POWERC_IDLE_UA in power_control.h).
+ *
+ * Returns: uint16_t, estimated current in uA
+ */
+uint16_t power_get_current_ua()
+{
+    uint32_t idle = power_get_idle_permille();
+
+    return (uint16_t) ((POWERC_IDLE_UA*idle +
+                POWERC_ACTIVE_UA*(1000-idle)) / 1000);
+}
@@ -0,0 +1,41 @@
+#ifndef POWER_CONTROL_H
+#define POWER_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#include "drivers/board.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "task_control.h"
+#include "timer_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The longest time (ms) the CPU sleeps in one go. Must be shorter than the
+ * timebase wrap-around time (see TIMERC_TICKS_PER_US in timer_control.h).
+ */
+#define POWERC_MAX_SLEEP_MS 15
+
+/* The idle percentage is calculated over POWERC_STATS_WINDOW (ms) */
+#define POWERC_STATS_WINDOW 1000
+
+/**
+ * Supply current (uA) of the microcontroller in active and idle mode at
+ * 32 MHz and 3.3 V (typical values from the ATxmega A4U datasheet). Used only
+ * for estimating the current.
+ *
+ * NOTE: Motors, the XBee and the LEDs are not included in the estimate.
+ */
+#define POWERC_ACTIVE_UA 10000
+#define POWERC_IDLE_UA 3800
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void power_control_init();
+void power_idle(uint16_t max_ms);
+uint16_t power_get_idle_permille();
+uint16_t power_get_current_ua();
+
+#endif
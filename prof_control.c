@@ -0,0 +1,198 @@
+/**
+ * Loop timing instrumentation (compiled in only if PROF_ENABLED is 1, see
+ * prof_control.h).
+ *
+ * Per stage minimum, average and maximum run time and a histogram of run
+ * times are collected with the free-running timebase (see timer_control.c),
+ * so one measurement costs only two timer reads. Also the main loop frequency
+ * and the share of time spent in the interrupts are calculated.
+ *
+ * NOTE: A stage that is interrupted also includes the interrupt time.
+ * NOTE: Stages longer than the timebase wrap-around time (~16.4 ms) cannot be
+ *       measured correctly.
+ */
+
+#include "prof_control.h"
+
+#if PROF_ENABLED
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void prof_update_window();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Stage statistics */
+prof_stage_t prof_stages[PROF_STAGE_COUNT];
+
+/* ISR ticks in the current window (written by the interrupts) */
+volatile uint32_t prof_isr_ticks[PROF_ISR_COUNT];
+
+/* ISR load of the last full window (per mille) */
+uint16_t prof_isr_permille[PROF_ISR_COUNT];
+
+/* Main loop passes in the current window and frequency of the last window */
+uint32_t prof_loops = 0;
+uint16_t prof_loop_hz = 0;
+
+/* Start of the current window (millis) */
+uint32_t prof_window_start = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Reset (or initialize) all the statistics.
+ */
+void prof_control_reset()
+{
+    uint8_t i = 0;
+    for(; i < PROF_STAGE_COUNT; i++){
+        prof_stage_t *stage = &prof_stages[i];
+
+        stage->min = UINT16_MAX;
+        stage->max = 0;
+        stage->sum = 0;
+        stage->count = 0;
+
+        uint8_t j = 0;
+        for(; j < PROF_BUCKETS; j++){
+            stage->hist[j] = 0;
+        }
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        for(i = 0; i < PROF_ISR_COUNT; i++){
+            prof_isr_ticks[i] = 0;
+            prof_isr_permille[i] = 0;
+        }
+    }
+
+    prof_loops = 0;
+    prof_loop_hz = 0;
+    prof_window_start = millis();
+}
+
+/**
+ * Record one run of a stage (see the PROF_BEGIN and PROF_END macros).
+ *
+ * Parameters:
+ *      stage - uint8_t, The stage (see prof_stage_enum in prof_control.h)
+ *      ticks - uint16_t, Run time in timer ticks
+ */
+void prof_record(uint8_t stage, uint16_t ticks)
+{
+    if(stage >= PROF_STAGE_COUNT) return;
+
+    prof_stage_t *s = &prof_stages[stage];
+
+    /* Keep the average meaningful - start over when the count saturates */
+    if(s->count == UINT16_MAX){
+        s->sum = 0;
+        s->count = 0;
+    }
+
+    if(ticks < s->min) s->min = ticks;
+    if(ticks > s->max) s->max = ticks;
+    s->sum += ticks;
+    s->count++;
+
+    uint8_t bucket = 0;
+    uint16_t limit = PROF_FIRST_BUCKET_US*TIMERC_TICKS_PER_US;
+    while(bucket < PROF_BUCKETS-1 && ticks >= limit){
+        bucket++;
+        limit <<= 1;
+    }
+    if(s->hist[bucket] < UINT16_MAX) s->hist[bucket]++;
+}
+
+/**
+ * Record one run of an interrupt (see the PROF_ISR_BEGIN and PROF_ISR_END
+ * macros). Must be called from the interrupt.
+ *
+ * Parameters:
+ *      source - uint8_t, The interrupt (see prof_isr_enum in prof_control.h)
+ *      ticks - uint16_t, Run time in timer ticks
+ */
+void prof_record_isr(uint8_t source, uint16_t ticks)
+{
+    if(source >= PROF_ISR_COUNT) return;
+
+    prof_isr_ticks[source] += ticks;
+}
+
+/**
+ * Count one main loop pass.
+ */
+void prof_loop()
+{
+    prof_loops++;
+    prof_update_window();
+}
+
+/**
+ * Close the loop frequency/ISR load window if it is over.
+ */
+void prof_update_window()
+{
+    uint32_t window = millis() - prof_window_start;
+    if(window < PROF_WINDOW) return;
+
+    prof_loop_hz = (uint16_t) (prof_loops*1000 / window);
+    prof_loops = 0;
+
+    uint8_t i = 0;
+    for(; i < PROF_ISR_COUNT; i++){
+        uint32_t ticks;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            ticks = prof_isr_ticks[i];
+            prof_isr_ticks[i] = 0;
+        }
+
+        /* ticks*1000 / (window*TIMERC_TICKS_PER_MS) */
+        prof_isr_permille[i] = (uint16_t) (ticks / (window*TIMERC_TICKS_PER_US));
+    }
+
+    prof_window_start += window;
+}
+
+/**
+ * Get the statistics of a stage.
+ *
+ * Parameters: stage - uint8_t, The stage (see prof_stage_enum)
+ *
+ * Returns: pointer to prof_stage_t or NULL if there is no such stage
+ */
+prof_stage_t *prof_get_stage(uint8_t stage)
+{
+    if(stage >= PROF_STAGE_COUNT) return NULL;
+
+    return &prof_stages[stage];
+}
+
+/**
+ * Get the main loop frequency (of the last full window).
+ *
+ * Returns: uint16_t, main loop passes per second
+ */
+uint16_t prof_get_loop_hz()
+{
+    prof_update_window();
+
+    return prof_loop_hz;
+}
+
+/**
+ * Get the interrupt load (of the last full window).
+ *
+ * Parameters: source - uint8_t, The interrupt (see prof_isr_enum)
+ *
+ * Returns: uint16_t, share of time spent in the interrupt (per mille)
+ */
+uint16_t prof_get_isr_permille(uint8_t source)
+{
+    if(source >= PROF_ISR_COUNT) return 0;
+
+    prof_update_window();
+
+    return prof_isr_permille[source];
+}
+
+#endif
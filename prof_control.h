@@ -0,0 +1,104 @@
+#ifndef PROF_CONTROL_H
+#define PROF_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <util/atomic.h>
+#include "drivers/board.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "timer_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * Loop timing instrumentation is compiled in only if PROF_ENABLED is 1 (cmake
+ * -DPROFILE=ON). Otherwise all the PROF_* macros are empty.
+ */
+#ifndef PROF_ENABLED
+#define PROF_ENABLED 0
+#endif
+
+/**
+ * Histogram bucket count. Bucket 0 counts the runs shorter than
+ * PROF_FIRST_BUCKET_US, every next bucket is twice as wide and the last
+ * bucket counts everything that did not fit into the others.
+ */
+#define PROF_BUCKETS 8
+#define PROF_FIRST_BUCKET_US 16
+
+/* Loop frequency and ISR load are calculated over PROF_WINDOW (ms) */
+#define PROF_WINDOW 1000
+
+/* ENUMS --------------------------------------------------------------------*/
+/* The measured stages */
+enum prof_stage_enum{
+    PROF_GET_CMD = 0,
+    PROF_PID_CONTROL = 1,
+    PROF_DRIVE_MM = 2,
+    PROF_TURN_DEG = 3,
+    PROF_DRIVE = 4,
+    PROF_TELEMETRY = 5,
+    PROF_STAGE_COUNT = 6
+};
+
+/**
+ * The measured interrupt sources.
+ *
+ * NOTE: Only the interrupts in this repository are measured. To include a
+ *       driver's interrupt (e.g. the encoders), wrap its body with
+ *       PROF_ISR_BEGIN() and PROF_ISR_END(PROF_ISR_ENCODER).
+ */
+enum prof_isr_enum{
+    PROF_ISR_TIMER = 0,
+    PROF_ISR_RADIO = 1,
+    PROF_ISR_ENCODER = 2,
+    PROF_ISR_GYRO = 3,
+    PROF_ISR_COUNT = 4
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * Timing statistics of one stage. All the times are in timer ticks (see
+ * TIMERC_TICKS_PER_US in timer_control.h).
+ */
+typedef struct prof_stage_struct{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint16_t count;
+    uint16_t hist[PROF_BUCKETS];
+} prof_stage_t;
+
+/* MACROS -------------------------------------------------------------------*/
+#if PROF_ENABLED
+/* Measure the time between PROF_BEGIN() and PROF_END(stage) */
+#define PROF_BEGIN() uint16_t prof_begin_ticks = timer_ticks()
+#define PROF_END(stage) \
+    prof_record(stage, (uint16_t) (timer_ticks() - prof_begin_ticks))
+
+/* The same for interrupts (ISR load) */
+#define PROF_ISR_BEGIN() uint16_t prof_isr_begin_ticks = timer_ticks()
+#define PROF_ISR_END(source) \
+    prof_record_isr(source, (uint16_t) (timer_ticks() - prof_isr_begin_ticks))
+
+/* Count main loop passes (main loop frequency) */
+#define PROF_LOOP() prof_loop()
+#else
+#define PROF_BEGIN()
+#define PROF_END(stage)
+#define PROF_ISR_BEGIN()
+#define PROF_ISR_END(source)
+#define PROF_LOOP()
+#endif
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void prof_control_reset();
+void prof_record(uint8_t stage, uint16_t ticks);
+void prof_record_isr(uint8_t source, uint16_t ticks);
+void prof_loop();
+prof_stage_t *prof_get_stage(uint8_t stage);
+uint16_t prof_get_loop_hz();
+uint16_t prof_get_isr_permille(uint8_t source);
+
+#endif
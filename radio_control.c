@@ -0,0 +1,558 @@
+/**
+ * Non-blocking radio transmitting and interrupt driven receiving.
+ *
+ * radio_puts (drivers/com.c) waits for every byte to be sent - at 57600 baud
+ * that is ~174 us per byte, so a 60 byte (debug) message would stop the main
+ * loop for over 10 ms. Here the messages are just copied into a ring buffer
+ * and the USART data register empty (DRE) interrupt sends them byte by byte
+ * in the background.
+ *
+ * With the transmit slots (see slot_control.c) the buffer is gated: the ISR
+ * sends only the bytes up to radio_tx_end, which radio_tx_release moves
+ * forward one whole message at a time when the robot's slot is open.
+ *
+ * The receive interrupt puts the received bytes into a ring buffer, where
+ * radio_receive takes them one string (ending with RADIOC_RX_END) at a time.
+ * A whole string triggers the parser task (see radio_rx_trigger), so it does
+ * not wait for the parser's period.
+ * The interrupt also watches for the emergency stop (see RADIOC_ESTOP_MARK
+ * in radio_control.h), which does not wait for the end letter or the
+ * parser: it stops the motors right in the interrupt (see killsw_stop) and
+ * drops everything received so far, so no older command can start the
+ * motors again. The parser task drops the active command (see
+ * radio_estop_taken). The ID's complement guards against a noise hit - a
+ * normal message has no RADIOC_ESTOP_MARK in it at all.
+ *
+ * NOTE: Do not mix radio_puts and radio_send after the start-up - the bytes
+ *       could get mixed up.
+ */
+
+#include "radio_control.h"
+#include "cmd_control.h"
+#include "killsw_control.h"
+#include "prof_control.h"
+#include "task_control.h"
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void radio_tx_start();
+uint8_t radio_estop_match(char byte);
+void radio_rx_flush();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Transmit ring buffer: head is written by radio_write, tail by the ISR */
+char radio_tx_buf[RADIOC_TX_BUF_LEN];
+volatile uint8_t radio_tx_head = 0;
+volatile uint8_t radio_tx_tail = 0;
+
+/* The ISR sends up to here (follows radio_tx_head when not gated) */
+volatile uint8_t radio_tx_end = 0;
+uint8_t radio_tx_gated = 0;
+
+/* Statistics */
+uint16_t radio_tx_dropped = 0;
+uint8_t radio_tx_max_used = 0;
+
+/* Receive ring buffer: head is written by the ISR, tail by radio_receive */
+char radio_rx_buf[RADIOC_RX_BUF_LEN];
+volatile uint16_t radio_rx_head = 0;
+volatile uint16_t radio_rx_tail = 0;
+
+/* Whole strings in the receive buffer */
+volatile uint16_t radio_rx_strings = 0;
+
+/* The task triggered by a whole string (see radio_rx_trigger) */
+volatile uint8_t radio_rx_task = RADIOC_NO_TASK;
+
+/* Incremented when the ISR drops the receive buffer (see radio_receive) */
+volatile uint8_t radio_rx_flushes = 0;
+
+/* Received bytes that did not fit into the receive buffer */
+volatile uint16_t radio_rx_overruns = 0;
+
+/* Emergency stop: the symbols matched so far, the ID and its complement */
+uint8_t radio_estop_pos = 0;
+uint16_t radio_estop_value = 0;
+
+/* Set by the ISR on an emergency stop, cleared by radio_estop_taken */
+volatile uint8_t radio_estop = 0;
+
+/* The current baud rate (see radio_set_baud) */
+uint32_t radio_baud = RADIOC_BAUD;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize radio transmitting and receiving. Must be called after
+ * radio_init.
+ */
+void radio_control_init()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        radio_tx_head = 0;
+        radio_tx_tail = 0;
+        radio_tx_end = 0;
+
+        radio_rx_head = 0;
+        radio_rx_tail = 0;
+        radio_rx_strings = 0;
+        radio_rx_task = RADIOC_NO_TASK;
+        radio_rx_overruns = 0;
+        radio_estop_pos = 0;
+        radio_estop = 0;
+    }
+    radio_tx_gated = 0;
+    radio_tx_dropped = 0;
+    radio_tx_max_used = 0;
+    radio_baud = RADIOC_BAUD;
+
+    /* High level receiving, so the emergency stop is not delayed */
+    RADIOC_USART.CTRLA = (RADIOC_USART.CTRLA & ~USART_RXCINTLVL_gm) |
+        USART_RXCINTLVL_HI_gc;
+    PMIC.CTRL |= PMIC_LOLVLEN_bm | PMIC_HILVLEN_bm;
+}
+
+/**
+ * Get the free space in the transmit buffer.
+ *
+ * NOTE: One byte is always kept free (to tell a full buffer from an empty
+ *       one).
+ *
+ * Returns: uint8_t, free space in bytes
+ */
+uint8_t radio_tx_free()
+{
+    uint8_t used = (uint8_t) (radio_tx_head - radio_tx_tail);
+
+    return (uint8_t) (RADIOC_TX_BUF_LEN-1 - used);
+}
+
+/**
+ * Queue data for sending (see also RADIOC_TX_POLICY in radio_control.h).
+ *
+ * Parameters:
+ *      data - string, The data to be sent (does not have to end with 0)
+ *      len - uint8_t, Length of the data
+ *
+ * Returns: uint8_t, how many bytes were dropped (0 if everything was queued)
+ */
+uint8_t radio_write(const char *data, uint8_t len)
+{
+    if(len == 0) return 0;
+
+    /* NOTE: len always fits into an empty buffer (255 bytes) */
+    uint8_t dropped = 0;
+
+    uint8_t free = radio_tx_free();
+    if(len > free){
+#if RADIOC_TX_POLICY == RADIOC_TX_OVERWRITE
+        /* Drop the oldest bytes (the ISR might be sending one of them) */
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+            free = radio_tx_free();
+            if(len > free){
+                uint8_t n = (uint8_t) (len - free);
+                if((uint8_t) (radio_tx_end - radio_tx_tail) < n){
+                    radio_tx_end = (uint8_t) (radio_tx_tail + n);
+                }
+                dropped += n;
+                radio_tx_tail += n;
+            }
+        }
+#else
+        radio_tx_dropped += len;
+        return len;
+#endif
+    }
+
+    uint8_t head = radio_tx_head;
+    uint8_t i = 0;
+    for(; i < len; i++){
+        radio_tx_buf[head++] = data[i];
+    }
+    radio_tx_head = head;
+    if(!radio_tx_gated) radio_tx_end = head;
+
+    uint8_t used = (uint8_t) (radio_tx_head - radio_tx_tail);
+    if(used > radio_tx_max_used) radio_tx_max_used = used;
+
+    radio_tx_dropped += dropped;
+    radio_tx_start();
+
+    return dropped;
+}
+
+/**
+ * Queue a string for sending. Non-blocking replacement for radio_puts.
+ *
+ * Parameters: str - string, The string to be sent
+ *
+ * Returns: uint8_t, how many bytes were dropped (0 if everything was queued)
+ */
+uint8_t radio_send(const char *str)
+{
+    uint16_t len = strnlen(str, RADIOC_TX_BUF_LEN);
+
+    return radio_write(str, (uint8_t) (len < RADIOC_TX_BUF_LEN ? len :
+                RADIOC_TX_BUF_LEN-1));
+}
+
+/**
+ * Wait until everything in the transmit buffer has been sent (e.g. for the
+ * start-up messages). With the gate closed only the released bytes are
+ * waited for.
+ */
+void radio_flush()
+{
+    while(radio_tx_end != radio_tx_tail);
+}
+
+/**
+ * Start (or keep on) sending - enable the data register empty interrupt.
+ */
+void radio_tx_start()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        RADIOC_USART.CTRLA = (RADIOC_USART.CTRLA & ~USART_DREINTLVL_gm) |
+            USART_DREINTLVL_LO_gc;
+    }
+}
+
+/**
+ * Get the count of dropped bytes (see RADIOC_TX_POLICY).
+ *
+ * Returns: uint16_t, dropped byte count (wraps around)
+ */
+uint16_t radio_get_dropped()
+{
+    return radio_tx_dropped;
+}
+
+/**
+ * Get the largest transmit buffer usage so far (for sizing the buffer).
+ *
+ * Returns: uint8_t, bytes
+ */
+uint8_t radio_get_tx_max_used()
+{
+    return radio_tx_max_used;
+}
+
+/**
+ * Gate the transmit buffer (see slot_control.c). While gated, only the bytes
+ * released with radio_tx_release are sent.
+ *
+ * Parameters: gated - uint8_t, 1 to gate, 0 to send everything right away
+ */
+void radio_tx_gate(uint8_t gated)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        radio_tx_gated = gated;
+        radio_tx_end = gated ? radio_tx_tail : radio_tx_head;
+    }
+
+    if(!gated) radio_tx_start();
+}
+
+/**
+ * Release whole messages (see RADIOC_MSG_END) for sending, as many as fit
+ * into budget. The released bytes that have not been sent yet count against
+ * the budget.
+ *
+ * Parameters: budget - uint8_t, How many bytes can be sent (e.g. the time
+ *                      left in the slot at the baud rate)
+ *
+ * Returns: uint8_t, how many bytes were released
+ */
+uint8_t radio_tx_release(uint8_t budget)
+{
+    /* The ISR only moves tail (towards end), so end is stable here */
+    uint8_t end = radio_tx_end;
+    uint8_t pending = (uint8_t) (end - radio_tx_tail);
+    if(pending >= budget) return 0;
+
+    uint8_t left = (uint8_t) (budget - pending);
+    uint8_t head = radio_tx_head;
+    uint8_t last = end;
+    uint8_t i = end;
+    for(; i != head && left > 0; left--){
+        if(radio_tx_buf[i++] == RADIOC_MSG_END) last = i;
+    }
+
+    uint8_t released = (uint8_t) (last - end);
+    if(released > 0){
+        radio_tx_end = last;
+        radio_tx_start();
+    }
+
+    return released;
+}
+
+/**
+ * Stop sending after the byte that is being sent (the end of the slot). The
+ * rest is released again in the next slot.
+ */
+void radio_tx_hold()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        radio_tx_end = radio_tx_tail;
+    }
+}
+
+/**
+ * Drop the next message if it is longer than max_len - a message that does
+ * not fit into a whole slot would block the buffer for good. The dropped
+ * bytes are counted (see radio_get_dropped).
+ *
+ * NOTE: Call only when nothing is released (at the start of the slot).
+ *
+ * Parameters: max_len - uint8_t, The longest message that can be sent
+ */
+void radio_tx_drop_long(uint8_t max_len)
+{
+    uint8_t tail = radio_tx_tail;
+    if(tail != radio_tx_end) return;
+
+    uint8_t head = radio_tx_head;
+    uint8_t i = tail;
+    uint8_t len = 0;
+    while(i != head){
+        len++;
+        if(radio_tx_buf[i++] == RADIOC_MSG_END) break;
+    }
+
+    if(len <= max_len || radio_tx_buf[(uint8_t) (i-1)] != RADIOC_MSG_END){
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        radio_tx_tail = i;
+        radio_tx_end = i;
+    }
+    radio_tx_dropped += len;
+}
+
+/**
+ * Get the next received string (without the end letter). Replaces
+ * radio_gets (drivers/com.c).
+ *
+ * Parameters:
+ *      str - string, Where to copy the string
+ *      size - uint16_t, Size of str. NOTE: The end of a longer string is cut
+ *             off.
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if a new string was copied to str
+ */
+uint8_t radio_receive(char *str, uint16_t size)
+{
+    uint16_t strings, tail;
+    uint8_t flushes;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        strings = radio_rx_strings;
+        flushes = radio_rx_flushes;
+        tail = radio_rx_tail;
+    }
+    if(strings == 0) return 0;
+
+    /* The ISR writes only after the end letter, so no locking is needed */
+    uint16_t len = 0;
+    while(1){
+        char byte = radio_rx_buf[tail];
+        tail = (tail + 1) & (RADIOC_RX_BUF_LEN-1);
+        if(byte == RADIOC_RX_END) break;
+
+        if(len+1 < size) str[len++] = byte;
+    }
+    str[len] = 0;
+
+    /* An emergency stop in the meantime has dropped the string */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(flushes != radio_rx_flushes){
+            str[0] = 0;
+            return 0;
+        }
+
+        radio_rx_tail = tail;
+        radio_rx_strings--;
+    }
+
+    return 1;
+}
+
+/**
+ * Set the task (the parser) that the receive interrupt triggers when a whole
+ * string has been received (see task_trigger).
+ *
+ * Parameters: task_id - uint8_t, Index of the task in the task table
+ *             (RADIOC_NO_TASK - none)
+ */
+void radio_rx_trigger(uint8_t task_id)
+{
+    radio_rx_task = task_id;
+}
+
+/**
+ * Change the baud rate (see baud_control.c) with the driver's radio_init.
+ * The interrupt levels are kept and the received bytes are dropped (they
+ * were garbled or from the XBee).
+ *
+ * NOTE: Call only when the transmit buffer is empty - the byte the USART is
+ *       sending would be garbled.
+ *
+ * Parameters: baud - uint32_t, The new rate
+ */
+void radio_set_baud(uint32_t baud)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        uint8_t ctrla = RADIOC_USART.CTRLA;
+        radio_init(baud);
+        RADIOC_USART.CTRLA = ctrla;
+
+        radio_rx_flush();
+        radio_estop_pos = 0;
+    }
+    radio_baud = baud;
+}
+
+/**
+ * Get the current baud rate.
+ *
+ * Returns: uint32_t, baud
+ */
+uint32_t radio_get_baud()
+{
+    return radio_baud;
+}
+
+/**
+ * Check for an emergency stop (since the last call). The motors have already
+ * been stopped (see killsw_stop), but the active command should be dropped.
+ *
+ * Returns: 0 or 1 (uint8_t)
+ */
+uint8_t radio_estop_taken()
+{
+    uint8_t estop;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        estop = radio_estop;
+        radio_estop = 0;
+    }
+
+    return estop;
+}
+
+/**
+ * Get the count of received bytes that did not fit into the receive buffer.
+ *
+ * Returns: uint16_t, byte count (wraps around)
+ */
+uint16_t radio_get_rx_overruns()
+{
+    uint16_t overruns;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        overruns = radio_rx_overruns;
+    }
+
+    return overruns;
+}
+
+/**
+ * Feed a received byte to the emergency stop matcher (from the ISR).
+ *
+ * Parameters: byte - char, The received byte
+ *
+ * Returns: 1 if the byte completed an emergency stop to this robot (or to
+ *          all of them), otherwise 0 (uint8_t)
+ */
+uint8_t radio_estop_match(char byte)
+{
+    if(byte == RADIOC_ESTOP_MARK){
+        /* A mark in the middle of the ID starts a new sequence */
+        radio_estop_pos = (radio_estop_pos == 1 || radio_estop_pos == 2) ?
+            2 : 1;
+        return 0;
+    }
+    if(radio_estop_pos < 2){
+        radio_estop_pos = 0;
+        return 0;
+    }
+
+    uint8_t digit;
+    if(byte >= '0' && byte <= '9'){
+        digit = (uint8_t) (byte - '0');
+    }else if(byte >= 'A' && byte <= 'F'){
+        digit = (uint8_t) (byte - 'A' + 10);
+    }else{
+        radio_estop_pos = 0;
+        return 0;
+    }
+
+    radio_estop_value = (uint16_t) ((radio_estop_value << 4) | digit);
+    if(++radio_estop_pos < RADIOC_ESTOP_LEN) return 0;
+    radio_estop_pos = 0;
+
+    uint8_t id = (uint8_t) (radio_estop_value >> 8);
+    if((uint8_t) (id ^ radio_estop_value) != 0xFF) return 0;
+
+    return id == ROBOT_ID || id == RADIOC_ESTOP_BROADCAST;
+}
+
+/**
+ * Drop everything in the receive buffer (from the ISR).
+ */
+void radio_rx_flush()
+{
+    radio_rx_tail = radio_rx_head;
+    radio_rx_strings = 0;
+    radio_rx_flushes++;
+}
+
+/**
+ * Receive complete interrupt - the emergency stop, otherwise put the byte
+ * into the receive buffer.
+ */
+ISR(RADIOC_RXC_vect)
+{
+    PROF_ISR_BEGIN();
+
+    char byte = RADIOC_USART.DATA;
+
+    if(radio_estop_match(byte)){
+        killsw_stop();
+        radio_rx_flush();
+        radio_estop = 1;
+    }else{
+        uint16_t head = (radio_rx_head + 1) & (RADIOC_RX_BUF_LEN-1);
+        if(head == radio_rx_tail){
+            /* A string longer than the whole buffer would block it */
+            if(radio_rx_strings == 0) radio_rx_flush();
+            radio_rx_overruns++;
+        }else{
+            radio_rx_buf[radio_rx_head] = byte;
+            radio_rx_head = head;
+            if(byte == RADIOC_RX_END){
+                radio_rx_strings++;
+                task_trigger(radio_rx_task);
+            }
+        }
+    }
+
+    PROF_ISR_END(PROF_ISR_RADIO);
+}
+
+/**
+ * Data register empty interrupt - send the next byte or stop if the buffer is
+ * empty.
+ */
+ISR(RADIOC_DRE_vect)
+{
+    PROF_ISR_BEGIN();
+
+    if(radio_tx_end != radio_tx_tail){
+        RADIOC_USART.DATA = radio_tx_buf[radio_tx_tail++];
+    }else{
+        RADIOC_USART.CTRLA &= ~USART_DREINTLVL_gm;
+    }
+
+    PROF_ISR_END(PROF_ISR_RADIO);
+}
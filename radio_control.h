@@ -0,0 +1,99 @@
+#ifndef RADIO_CONTROL_H
+#define RADIO_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "drivers/com.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The radio (XBee) USART. Must be the same USART drivers/com.c uses - the
+ * USART is still set up by radio_init, the transmitting and the receiving
+ * are done here.
+ *
+ * NOTE: drivers/com.c is built with COM_NO_RX_ISR, without its receive
+ *       interrupt (the vector is taken here, radio_gets is not used).
+ */
+#define RADIOC_USART USARTE0
+#define RADIOC_DRE_vect USARTE0_DRE_vect
+#define RADIOC_RXC_vect USARTE0_RXC_vect
+
+/**
+ * The radio baud rate after the start-up (see radio_init in main.c), the
+ * XBee must be set to the same rate. Can also be given when compiling (BAUD
+ * in CMakeLists.txt). The camera can switch to a faster rate later (see
+ * baud_control.c).
+ */
+#ifndef RADIOC_BAUD
+#define RADIOC_BAUD 57600
+#endif
+
+/**
+ * The last byte of every message the robot sends (see CMDC_MSG_END in
+ * cmd_control.h). The transmit slots (see radio_tx_release) release only
+ * whole messages.
+ */
+#define RADIOC_MSG_END '\r'
+
+/* The letter that ends a received radio string (see radio_receive) */
+#define RADIOC_RX_END 'G'
+
+/* No task is triggered by a received string (see radio_rx_trigger) */
+#define RADIOC_NO_TASK 0xFF
+
+/**
+ * Receive ring buffer size (a power of 2). Must hold the longest string (see
+ * MAX_BURST_LEN in serial-control/pisibot.py) and the start of the next one
+ * until the parser task (see main.c) takes the string.
+ */
+#define RADIOC_RX_BUF_LEN 512
+
+/**
+ * Emergency stop (see radio_control.c): RADIOC_ESTOP_MARK twice, the robot ID
+ * and the ID's complement (0xFF - ID) in hexadecimal, e.g. !!45BA to robot
+ * 0x45 and !!FF00 to all the robots.
+ */
+#define RADIOC_ESTOP_MARK '!'
+#define RADIOC_ESTOP_LEN 6
+#define RADIOC_ESTOP_BROADCAST 0xFF
+
+/**
+ * Transmit ring buffer size. Must be 256 - the buffer indexes are uint8_t and
+ * wrap around by themselves.
+ */
+#define RADIOC_TX_BUF_LEN 256
+
+/**
+ * What to do when a message does not fit into the transmit buffer:
+ *      RADIOC_TX_DROP - drop the (whole) new message
+ *      RADIOC_TX_OVERWRITE - drop the oldest bytes in the buffer to make room
+ *                            for the new message
+ */
+#define RADIOC_TX_DROP 0
+#define RADIOC_TX_OVERWRITE 1
+#define RADIOC_TX_POLICY RADIOC_TX_DROP
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void radio_control_init();
+uint8_t radio_send(const char *str);
+uint8_t radio_write(const char *data, uint8_t len);
+uint8_t radio_tx_free();
+void radio_flush();
+uint16_t radio_get_dropped();
+uint8_t radio_get_tx_max_used();
+void radio_tx_gate(uint8_t gated);
+uint8_t radio_tx_release(uint8_t budget);
+void radio_tx_hold();
+void radio_tx_drop_long(uint8_t max_len);
+uint8_t radio_receive(char *str, uint16_t size);
+void radio_rx_trigger(uint8_t task_id);
+uint8_t radio_estop_taken();
+uint16_t radio_get_rx_overruns();
+void radio_set_baud(uint32_t baud);
+uint32_t radio_get_baud();
+
+#endif
@@ -0,0 +1,462 @@
+# Encoder and decoder of the Pisibot radio messages (see get_cmd and make_msg
+# in cmd_control.c)
+#
+#   import pisibot
+#   ser.write(pisibot.motors(0x45, 300, 300))
+#   ser.write(pisibot.burst([
+#       pisibot.frame(0x45, pisibot.CMD_DRIVE, [1000, 400]),
+#       pisibot.frame(0x46, pisibot.CMD_TURN, [90, 400])]))
+#
+# A message is "0000" (preamble), the robot ID, the type and the data length
+# (2 hex digits each), the data (hexadecimal arguments separated by commas)
+# and the checksum (2 hex digits, the sum of the symbols after the preamble
+# modulo 255). The messages to the robots end with the letter G, the robots'
+# messages with "\n\r".
+#
+# The frames are cached: a teleop or a swarm controller sends the same few
+# commands over and over again.
+#
+# Scheduler divides the channel into transmit slots (see slot_control.c), so
+# the robots' telemetry does not collide with the commands.
+#
+# estop is not a message: the robot's receive interrupt stops the motors
+# right when its last symbol arrives (see radio_control.c).
+#
+# switch_baud moves the robots and the PC's XBee to a faster baud rate (see
+# baud_control.c).
+import functools, time
+
+# Message types (cmdc_cmd_enum in cmd_control.h)
+CMD_END = 0
+CMD_DRIVE = 1
+CMD_TURN = 2
+CMD_MOTORS = 3
+CMD_QUERY = 4
+CMD_TELEM = 5
+CMD_TRACE = 6
+CMD_HEARTBEAT = 7
+CMD_SLOT = 8
+CMD_SYNC = 9
+CMD_MULTI = 10
+CMD_BAUD = 11
+
+# Query types (cmdc_query_enum in cmd_control.h)
+QUERY_POWER = 0
+QUERY_TASKS = 1
+QUERY_PROF = 2
+QUERY_PROF_RESET = 3
+QUERY_RADIO = 4
+QUERY_MEM = 5
+QUERY_GYRO = 6
+
+# The stop modes of CMD_DRIVE and CMD_TURN (drivec_stop_enum in
+# drive_control.h)
+STOP_COAST = 0
+STOP_BRAKE = 1
+STOP_REVERSE = 2
+
+# Trace actions (tracec_action_enum in trace_control.h)
+TRACE_ARM = 0
+TRACE_TRIGGER = 1
+TRACE_DUMP = 2
+TRACE_STOP = 3
+TRACE_RECORD = 4
+
+# The trace dump modes (tracec_mode_enum in trace_control.h)
+TRACE_MODE_SAMPLES = 0
+TRACE_MODE_INPUT = 1
+
+# Telemetry signals (telemc_signal_enum in telem_control.h)
+TELEM_ENC = 0x01
+TELEM_DIST = 0x02
+TELEM_PID = 0x04
+TELEM_PWR = 0x08
+TELEM_POSE = 0x10
+TELEM_TIMING = 0x20
+TELEM_GYRO = 0x40
+TELEM_BATT = 0x80
+
+# Every robot accepts the messages to this ID
+BROADCAST_ID = 0xFF
+
+PREAMBLE = "0000"
+MSG_END = b"G"
+
+# The emergency stop (RADIOC_ESTOP_MARK in radio_control.h)
+ESTOP_MARK = "!"
+
+# Between the messages of a burst. The robot finds the next message by its
+# preamble, so the symbol before it must not be 0 (a checksum ending with 0
+# would make a false preamble that hides the real one).
+BURST_SEP = b" "
+
+# The longest burst string (the robot's radio buffer, CMDC_MAX_BUF_LEN in
+# cmd_control.h, with plenty of room)
+MAX_BURST_LEN = 256
+
+# The radio baud rate after the start-up (RADIOC_BAUD in radio_control.h)
+BAUD = 57600
+
+# The baud rate switch (baudc_request_enum and baudc_reply_enum in
+# baud_control.h)
+BAUD_PROPOSE = 0
+BAUD_CONFIRM = 1
+BAUD_SWITCHING = 0
+BAUD_DONE = 1
+BAUD_REFUSED = 2
+
+# The robot waits this long (s) for the confirmation (BAUDC_TIMEOUT), the
+# XBee's guard time with a margin (BAUDC_GUARD_TIME in baud_control.h)
+BAUD_TIMEOUT = 3.0
+XBEE_GUARD = 1.1
+
+# The XBee's BD of the standard rates, a larger BD is the rate itself
+XBEE_BD = {9600: 3, 19200: 4, 38400: 5, 57600: 6, 115200: 7}
+
+# The robot stops sending this long (ms) before the end of its slot
+# (SLOTC_GUARD in slot_control.h)
+SLOT_GUARD = 8
+
+def checksum(body):
+    return sum(body.encode()) % 255
+
+def _args(args):
+    return ",".join(("-%X" % -a) if a < 0 else ("%X" % a) for a in args)
+
+def _data_frame(robot_id, msg_type, data):
+    body = "%02X%02X%02X%s" % (robot_id, msg_type, len(data), data)
+    return (PREAMBLE + body + "%02X" % checksum(body)).encode()
+
+@functools.lru_cache(maxsize=256)
+def _frame(robot_id, msg_type, args):
+    return _data_frame(robot_id, msg_type, _args(args))
+
+def frame(robot_id, msg_type, args):
+    """A message without the end letter (for burst)."""
+    return _frame(robot_id, msg_type, tuple(args))
+
+@functools.lru_cache(maxsize=256)
+def _make_msg(robot_id, msg_type, args):
+    return _frame(robot_id, msg_type, args) + MSG_END
+
+def make_msg(robot_id, msg_type, args):
+    """A message to one robot, ready for ser.write."""
+    return _make_msg(robot_id, msg_type, tuple(args))
+
+def multi(records):
+    """
+    One frame (see frame) with the commands of several robots: records is a
+    list of (robot_id, msg_type, args). Every robot finds its record from an
+    offset table (see get_record in cmd_control.c), so a fleet update has
+    one preamble, header and checksum instead of one per robot.
+
+    NOTE: The robots' IDs should be close to each other - the table has an
+          entry for every ID from the smallest to the largest.
+    """
+    by_id = {}
+    for robot_id, msg_type, args in records:
+        if robot_id in by_id or robot_id == BROADCAST_ID or \
+                not 0 <= msg_type <= 15 or msg_type == CMD_MULTI:
+            raise ValueError("bad record for robot 0x%02X" % robot_id)
+        by_id[robot_id] = "%X" % msg_type + _args(args)
+    first = min(by_id)
+    count = max(by_id) - first + 1
+    offset = 4 + 2 * count
+    table = ""
+    body = ""
+    for robot_id in range(first, first + count):
+        table += "%02X" % (offset + len(body))
+        body += by_id.get(robot_id, "")
+    data = "%02X%02X" % (first, count) + table + body
+    if len(data) > 255:
+        raise ValueError("too many records")
+    return _data_frame(BROADCAST_ID, CMD_MULTI, data)
+
+def burst(frames):
+    """
+    Pack frames (see frame) into as few radio strings as possible, for one
+    ser.write: one end letter per up to MAX_BURST_LEN symbols instead of one
+    per message.
+
+    NOTE: A robot parses one of its messages per parser task run (5 ms, the
+          messages to the other robots are skipped). A robot stops parsing
+          a string at its own message, so a string has at most one message
+          for every robot (the next one starts a new string).
+    """
+    strings = []
+    string = b""
+    robot_ids = set()
+    for f in frames:
+        robot_id = int(f[4:6], 16)
+        if string and (len(string) + len(BURST_SEP) + len(f) +
+                       len(MSG_END) > MAX_BURST_LEN or
+                       robot_id in robot_ids or BROADCAST_ID in robot_ids or
+                       robot_id == BROADCAST_ID):
+            strings.append(string + MSG_END)
+            string = b""
+            robot_ids = set()
+        string += (BURST_SEP if string else b"") + f
+        robot_ids.add(robot_id)
+    if string:
+        strings.append(string + MSG_END)
+    return b"".join(strings)
+
+def parse_msg(line):
+    """A robot's message: (robot_id, type, args) or None if it is invalid."""
+    line = line.strip()
+    if len(line) < 13 or not line.startswith(PREAMBLE):
+        return None
+    body, chk = line[4:-2], line[-2:]
+    try:
+        if checksum(body) != int(chk, 16):
+            return None
+        robot_id, msg_type = int(body[0:2], 16), int(body[2:4], 16)
+        args = [int(a, 16) for a in body[6:].split(",")]
+    except ValueError:
+        return None
+    return robot_id, msg_type, args
+
+def parse_stats(line):
+    """A QUERY_RADIO reply line, e.g. "drop: short 2, checksum 5" ->
+    ("drop", {"short": 2, "checksum": 5}) or None. The "link:" line gives
+    "msg/s" and "ok" (the accepted percentage of this robot's messages)."""
+    name, sep, rest = line.strip().partition(":")
+    if not sep:
+        return None
+    stats = {}
+    for field in rest.split(","):
+        words = field.replace(":", " ").split()
+        if len(words) < 2:
+            continue
+        if words[-1] == "msg/s":
+            key, value = words[-1], words[0]
+        else:
+            key, value = " ".join(words[:-1]), words[-1]
+        try:
+            stats[key] = (float(value[:-1]) if value.endswith("%")
+                          else int(value))
+        except ValueError:
+            return None
+    return name, stats
+
+# The commands (see parser_task in main.c for the arguments)
+def end(robot_id):
+    return make_msg(robot_id, CMD_END, [0])
+
+def _stop(stop):
+    """The optional stop mode argument (coasting needs none)."""
+    return [stop] if stop != STOP_COAST else []
+
+def drive(robot_id, distance_mm, pwr, stop=STOP_COAST):
+    return make_msg(robot_id, CMD_DRIVE, [distance_mm, pwr] + _stop(stop))
+
+def turn(robot_id, deg, pwr, stop=STOP_COAST):
+    return make_msg(robot_id, CMD_TURN, [deg, pwr] + _stop(stop))
+
+def motors(robot_id, pwr_left, pwr_right):
+    return make_msg(robot_id, CMD_MOTORS, [pwr_left, pwr_right])
+
+def query(robot_id, query_type):
+    return make_msg(robot_id, CMD_QUERY, [query_type])
+
+def telem(robot_id, signals, decimation):
+    return make_msg(robot_id, CMD_TELEM, [signals, decimation])
+
+def trace(robot_id, action, *args):
+    return make_msg(robot_id, CMD_TRACE, [action] + list(args))
+
+def heartbeat(robot_id, timeout_ms=0):
+    """Keep the kill switch from firing (and set its time if not 0)."""
+    return make_msg(robot_id, CMD_HEARTBEAT, [timeout_ms])
+
+def estop(robot_id=BROADCAST_ID):
+    """
+    Emergency stop: the motors stop right away and the commands the robot
+    has not parsed yet are dropped. Any message after it (e.g. a heartbeat)
+    keeps the robot going again, but only a new command moves it.
+    """
+    return ("%s%s%02X%02X" % (ESTOP_MARK, ESTOP_MARK, robot_id,
+                              0xFF - robot_id)).encode()
+
+def baud(robot_id, rate, request=BAUD_PROPOSE):
+    """Propose or confirm a baud rate (see switch_baud)."""
+    return make_msg(robot_id, CMD_BAUD, [rate // 100, request])
+
+def read_msgs(ser, seconds):
+    """The robots' valid messages (see parse_msg) for the next seconds."""
+    end = time.monotonic() + seconds
+    rx, msgs = b"", []
+    while time.monotonic() < end:
+        rx += ser.read(ser.in_waiting or 1)
+        *lines, rx = rx.split(b"\n")
+        msgs += filter(None, (parse_msg(l.decode(errors="ignore"))
+                              for l in lines))
+    return msgs
+
+def xbee_set_baud(ser, rate):
+    """Set the PC's XBee (the AT command mode) and the serial port to rate."""
+    time.sleep(XBEE_GUARD)
+    ser.write(b"+++")
+    time.sleep(XBEE_GUARD)
+    ser.write(b"ATBD%X,CN\r" % XBEE_BD.get(rate, rate))
+    ser.flush()
+    time.sleep(0.05)
+    ser.baudrate = rate
+    ser.reset_input_buffer()
+
+def switch_baud(ser, robot_ids, rate, retry=0.1):
+    """
+    Move the robots and the PC's XBee to another baud rate (see
+    baud_control.c): propose it to every robot, switch the PC's XBee while
+    the robots switch theirs, then confirm at the new rate. The robots that
+    do not get the confirmation fall back to the old rate by themselves.
+    Returns the IDs of the robots at the new rate. If none of them made it,
+    the PC's XBee is set back to the old rate.
+
+    Call it with the robots standing still and the slots off (the robot
+    drops its command and its slot, see parser_task in main.c).
+    """
+    old = ser.baudrate
+    switching = set()
+    for robot_id in robot_ids:
+        for _ in range(3):
+            ser.write(baud(robot_id, rate))
+            replies = [m[2] for m in read_msgs(ser, retry)
+                       if m[:2] == (robot_id, CMD_BAUD)]
+            if replies:
+                break
+        # Without a reply it might still be switching (the reply was lost)
+        if not replies or replies[0][1] == BAUD_SWITCHING:
+            switching.add(robot_id)
+
+    xbee_set_baud(ser, rate)
+    done = set()
+    end = time.monotonic() + BAUD_TIMEOUT
+    while switching - done and time.monotonic() < end:
+        for robot_id in switching - done:
+            ser.write(baud(robot_id, rate, BAUD_CONFIRM))
+        for robot_id, msg_type, args in read_msgs(ser, retry):
+            if msg_type == CMD_BAUD and args == [rate // 100, BAUD_DONE]:
+                done.add(robot_id)
+
+    if not done:
+        xbee_set_baud(ser, old)
+    return done
+
+def slot(robot_id, start_ms, len_ms):
+    """Assign the robot's transmit slot (len_ms 0 - no slot)."""
+    return make_msg(robot_id, CMD_SLOT, [start_ms, len_ms])
+
+def sync(frame_ms):
+    """The beacon that starts a frame of transmit slots."""
+    return make_msg(BROADCAST_ID, CMD_SYNC, [frame_ms])
+
+class Scheduler:
+    """
+    Transmit slots (TDMA) on the shared radio channel (see slot_control.c):
+
+        | beacon, commands | robot 1 | robot 2 | ... | beacon, commands |
+
+    Every frame_ms the scheduler writes the beacon and then one string of
+    the waiting frames (see frame), the more urgent ones first. A robot
+    sends its telemetry and replies only in its slot_ms slot.
+
+        sched = pisibot.Scheduler(ser, [0x45, 0x46, 0x47])
+        sched.send(pisibot.frame(0x45, pisibot.CMD_MOTORS, [300, 300]))
+        while True:
+            time.sleep(sched.poll())
+
+    A new command replaces the robot's command that is still waiting, so a
+    command waits at most one frame (plus the robot's 5 ms parser period).
+    A frame that has waited MAX_WAIT frames goes first, whatever its
+    priority (a broadcast takes the whole string).
+    """
+    PRIO_CMD = 0
+    PRIO_CONFIG = 1
+
+    # Seconds between the beacon and the commands: the robot parses the
+    # beacon in its next parser run (5 ms), a string that arrives before
+    # that would replace it
+    GAP = 0.006
+    MAX_WAIT = 3
+
+    def __init__(self, ser, robot_ids, frame_ms=120, down_ms=30, slot_ms=18):
+        if down_ms + len(robot_ids) * slot_ms > frame_ms or \
+                slot_ms <= SLOT_GUARD:
+            raise ValueError("the slots do not fit into the frame")
+        self.ser = ser
+        self.frame_ms = frame_ms
+        self.down_ms = down_ms
+        # [priority, robot_id, frame, frames waited]
+        self.queue = []
+        self.estops = []
+        self.next_frame = time.monotonic()
+        self.string_time = None
+        for i, robot_id in enumerate(robot_ids):
+            self.send(frame(robot_id, CMD_SLOT,
+                            [down_ms + i * slot_ms, slot_ms]),
+                      self.PRIO_CONFIG)
+
+    def send(self, f, priority=PRIO_CMD):
+        """Queue a frame (see frame) for the next slot of the host."""
+        robot_id = int(f[4:6], 16)
+        if priority == self.PRIO_CMD:
+            for entry in self.queue:
+                if entry[0] == priority and entry[1] == robot_id:
+                    entry[2] = f
+                    return
+        self.queue.append([priority, robot_id, f, 0])
+
+    def poll(self):
+        """Write what is due. Returns the seconds until the next call."""
+        now = time.monotonic()
+        if self.string_time is not None and now >= self.string_time:
+            self.string_time = None
+            string = self.string()
+            if string:
+                self.ser.write(string)
+        if now >= self.next_frame:
+            self.next_frame += self.frame_ms / 1000
+            if self.next_frame < now:
+                self.next_frame = now + self.frame_ms / 1000
+            self.ser.write(b"".join(self.estops) + sync(self.frame_ms))
+            self.estops = []
+            self.string_time = now + self.GAP
+        due = self.next_frame if self.string_time is None else \
+            self.string_time
+        return max(0.0, due - time.monotonic())
+
+    def string(self):
+        """One string of the waiting frames that fits into the host's slot."""
+        budget = ((self.down_ms / 1000 - self.GAP) * self.ser.baudrate / 10 -
+                  len(sync(self.frame_ms)))
+        order = sorted(self.queue, key=lambda e: (e[3] < self.MAX_WAIT, e[0]))
+        taken = []
+        for entry in order:
+            ids = [e[1] for e in taken]
+            if entry[1] in ids or (taken and (entry[1] == BROADCAST_ID or
+                                              BROADCAST_ID in ids)):
+                continue
+            if len(burst([e[2] for e in taken + [entry]])) > min(
+                    budget, MAX_BURST_LEN):
+                continue
+            taken.append(entry)
+        for entry in self.queue:
+            entry[3] += 1
+        self.queue = [e for e in self.queue if e not in taken]
+        return burst([e[2] for e in taken])
+
+    def estop(self, robot_id=BROADCAST_ID):
+        """
+        Emergency stop (see estop) right away, without waiting for the slot,
+        and again with the next beacon (the first one can collide with a
+        robot's slot). The robot's waiting commands are dropped.
+        """
+        self.ser.write(estop(robot_id))
+        self.estops.append(estop(robot_id))
+        self.queue = [e for e in self.queue if e[0] != self.PRIO_CMD or
+                      (robot_id != BROADCAST_ID and e[1] != robot_id)]
+
+    def stop(self):
+        """Turn the slots off - the robots send freely again."""
+        self.ser.write(slot(BROADCAST_ID, 0, 0))
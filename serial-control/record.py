@@ -0,0 +1,137 @@
+# Record the input of a robot for sim/sim_replay
+# Usage: python record.py start [robot_id] [port]
+#        python record.py dump [robot_id] out.rec [port]
+#        python record.py sniff [robot_id] out.rec [port]
+#
+# start - start the robot's input recording (TRACE_RECORD, see
+#         trace_control.c). The recording stops when the buffer is full.
+# dump - dump the robot's recording into a file
+# sniff - record from the serial port (an XBee that hears the channel) until
+#         Ctrl+C: the strings the robot receives (everything up to the end
+#         letter G, without the robot's own messages) and the encoders from
+#         the robot's telemetry (subscribe with telemetry.py, signal 1). The
+#         control steps of the replay are then only at the telemetry samples,
+#         so the parser is replayed exactly but the motion control is not.
+#
+# The file format is the same as the robot's (see tracec_rec_enum in
+# trace_control.h).
+import serial, struct, sys, time
+from pisibot import CMD_TELEM, CMD_TRACE, TELEM_ENC, TRACE_DUMP, \
+    TRACE_MODE_INPUT, TRACE_RECORD, parse_msg, trace
+
+REC_KEY = 1
+REC_RX = 2
+REC_TIME = 5
+REC_MAX_DT = 0x1F
+
+def read_dump(ser, robot_id):
+    data = {}
+    count = None
+    while count is None or len(data) < count:
+        line = ser.readline()
+        if not line:
+            break
+        msg = parse_msg(line.decode(errors="ignore"))
+        if msg is None or msg[0] != robot_id or msg[1] != CMD_TRACE:
+            continue
+        args = msg[2]
+        if args[0] == -1:
+            if len(args) < 4 or args[3] != TRACE_MODE_INPUT:
+                sys.exit("not an input recording (see trace2csv.py)")
+            count, data = args[1], {}
+        else:
+            # 3 bytes per argument, the first byte lowest
+            i = args[0]
+            for arg in args[1:]:
+                for byte in range(3):
+                    # The last argument may have unused bytes
+                    if count is None or i < count:
+                        data[i] = (arg >> (8 * byte)) & 0xFF
+                    i += 1
+    if count is None:
+        sys.exit("no dump")
+    if len(data) < count:
+        # Only the part before the first lost message can be replayed
+        lost = min(i for i in range(count) if i not in data)
+        print("# %d bytes lost, keeping %d" % (count - len(data), lost),
+              file=sys.stderr)
+        count = lost
+    return bytes(data[i] for i in range(count))
+
+class Recorder:
+    def __init__(self):
+        self.data = bytearray()
+        self.t = None
+
+    def add(self, rec_type, payload=b""):
+        now = int(time.monotonic() * 1000) & 0xFFFF
+        if self.t is None:
+            self.data += bytes([REC_TIME << 5]) + struct.pack("<H", now)
+            self.t = now
+        dt = (now - self.t) & 0xFFFF
+        if dt > REC_MAX_DT:
+            self.data += bytes([REC_TIME << 5]) + struct.pack("<H", dt)
+            dt = 0
+        self.data += bytes([(rec_type << 5) | dt]) + payload
+        self.t = now
+
+def sniff(ser, robot_id):
+    rec = Recorder()
+    pending = b""
+    line = b""
+    try:
+        while True:
+            byte = ser.read(1)
+            if not byte:
+                continue
+            pending += byte
+            line += byte
+            if byte == b"G":
+                rx = pending[:-1]
+                rec.add(REC_RX, struct.pack("<H", len(rx)) + rx)
+                pending = line = b""
+            elif line.endswith(b"\n\r"):
+                # The message starts at the preamble (after the other bytes)
+                line = line[max(line.find(b"0000"), 0):]
+                msg = parse_msg(line.decode(errors="ignore"))
+                if msg is not None and msg[0] == robot_id:
+                    # The robot does not hear itself
+                    pending = pending[:-len(line)]
+                    args = msg[2]
+                    if msg[1] == CMD_TELEM and args[0] & TELEM_ENC:
+                        # The telemetry has forward positive encoders
+                        rec.add(REC_KEY, struct.pack("<hh", -args[2],
+                                                     -args[3]))
+                line = b""
+    except KeyboardInterrupt:
+        pass
+    return bytes(rec.data)
+
+if len(sys.argv) < 2 or sys.argv[1] not in ("start", "dump", "sniff"):
+    sys.exit("usage: python record.py start|dump|sniff [robot_id] [out.rec] "
+             "[port]")
+
+action = sys.argv[1]
+robot_id = int(sys.argv[2], 16) if len(sys.argv) > 2 else 0x45
+if action == "start":
+    port = sys.argv[3] if len(sys.argv) > 3 else "/dev/ttyACM0"
+else:
+    if len(sys.argv) < 4:
+        sys.exit("usage: python record.py %s [robot_id] out.rec [port]"
+                 % action)
+    out = sys.argv[3]
+    port = sys.argv[4] if len(sys.argv) > 4 else "/dev/ttyACM0"
+
+ser = serial.Serial(port, 57600, timeout=2)
+if action == "start":
+    ser.write(trace(robot_id, TRACE_RECORD))
+elif action == "dump":
+    ser.write(trace(robot_id, TRACE_DUMP))
+    data = read_dump(ser, robot_id)
+    open(out, "wb").write(data)
+    print("# %d bytes" % len(data), file=sys.stderr)
+else:
+    data = sniff(ser, robot_id)
+    open(out, "wb").write(data)
+    print("# %d bytes" % len(data), file=sys.stderr)
+ser.close()
@@ -1,104 +1,208 @@
-# NB! Requires root to run
-import serial, keyboard, subprocess, time
-
-ser = serial.Serial("/dev/ttyACM0")
+# Drive a robot with the keyboard (manual driving, e.g. during the arena set
+# up)
+# NB! Requires root to run (the keyboard module reads the input devices)
+# Usage: python serial-control.py [robot_id] [port]
+#
+# Vim keys are superior :)
+#   k/j - forward/backwards, h/l - left/right (can be combined with k and j).
+#         The longer a key is held, the faster (MIN_PWR...MAX_PWR in
+#         RAMP_TIME).
+#   8/9 - drive 2 m (2000 mm) backwards/forward
+#   space - emergency stop (see pisibot.estop)
+#   q - quit
+#
+# The key events come from the keyboard hooks (no polling). While the motor
+# powers change they are sent (CMD_MOTORS) at most every SEND_PERIOD, when
+# nothing changes a heartbeat is sent every HEARTBEAT_PERIOD: the kill switch
+# time is set to KILL_TIME, so the robot stops soon if this script or the
+# radio link dies (see killsw_control.c). The round trip time of a radio
+# query (QUERY_RADIO) is measured every RTT_PERIOD and the status line shows
+# the link quality from its reply (the robot's accepted messages).
+import asyncio, keyboard, serial, subprocess, sys, time
+import pisibot
+
+# Powers (see DRIVEC_MAX_PWR in drive_control.h)
+MIN_PWR = 150
+MAX_PWR = 600
+TURN_PWR = 300
+# How much of the turn power is used when turning while driving
+TURN_RATIO = 0.5
+# Seconds from MIN_PWR to MAX_PWR
+RAMP_TIME = 1.0
+# The powers are rounded, so there are fewer updates (and the frames cache)
+PWR_STEP = 25
+
+# Seconds
+SEND_PERIOD = 0.05
+HEARTBEAT_PERIOD = 0.2
+RTT_PERIOD = 1.0
+
+# The kill switch time while driving and after quitting (KILLSWC_TIME in
+# killsw_control.h), ms
+KILL_TIME = 500
+KILL_TIME_DEFAULT = 5000
+
+DRIVE_KEYS = ("k", "j", "h", "l")
+
+def level(pressed, key, now):
+    """How much the key is pressed: 0 (not pressed), MIN_PWR...MAX_PWR."""
+    if key not in pressed:
+        return 0
+    ramp = min(1.0, (now - pressed[key]) / RAMP_TIME)
+    return MIN_PWR + (MAX_PWR - MIN_PWR) * ramp
+
+def powers(pressed, now):
+    """The motor powers (left, right) of the pressed keys."""
+    drive = level(pressed, "k", now) - level(pressed, "j", now)
+    turn = (TURN_PWR if "h" in pressed else 0) - \
+        (TURN_PWR if "l" in pressed else 0)
+    if drive != 0:
+        turn *= TURN_RATIO
+    pwr = []
+    for p in (drive - turn, drive + turn):
+        p = int(round(p / PWR_STEP)) * PWR_STEP
+        pwr.append(max(-MAX_PWR, min(MAX_PWR, p)))
+    return tuple(pwr)
+
+class Teleop:
+    def __init__(self, ser, robot_id):
+        self.ser = ser
+        self.robot_id = robot_id
+        self.events = asyncio.Queue()
+        self.pressed = {}
+        self.sent = (0, 0)
+        self.last_send = 0.0
+        self.rx = b""
+        self.rtt_sent = None
+        self.rtts = []
+        self.link = None
+        self.dropped = 0
+
+    def write(self, msg):
+        try:
+            self.ser.write(msg)
+        except serial.SerialTimeoutException:
+            # The serial port's buffer is full - a newer update follows
+            self.dropped += 1
+        self.last_send = time.monotonic()
+
+    def key_event(self, event):
+        """keyboard hook (in the keyboard module's thread)."""
+        self.loop.call_soon_threadsafe(self.events.put_nowait,
+                                       (event.name, event.event_type ==
+                                        keyboard.KEY_DOWN))
+
+    def readable(self):
+        """The robot's messages (the query replies end with "\\n\\r")."""
+        self.rx += self.ser.read(self.ser.in_waiting or 1)
+        while b"\n" in self.rx:
+            line, self.rx = self.rx.split(b"\n", 1)
+            line = line.strip(b"\r")
+            if line.startswith(b"tx:") and self.rtt_sent is not None:
+                self.rtts.append(time.monotonic() - self.rtt_sent)
+                self.rtt_sent = None
+            stats = pisibot.parse_stats(line.decode(errors="ignore"))
+            if stats and stats[0] == "link":
+                self.link = stats[1]
+                self.status()
+
+    def status(self):
+        rtt = ""
+        if self.rtts:
+            last = self.rtts[-100:]
+            rtt = "rtt %.0f ms (min %.0f, max %.0f)" % (
+                last[-1] * 1000, min(last) * 1000, max(last) * 1000)
+        link = ""
+        if self.link:
+            link = "link ok %.1f%% (%d msg/s)" % (self.link.get("ok", 0),
+                                                self.link.get("msg/s", 0))
+        print("\r%4d %4d  %s  %s  dropped %d   " % (
+            self.sent + (rtt, link, self.dropped)), end="", flush=True)
+
+    async def rtt(self):
+        while True:
+            self.rtt_sent = time.monotonic()
+            self.write(pisibot.query(self.robot_id, pisibot.QUERY_RADIO))
+            await asyncio.sleep(RTT_PERIOD)
+
+    async def control(self):
+        """Send the key events to the robot until q."""
+        self.write(pisibot.heartbeat(self.robot_id, KILL_TIME))
+        while True:
+            now = time.monotonic()
+            # Wake up for the rate limit, the ramp or the next heartbeat
+            ramping = any(now - t < RAMP_TIME for t in self.pressed.values())
+            if powers(self.pressed, now) != self.sent:
+                timeout = self.last_send + SEND_PERIOD - now
+            elif ramping:
+                timeout = SEND_PERIOD
+            else:
+                timeout = self.last_send + HEARTBEAT_PERIOD - now
+            timeout = max(0.0, timeout)
+            try:
+                key, down = await asyncio.wait_for(self.events.get(), timeout)
+            except asyncio.TimeoutError:
+                key = None
+
+            now = time.monotonic()
+            if key == "q":
+                break
+            elif key in DRIVE_KEYS:
+                if down:
+                    self.pressed.setdefault(key, now)
+                else:
+                    self.pressed.pop(key, None)
+            elif key in ("8", "9", "space") and down:
+                self.pressed.clear()
+                if key == "space":
+                    self.write(pisibot.estop(self.robot_id))
+                else:
+                    self.write(pisibot.drive(self.robot_id,
+                                             2000 if key == "9" else -2000,
+                                             500))
+                self.sent = (0, 0)
+                continue
+
+            pwr = powers(self.pressed, now)
+            if pwr != self.sent and now - self.last_send >= SEND_PERIOD:
+                if pwr == (0, 0):
+                    self.write(pisibot.end(self.robot_id))
+                else:
+                    self.write(pisibot.motors(self.robot_id, *pwr))
+                self.sent = pwr
+                self.status()
+            elif now - self.last_send >= HEARTBEAT_PERIOD:
+                # Does not change the robot's command (see parser_task)
+                self.write(pisibot.heartbeat(self.robot_id))
+
+    async def run(self):
+        self.loop = asyncio.get_running_loop()
+        self.loop.add_reader(self.ser.fileno(), self.readable)
+        keyboard.hook(self.key_event)
+        rtt = asyncio.create_task(self.rtt())
+        try:
+            await self.control()
+        finally:
+            keyboard.unhook_all()
+            rtt.cancel()
+            self.loop.remove_reader(self.ser.fileno())
+            self.ser.write(pisibot.end(self.robot_id))
+            self.ser.write(pisibot.heartbeat(self.robot_id,
+                                             KILL_TIME_DEFAULT))
+
+robot_id = int(sys.argv[1], 16) if len(sys.argv) > 1 else 0x45
+port = sys.argv[2] if len(sys.argv) > 2 else "/dev/ttyACM0"
+
+# Non-blocking: the reads are done when there is something to read, a write
+# that does not fit into the buffer is dropped
+ser = serial.Serial(port, 57600, timeout=0, write_timeout=0)
 
 # Hack for disabling the keys pressed showing up in the terminal
 subprocess.run(["stty", "-echo"], check=True)
 
-last_key = ""
-
-# Delay for throttling the while loop (in ms)
-delay = 10
-last_delay_at = 0
-
-
-def millis():
-    return(time.time() * 1000)
-
-def get_key_pressed():
-    if keyboard.is_pressed("k"):
-        return "k"
-    elif keyboard.is_pressed("j"):
-        return "j"
-    elif keyboard.is_pressed("l"):
-        return "l"
-    elif keyboard.is_pressed("h"):
-        return "h"
-    elif keyboard.is_pressed("8"):
-        return "8"
-    elif keyboard.is_pressed("9"):
-        return "9"
-    else:
-        return ""
-
-# Vim keys are superior :)
-while True:
-    if millis() - last_delay_at >= delay:
-        last_delay_at = millis()
-        if keyboard.is_pressed("q"):
-            print("Exiting...")
-            break
-        elif get_key_pressed() == "k" and last_key != "k":
-            # Drive forward (motor_set 100,100)
-            #ser.write(b'000045030564,6433G')
-            
-            # Drive forward (motor_set 200,200)
-            #ser.write(b'000045030596,963DG')
-            
-            # Drive forward (motor_set 300,300)
-            ser.write(b'000045030712C,12CADG')
-
-            # Drive forward (motor_set 500,500)
-            #ser.write(b'00004503071F4,1F4B7G')
-            last_key = "k"
-        elif get_key_pressed() == "j" and last_key != "j":
-            # Drive backwards (motor_set -100,-100)
-            #ser.write(b'0000450307-64,-648FG')
-            
-            # Drive backwards (motor_set -200,-200)
-            #ser.write(b'0000450307-96,-9699G')
-            
-            # Drive backwards (motor_set -300,-300)
-            ser.write(b'0000450309-12C,-12C0AG')
-
-            # Drive backwards (motor_set -500,-500)
-            #ser.write(b'0000450309-1F4,-1F414G')
-
-            last_key = "j"
-        elif get_key_pressed() == "l" and last_key != "l":
-            # Turn right (motor_set 300,-300)
-            #ser.write(b'000069030812C,-12CE1G')
-            
-            # Turn right (motor_set 200,-200)
-            ser.write(b'0000450306C8,-C883G')
-
-            last_key = "l"
-        elif get_key_pressed() == "h" and last_key != "h":
-            # Turn left (motor_set -300,300)
-            #ser.write(b'0000690308-12C,12CE1G')
-            
-            # Turn left (motor_set -200,200)
-            ser.write(b'0000450306-C8,C883G')
-            
-            last_key = "h"
-        elif get_key_pressed() == "8" and last_key != "8":
-            # Drive 2000 mm (2 m) backwards
-            ser.write(b'0000690108-7D0,1F4E9G')
-            last_key = "8"
-        elif get_key_pressed() == "9" and last_key != "9":
-            # Drive 2000 mm (2 m) forward
-            ser.write(b'00006901077D0,1F4BBG')
-            last_key = "9"
-        elif get_key_pressed() == "" and last_key != "" and last_key != "8" and last_key != "9":
-            # Send END (stop) command 
-            ser.write(b'000045000105BG')
-            last_key = ""
-
-
-input("Press enter to continue...")
-print()
-
-subprocess.run(["stty", "echo"], check=True)
-
-ser.close()
+try:
+    asyncio.run(Teleop(ser, robot_id).run())
+finally:
+    print("\nExiting...")
+    subprocess.run(["stty", "echo"], check=True)
+    ser.close()
@@ -0,0 +1,43 @@
+# Subscribe to robot telemetry and print the decoded messages
+# Usage: python telemetry.py [robot_id] [signals] [decimation]
+#   e.g. python telemetry.py 45 5 5 (encoders and PID error every 50 ms)
+# See telem_control.c for the signals and the message format
+import serial, sys
+from pisibot import CMD_TELEM, parse_msg, telem
+
+# Signal bits and the names of their values (in the message order)
+SIGNALS = [
+    (0x01, ["le", "re"]),
+    (0x02, ["ld", "rd"]),
+    (0x04, ["err"]),
+    (0x08, ["pwrl", "pwrr"]),
+    (0x10, ["x", "y", "hdg"]),
+    (0x20, ["idle", "hz", "overruns"]),
+]
+
+def decode(args):
+    signals, values = args[0], args[2:]
+    fields = {"t": args[1]}
+    for bit, names in SIGNALS:
+        if signals & bit:
+            for name in names:
+                fields[name] = values.pop(0)
+    return fields
+
+robot_id = int(sys.argv[1], 16) if len(sys.argv) > 1 else 0x45
+signals = int(sys.argv[2], 16) if len(sys.argv) > 2 else 0x05
+decimation = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+
+ser = serial.Serial("/dev/ttyACM0", 57600)
+ser.write(telem(robot_id, signals, decimation))
+
+try:
+    while True:
+        msg = parse_msg(ser.readline().decode(errors="ignore"))
+        if msg is None or msg[1] != CMD_TELEM:
+            continue
+        print("%02X: %s" % (msg[0], decode(msg[2])))
+except KeyboardInterrupt:
+    # Stop the telemetry
+    ser.write(telem(robot_id, 0, 0))
+    ser.close()
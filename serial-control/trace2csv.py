@@ -0,0 +1,53 @@
+# Dump the flight recorder of a robot and convert it to CSV
+# Usage: python trace2csv.py [robot_id] > trace.csv
+#        python trace2csv.py [robot_id] captured.log > trace.csv
+# Without a log file the dump is requested over the serial port. See
+# trace_control.c for the dump format.
+import serial, sys
+from pisibot import CMD_TRACE, TRACE_DUMP, TRACE_MODE_INPUT, parse_msg, trace
+
+COLUMNS = ["i", "t", "le", "re", "err", "u", "pwrl", "pwrr"]
+
+def read_dump(lines, robot_id):
+    samples = {}
+    count = None
+    for line in lines:
+        msg = parse_msg(line)
+        if msg is None or msg[0] != robot_id or msg[1] != CMD_TRACE:
+            continue
+        args = msg[2]
+        if args[0] == -1:
+            if len(args) > 3 and args[3] == TRACE_MODE_INPUT:
+                sys.exit("input recording, use record.py dump")
+            count, source = args[1], args[2]
+            samples = {}
+            print("# %d samples, trigger %d" % (count, source), file=sys.stderr)
+        else:
+            samples[args[0]] = args
+        if count is not None and len(samples) >= count:
+            break
+    if count is not None and len(samples) < count:
+        print("# %d samples lost" % (count - len(samples)), file=sys.stderr)
+    return [samples[i] for i in sorted(samples)]
+
+def serial_lines(ser):
+    # Stop when nothing arrives within the timeout
+    while True:
+        line = ser.readline()
+        if not line:
+            return
+        yield line.decode(errors="ignore")
+
+robot_id = int(sys.argv[1], 16) if len(sys.argv) > 1 else 0x45
+
+if len(sys.argv) > 2:
+    samples = read_dump(open(sys.argv[2], errors="ignore"), robot_id)
+else:
+    ser = serial.Serial("/dev/ttyACM0", 57600, timeout=2)
+    ser.write(trace(robot_id, TRACE_DUMP))
+    samples = read_dump(serial_lines(ser), robot_id)
+    ser.close()
+
+print(",".join(COLUMNS))
+for sample in samples:
+    print(",".join(str(v) for v in sample))
@@ -0,0 +1,19 @@
+# Replays a recording and fails if the output differs from the expected one
+# (a regression test of the parser and the drive control, see CMakeLists.txt):
+#   cmake -DREPLAY=sim_replay -DREC=drive.rec -DEXPECTED=drive.csv
+#         -DOUT=drive_out.csv -P replay_check.cmake
+#
+# A change that is meant to change the output (e.g. a new PID tuning) needs
+# a new expected file: sim_replay drive.rec > drive.csv
+
+execute_process(COMMAND ${REPLAY} ${REC} OUTPUT_FILE ${OUT}
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${REPLAY} failed for ${REC}")
+endif()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${EXPECTED} ${OUT}
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${OUT} differs from ${EXPECTED}")
+endif()
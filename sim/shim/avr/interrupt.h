@@ -0,0 +1,15 @@
+/**
+ * Host stand-in for <avr/interrupt.h> (see sim/README.md). An interrupt
+ * handler is a plain function named after its vector (e.g. TCE0_OVF_vect),
+ * the simulator calls it when the interrupt would fire.
+ */
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void); void vector(void){}
+
+void sei(void);
+void cli(void);
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * Host stand-in for <avr/io.h> (see sim/README.md). Only the peripherals the
+ * firmware in this repository touches are here. The registers are plain
+ * memory (see sim_hw.c): the firmware writes them as usual and the simulator
+ * reads them to decide which interrupts are enabled.
+ */
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+/* ATxmega32A4U SRAM */
+#define RAMSTART 0x2000
+#define RAMEND 0x2FFF
+
+/* Timer/counter */
+typedef struct TC0_struct{
+    volatile uint8_t CTRLA, CTRLB, CTRLC, CTRLD, CTRLE;
+    volatile uint8_t INTCTRLA, INTCTRLB;
+    volatile uint8_t CTRLFCLR, CTRLFSET, CTRLGCLR, CTRLGSET;
+    volatile uint8_t INTFLAGS, TEMP;
+    volatile uint16_t CNT, PER, CCA, CCB, CCC, CCD;
+    volatile uint16_t PERBUF, CCABUF, CCBBUF, CCCBUF, CCDBUF;
+} TC0_t;
+
+typedef TC0_t TC1_t;
+
+extern TC0_t TCC0, TCD0, TCE0;
+extern TC1_t TCC1, TCD1;
+
+#define TC_CLKSEL_gm 0x0F
+#define TC_CLKSEL_OFF_gc 0x00
+#define TC_CLKSEL_DIV1_gc 0x01
+#define TC_CLKSEL_DIV8_gc 0x04
+#define TC_CLKSEL_DIV64_gc 0x05
+#define TC_CLKSEL_DIV256_gc 0x06
+#define TC_CLKSEL_DIV1024_gc 0x07
+#define TC_WGMODE_NORMAL_gc 0x00
+
+#define TC_OVFINTLVL_gm 0x03
+#define TC_OVFINTLVL_OFF_gc 0x00
+#define TC_OVFINTLVL_LO_gc 0x01
+#define TC_OVFINTLVL_MED_gc 0x02
+#define TC_OVFINTLVL_HI_gc 0x03
+
+#define TC_CCAINTLVL_gm 0x03
+#define TC_CCAINTLVL_OFF_gc 0x00
+#define TC_CCAINTLVL_LO_gc 0x01
+#define TC_CCAINTLVL_MED_gc 0x02
+#define TC_CCAINTLVL_HI_gc 0x03
+#define TC_CCBINTLVL_gm 0x0C
+#define TC_CCBINTLVL_OFF_gc 0x00
+#define TC_CCBINTLVL_LO_gc 0x04
+#define TC_CCBINTLVL_MED_gc 0x08
+#define TC_CCBINTLVL_HI_gc 0x0C
+
+#define TC0_CCAINTLVL_gm 0x03
+
+#define TC0_OVFIF_bm 0x01
+#define TC0_CCAIF_bm 0x10
+#define TC0_CCBIF_bm 0x20
+#define TC1_OVFIF_bm 0x01
+#define TC1_CCAIF_bm 0x10
+#define TC1_CCBIF_bm 0x20
+
+/* Programmable multilevel interrupt controller */
+typedef struct PMIC_struct{
+    volatile uint8_t STATUS, INTPRI, CTRL;
+} PMIC_t;
+
+extern PMIC_t PMIC;
+
+#define PMIC_LOLVLEN_bm 0x01
+#define PMIC_MEDLVLEN_bm 0x02
+#define PMIC_HILVLEN_bm 0x04
+
+/* USART */
+typedef struct USART_struct{
+    volatile uint8_t DATA, STATUS, reserved;
+    volatile uint8_t CTRLA, CTRLB, CTRLC;
+    volatile uint8_t BAUDCTRLA, BAUDCTRLB;
+} USART_t;
+
+extern USART_t USARTC0, USARTC1, USARTD0, USARTD1, USARTE0;
+
+#define USART_RXCINTLVL_gm 0x30
+#define USART_RXCINTLVL_OFF_gc 0x00
+#define USART_RXCINTLVL_LO_gc 0x10
+#define USART_RXCINTLVL_MED_gc 0x20
+#define USART_RXCINTLVL_HI_gc 0x30
+#define USART_TXCINTLVL_gm 0x0C
+#define USART_DREINTLVL_gm 0x03
+#define USART_DREINTLVL_OFF_gc 0x00
+#define USART_DREINTLVL_LO_gc 0x01
+#define USART_DREINTLVL_MED_gc 0x02
+#define USART_DREINTLVL_HI_gc 0x03
+
+#define USART_RXCIF_bm 0x80
+#define USART_TXCIF_bm 0x40
+#define USART_DREIF_bm 0x20
+#define USART_FERR_bm 0x10
+#define USART_BUFOVF_bm 0x08
+#define USART_PERR_bm 0x04
+
+#define USART_RXEN_bm 0x10
+#define USART_TXEN_bm 0x08
+#define USART_CLK2X_bm 0x04
+
+/* Analog to digital converter (ADC) */
+typedef struct ADC_CH_struct{
+    volatile uint8_t CTRL, MUXCTRL, INTCTRL, INTFLAGS;
+    volatile uint16_t RES;
+    volatile uint8_t SCAN;
+} ADC_CH_t;
+
+typedef struct ADC_struct{
+    volatile uint8_t CTRLA, CTRLB, REFCTRL, EVCTRL, PRESCALER, INTFLAGS;
+    volatile uint16_t CMP;
+    ADC_CH_t CH0, CH1, CH2, CH3;
+} ADC_t;
+
+extern ADC_t ADCA;
+
+#define ADC_ENABLE_bm 0x01
+#define ADC_CONMODE_bm 0x10
+#define ADC_RESOLUTION_gm 0x06
+#define ADC_RESOLUTION_12BIT_gc 0x00
+#define ADC_REFSEL_gm 0x70
+#define ADC_REFSEL_INT1V_gc 0x00
+#define ADC_REFSEL_INTVCC_gc 0x10
+#define ADC_PRESCALER_DIV256_gc 0x06
+
+#define ADC_CH_START_bm 0x80
+#define ADC_CH_INPUTMODE_SINGLEENDED_gc 0x01
+#define ADC_CH_MUXPOS_gm 0x78
+#define ADC_CH_MUXPOS_PIN1_gc 0x08
+#define ADC_CH_CHIF_bm 0x01
+
+/* Two wire interface (TWI) */
+typedef struct TWI_MASTER_struct{
+    volatile uint8_t CTRLA, CTRLB, CTRLC, STATUS;
+    volatile uint8_t BAUD, ADDR, DATA;
+} TWI_MASTER_t;
+
+typedef struct TWI_SLAVE_struct{
+    volatile uint8_t CTRLA, CTRLB, STATUS, ADDR, DATA, ADDRMASK;
+} TWI_SLAVE_t;
+
+typedef struct TWI_struct{
+    volatile uint8_t CTRL;
+    TWI_MASTER_t MASTER;
+    TWI_SLAVE_t SLAVE;
+} TWI_t;
+
+extern TWI_t TWIC, TWIE;
+
+#define TWI_MASTER_INTLVL_gm 0xC0
+#define TWI_MASTER_INTLVL_OFF_gc 0x00
+#define TWI_MASTER_INTLVL_LO_gc 0x40
+#define TWI_MASTER_INTLVL_MED_gc 0x80
+#define TWI_MASTER_INTLVL_HI_gc 0xC0
+#define TWI_MASTER_RIEN_bm 0x20
+#define TWI_MASTER_WIEN_bm 0x10
+#define TWI_MASTER_ENABLE_bm 0x08
+
+#define TWI_MASTER_ACKACT_bm 0x04
+#define TWI_MASTER_CMD_gm 0x03
+#define TWI_MASTER_CMD_NOACT_gc 0x00
+#define TWI_MASTER_CMD_REPSTART_gc 0x01
+#define TWI_MASTER_CMD_RECVTRANS_gc 0x02
+#define TWI_MASTER_CMD_STOP_gc 0x03
+
+#define TWI_MASTER_RIF_bm 0x80
+#define TWI_MASTER_WIF_bm 0x40
+#define TWI_MASTER_CLKHOLD_bm 0x20
+#define TWI_MASTER_RXACK_bm 0x10
+#define TWI_MASTER_ARBLOST_bm 0x08
+#define TWI_MASTER_BUSERR_bm 0x04
+#define TWI_MASTER_BUSSTATE_gm 0x03
+#define TWI_MASTER_BUSSTATE_UNKNOWN_gc 0x00
+#define TWI_MASTER_BUSSTATE_IDLE_gc 0x01
+#define TWI_MASTER_BUSSTATE_OWNER_gc 0x02
+#define TWI_MASTER_BUSSTATE_BUSY_gc 0x03
+
+/* Real time counter */
+typedef struct RTC_struct{
+    volatile uint8_t CTRL, STATUS, INTCTRL, INTFLAGS, TEMP;
+    volatile uint16_t CNT, PER, COMP;
+} RTC_t;
+
+extern RTC_t RTC;
+
+/* Clock system */
+typedef struct CLK_struct{
+    volatile uint8_t CTRL, PSCTRL, LOCK, RTCCTRL;
+} CLK_t;
+
+extern CLK_t CLK;
+
+#endif
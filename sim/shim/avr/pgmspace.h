@@ -0,0 +1,14 @@
+/**
+ * Host stand-in for <avr/pgmspace.h> (see sim/README.md). On the host there
+ * is only one address space, so PROGMEM data is read directly.
+ */
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *) (p))
+#define pgm_read_word(p) (*(const uint16_t *) (p))
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * Host stand-in for <avr/sleep.h> (see sim/README.md). sleep_cpu() lets the
+ * simulated time run until the next interrupt.
+ */
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+
+void set_sleep_mode(int mode);
+void sleep_enable(void);
+void sleep_disable(void);
+void sleep_cpu(void);
+
+#endif
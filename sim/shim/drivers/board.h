@@ -0,0 +1,24 @@
+/**
+ * Host stand-in for the Pisibot board driver (see sim/README.md and
+ * sim_hw.c). millis() is the simulated time.
+ */
+#ifndef SIM_DRIVERS_BOARD_H
+#define SIM_DRIVERS_BOARD_H
+
+#include <stdint.h>
+#include <avr/io.h>
+
+enum sim_rgb_enum{
+    OFF = 0,
+    RED,
+    GREEN,
+    BLUE
+};
+
+void clock_init(void);
+void board_init(void);
+void rgb_set(uint8_t color);
+uint8_t sw1_read(void);
+uint32_t millis(void);
+
+#endif
@@ -0,0 +1,15 @@
+/**
+ * Host stand-in for the Pisibot radio driver (see sim/README.md and
+ * sim_hw.c).
+ */
+#ifndef SIM_DRIVERS_COM_H
+#define SIM_DRIVERS_COM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+void radio_init(uint32_t baud);
+void radio_puts(char *str);
+uint8_t radio_gets(char *str);
+
+#endif
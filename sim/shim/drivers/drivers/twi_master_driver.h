@@ -0,0 +1,50 @@
+/**
+ * Host stand-in for Atmel's TWI master driver (AVR1308, see sim/README.md
+ * and sim_hw.c). The same interrupt driven state machine on the simulated
+ * TWI registers (see sim_twi_step).
+ */
+#ifndef SIM_DRIVERS_TWI_MASTER_DRIVER_H
+#define SIM_DRIVERS_TWI_MASTER_DRIVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/io.h>
+
+#define TWI_BAUD(F_SYS, F_TWI) ((F_SYS / (2 * F_TWI)) - 5)
+
+#define TWIM_WRITE_BUFFER_SIZE 8
+#define TWIM_READ_BUFFER_SIZE 8
+
+#define TWIM_STATUS_READY 0
+#define TWIM_STATUS_BUSY 1
+
+typedef enum TWIM_RESULT_enum{
+    TWIM_RESULT_UNKNOWN = 0,
+    TWIM_RESULT_OK = 1,
+    TWIM_RESULT_BUFFER_OVERFLOW = 2,
+    TWIM_RESULT_ARBITRATION_LOST = 3,
+    TWIM_RESULT_BUS_ERROR = 4,
+    TWIM_RESULT_NACK_RECEIVED = 5,
+    TWIM_RESULT_FAIL = 6
+} TWIM_RESULT_t;
+
+typedef struct TWI_Master{
+    TWI_t *interface;
+    volatile uint8_t address;
+    volatile uint8_t writeData[TWIM_WRITE_BUFFER_SIZE];
+    volatile uint8_t readData[TWIM_READ_BUFFER_SIZE];
+    volatile uint8_t bytesToWrite;
+    volatile uint8_t bytesToRead;
+    volatile uint8_t bytesWritten;
+    volatile uint8_t bytesRead;
+    volatile uint8_t status;
+    volatile uint8_t result;
+} TWI_Master_t;
+
+void TWI_MasterInit(TWI_Master_t *twi, TWI_t *module, uint8_t intLevel,
+        uint8_t baudRateRegisterSetting);
+bool TWI_MasterWriteRead(TWI_Master_t *twi, uint8_t address,
+        uint8_t *writeData, uint8_t bytesToWrite, uint8_t bytesToRead);
+void TWI_MasterInterruptHandler(TWI_Master_t *twi);
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * Host stand-in for the Pisibot motor and encoder driver (see sim/README.md
+ * and sim_hw.c). The motors and encoders are those of the simulated robot
+ * (see sim_plant.c).
+ */
+#ifndef SIM_DRIVERS_MOTOR_H
+#define SIM_DRIVERS_MOTOR_H
+
+#include <stdint.h>
+
+void motor_init(void);
+void motor_set(int16_t pwr_left, int16_t pwr_right);
+void quadrature_init(void);
+int16_t get_left_enc(void);
+int16_t get_right_enc(void);
+void left_enc_reset(void);
+void right_enc_reset(void);
+
+#endif
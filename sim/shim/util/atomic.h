@@ -0,0 +1,13 @@
+/**
+ * Host stand-in for <util/atomic.h> (see sim/README.md). The simulated
+ * interrupts run between the firmware's function calls, never inside them,
+ * so an atomic block is just a block.
+ */
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+#define ATOMIC_BLOCK(type) for(int sim_atomic = 1; sim_atomic; sim_atomic = 0)
+
+#endif
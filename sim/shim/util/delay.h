@@ -0,0 +1,11 @@
+/**
+ * Host stand-in for <util/delay.h> (see sim/README.md). The delays advance
+ * the simulated time.
+ */
+#ifndef SIM_UTIL_DELAY_H
+#define SIM_UTIL_DELAY_H
+
+void _delay_ms(double ms);
+void _delay_us(double us);
+
+#endif
@@ -0,0 +1,453 @@
+/**
+ * Motion quality benchmark: runs a standard matrix of drive_mm, turn_deg and
+ * drive commands (see drive_control.c) against the simulated robot (see
+ * sim_plant.c), every scenario with several random robots, and prints one
+ * CSV line per scenario. The results can be kept and compared between the
+ * firmware versions (e.g. make bench, see CMakeLists.txt).
+ *
+ * Usage:
+ *      sim_bench [-n runs] [-s seed] [-b charge] [-N] [-l lag_ms] [-P]
+ *                [-S stop] [-o file]
+ *
+ * Options:
+ *      -n runs - random robots per scenario (default 10)
+ *      -s seed - random seed of the first robot (default 1), the scenarios
+ *                use the same robots
+ *      -b charge - battery state of charge 0...1 (default 1)
+ *      -N - nominal robot (no random gain and deadband mismatch)
+ *      -l lag_ms - every drive_mm and turn_deg step is late by up to lag_ms
+ *                  (random, like behind the parser and telemetry tasks on
+ *                  the robot, default 0)
+ *      -P - no interrupts: drive_mm and turn_deg stop the motors only in
+ *           the control step, not in the encoder compare interrupt (see
+ *           drive_target_arm in drive_control.c)
+ *      -S stop - how drive_mm and turn_deg stop: coast (default), brake or
+ *                reverse (see drive_stop in drive_control.c)
+ *      -o file - write the results into a file instead of stdout
+ *
+ * The scenarios:
+ *      drive - drive_mm for every distance in SIM_DISTANCES and every power
+ *              in SIM_POWERS
+ *      turn - turn_deg for every angle in SIM_ANGLES (both directions) and
+ *             every power
+ *      straight - drive(pwr, pwr) for SIM_STRAIGHT_TIME ms (step response
+ *                 and straight line drift) for every power
+ *
+ * The metrics are measured on the true pose of the robot (not the odometry):
+ *      time_ms - time until the command was done (drive, turn), the speed
+ *                rise time from 10% to 90% (straight)
+ *      overshoot - the furthest the robot got past the target including the
+ *                  coasting after the command (mm or deg), the speed over
+ *                  the final speed (straight, %)
+ *      error - the final distance or angle minus the target (mm or deg,
+ *              positive is too far), 0 for straight
+ *      drift - sideways distance at the end (drive, mm), how far the center
+ *              moved (turn, mm), sideways drift per driven meter (straight,
+ *              mm/m)
+ *      stop_ms - time from the target stop (see drive_target_arm) until the
+ *                wheels stand still (under SIM_STILL_SPEED), 0 for straight
+ *      ctrl_ns - host time of one control step (the update_pose and the
+ *                command function, see control_task in main.c)
+ * Every metric has the mean and the worst value (the biggest absolute value)
+ * over the runs. The runs that timed out are counted, but not included in the
+ * metrics.
+ */
+
+#define _GNU_SOURCE
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "batt_control.h"
+#include "drive_control.h"
+#include "sim_hw.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Control step period in ms (see TASK_CONTROL in main.c) */
+#define SIM_CONTROL_PERIOD 2
+
+/* A command that is not done in SIM_TIMEOUT ms has failed */
+#define SIM_TIMEOUT 20000
+
+/* Coasting time after the command is done in ms */
+#define SIM_SETTLE 500
+
+/* The straight scenario time and the time the final speed is taken from */
+#define SIM_STRAIGHT_TIME 2000
+#define SIM_FINAL_SPEED_TIME 500
+
+/* The wheels stand still under this speed (mm/s) */
+#define SIM_STILL_SPEED 5.0
+
+/* The scenario matrix */
+#define SIM_DISTANCES {100, 250, 500, 1000, 2000}
+#define SIM_ANGLES {15, 45, 90, 180, 360}
+#define SIM_POWERS {100, 200, 400, 600, DRIVEC_MAX_PWR}
+
+/* ENUMS --------------------------------------------------------------------*/
+enum sim_mode_enum{
+    SIM_DRIVE = 0,
+    SIM_TURN = 1,
+    SIM_STRAIGHT = 2
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/* The metrics of one run (see the file comment) */
+typedef struct sim_result_struct{
+    double time_ms;
+    double overshoot;
+    double error;
+    double drift;
+    double stop_ms;
+    double ctrl_ns;
+    double ctrl_ns_max;
+} sim_result_t;
+
+/* A metric over the runs */
+typedef struct sim_stat_struct{
+    double sum;
+    double worst;
+} sim_stat_t;
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void usage();
+uint8_t sim_bench_run(uint8_t mode, int32_t value, int16_t pwr,
+        sim_result_t *result);
+void sim_bench_scenario(FILE *out, uint8_t mode, int32_t value, int16_t pwr);
+void sim_stat_add(sim_stat_t *stat, double value);
+double sim_now_ns();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The odometry pose in drive_control.c (reset between the runs) */
+extern int32_t pose_x;
+extern int32_t pose_y;
+extern int16_t pose_heading;
+extern int8_t pose_half;
+
+/* The target stop in drive_control.c */
+extern volatile uint8_t drive_target;
+
+const char *mode_names[] = {"drive", "turn", "straight"};
+const char *stop_names[] = {"coast", "brake", "reverse"};
+
+uint32_t runs = 10;
+uint32_t seed = 1;
+double charge = 1.0;
+uint8_t spread = 1;
+uint8_t interrupts = 1;
+double lag_ms = 0.0;
+uint8_t stop = DRIVEC_STOP_COAST;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+void usage()
+{
+    fprintf(stderr, "usage: sim_bench [-n runs] [-s seed] [-b charge] [-N] "
+            "[-l lag_ms] [-P] [-S stop] [-o file]\n");
+    exit(2);
+}
+
+/* Host time in ns */
+double sim_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec*1e9 + now.tv_nsec;
+}
+
+/**
+ * Add a run's value to a metric.
+ *
+ * Parameters:
+ *      stat - sim_stat_t*, The metric
+ *      value - double, The run's value
+ */
+void sim_stat_add(sim_stat_t *stat, double value)
+{
+    stat->sum += value;
+    if(fabs(value) > fabs(stat->worst)) stat->worst = value;
+}
+
+/**
+ * Run one command on the current robot and measure it.
+ *
+ * Parameters:
+ *      mode - uint8_t, SIM_DRIVE, SIM_TURN or SIM_STRAIGHT
+ *      value - int32_t, distance in mm, angle in deg or time in ms
+ *      pwr - int16_t, motor power
+ *      result - sim_result_t*, The metrics are written here
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if the command was done before SIM_TIMEOUT
+ */
+uint8_t sim_bench_run(uint8_t mode, int32_t value, int16_t pwr,
+        sim_result_t *result)
+{
+    /* The target in the plant's units (the positive angles are clockwise) */
+    double target = (mode == SIM_TURN) ? -value*M_PI/180 : value;
+    double dir = (target < 0) ? -1.0 : 1.0;
+    double furthest = 0.0;
+
+    /* Straight: the speed samples for the rise time */
+    double speed[SIM_STRAIGHT_TIME/SIM_CONTROL_PERIOD];
+    uint32_t speed_count = 0;
+
+    double ctrl_ns = 0.0;
+    uint32_t steps = 0;
+    int32_t done_ms = -1;
+    uint32_t done_us = 0;
+
+    /* When the target stop happened and the wheels last moved */
+    int64_t hit_us = -1;
+    uint32_t moving_us = 0;
+
+    /* The control step lag (-l) */
+    uint32_t rng = sim_plant.rng;
+
+    memset(result, 0, sizeof(*result));
+
+    uint32_t t = 0;
+    for(; t < SIM_TIMEOUT + SIM_SETTLE; t += SIM_CONTROL_PERIOD){
+        if(t % BATTC_PERIOD == 0) batt_tick();
+
+        if(done_ms < 0){
+            uint8_t done = 0;
+            double start = sim_now_ns();
+
+            update_pose();
+            if(mode == SIM_DRIVE){
+                done = drive_mm((int16_t) value, pwr, stop);
+            }else if(mode == SIM_TURN){
+                done = turn_deg(value, pwr, stop);
+            }else if(t < (uint32_t) value){
+                drive(pwr, pwr);
+            }else{
+                drive(0, 0);
+                done = 1;
+            }
+
+            double ns = sim_now_ns() - start;
+            ctrl_ns += ns;
+            if(ns > result->ctrl_ns_max) result->ctrl_ns_max = ns;
+            steps++;
+
+            if(done){
+                done_ms = (int32_t) t;
+                done_us = sim_time_us();
+                motor_set(0, 0);
+            }else if(t >= SIM_TIMEOUT){
+                break;
+            }
+        }else if(t >= (uint32_t) done_ms + SIM_SETTLE){
+            break;
+        }
+
+        double lag_us = (mode == SIM_STRAIGHT) ? 0.0 :
+            (sim_rand(&rng) + 1.0)/2*lag_ms*1000;
+        sim_run(SIM_CONTROL_PERIOD*1000 + (uint32_t) lag_us);
+
+        if(mode != SIM_STRAIGHT && hit_us < 0 &&
+                drive_target >= DRIVEC_TARGET_HIT){
+            hit_us = sim_time_us();
+            moving_us = sim_time_us();
+        }
+        if(hit_us >= 0 &&
+                (fabs(sim_plant.wheel[SIM_LEFT].speed) >= SIM_STILL_SPEED ||
+                 fabs(sim_plant.wheel[SIM_RIGHT].speed) >= SIM_STILL_SPEED)){
+            moving_us = sim_time_us();
+        }
+
+        double progress = (mode == SIM_TURN) ? sim_plant.heading :
+            sim_plant.x;
+        if(dir*progress > furthest) furthest = dir*progress;
+
+        if(mode == SIM_STRAIGHT && done_ms < 0 &&
+                speed_count < SIM_STRAIGHT_TIME/SIM_CONTROL_PERIOD){
+            speed[speed_count++] = (sim_plant.wheel[SIM_LEFT].ground_speed +
+                    sim_plant.wheel[SIM_RIGHT].ground_speed) / 2;
+        }
+    }
+    motor_set(0, 0);
+
+    result->ctrl_ns = (steps > 0) ? ctrl_ns / steps : 0.0;
+    if(done_ms < 0) return 0;
+
+    double goal = dir*target;
+    if(mode == SIM_DRIVE){
+        result->time_ms = done_us/1000;
+        result->overshoot = (furthest > goal) ? furthest - goal : 0.0;
+        result->error = dir*sim_plant.x - goal;
+        result->drift = sim_plant.y;
+        result->stop_ms = (moving_us - hit_us)/1000.0;
+    }else if(mode == SIM_TURN){
+        double heading = dir*sim_plant.heading;
+        result->time_ms = done_us/1000;
+        result->overshoot = (furthest > goal) ? (furthest - goal)*180/M_PI :
+            0.0;
+        result->error = (heading - goal)*180/M_PI;
+        result->drift = hypot(sim_plant.x, sim_plant.y);
+        result->stop_ms = (moving_us - hit_us)/1000.0;
+    }else{
+        /* The final speed is the mean of the last samples */
+        uint32_t final_count = SIM_FINAL_SPEED_TIME/SIM_CONTROL_PERIOD;
+        double final = 0.0;
+        double peak = 0.0;
+        uint32_t i = 0;
+        for(; i < speed_count; i++){
+            if(i >= speed_count - final_count) final += speed[i];
+            if(speed[i] > peak) peak = speed[i];
+        }
+        final /= final_count;
+
+        /* Rise time from 10% to 90% of the final speed */
+        int32_t rise_start = -1;
+        int32_t rise_end = -1;
+        for(i = 0; i < speed_count && final > 0.0; i++){
+            if(rise_start < 0 && speed[i] >= 0.1*final) rise_start = i;
+            if(speed[i] >= 0.9*final){
+                rise_end = i;
+                break;
+            }
+        }
+        if(rise_start < 0 || rise_end < 0) return 0;
+
+        result->time_ms = (rise_end - rise_start)*SIM_CONTROL_PERIOD;
+        result->overshoot = (peak - final) / final * 100;
+        result->drift = (sim_plant.x > 0.0) ? sim_plant.y / sim_plant.x*1000 :
+            0.0;
+    }
+
+    return 1;
+}
+
+/**
+ * Run one scenario with all the robots and print its line.
+ *
+ * Parameters:
+ *      out - FILE*, Where the results go
+ *      mode - uint8_t, SIM_DRIVE, SIM_TURN or SIM_STRAIGHT
+ *      value - int32_t, distance in mm, angle in deg or time in ms
+ *      pwr - int16_t, motor power
+ */
+void sim_bench_scenario(FILE *out, uint8_t mode, int32_t value, int16_t pwr)
+{
+    sim_stat_t time_ms = {0}, overshoot = {0}, error = {0}, drift = {0};
+    sim_stat_t stop_ms = {0};
+    sim_stat_t ctrl_ns = {0}, ctrl_ns_max = {0};
+    uint32_t ok = 0;
+
+    uint32_t run = 0;
+    for(; run < runs; run++){
+        sim_hw_init(seed + run, spread);
+        sim_plant.param.charge = charge;
+
+        board_init();
+        drive_control_init();
+        batt_control_init();
+        if(interrupts) sei();
+        pose_x = 0;
+        pose_y = 0;
+        pose_heading = 0;
+        pose_half = 0;
+
+        sim_result_t result;
+        uint8_t done = sim_bench_run(mode, value, pwr, &result);
+
+        sim_stat_add(&ctrl_ns, result.ctrl_ns);
+        sim_stat_add(&ctrl_ns_max, result.ctrl_ns_max);
+        if(!done) continue;
+
+        ok++;
+        sim_stat_add(&time_ms, result.time_ms);
+        sim_stat_add(&overshoot, result.overshoot);
+        sim_stat_add(&error, result.error);
+        sim_stat_add(&drift, result.drift);
+        sim_stat_add(&stop_ms, result.stop_ms);
+    }
+
+    double n = (ok > 0) ? ok : 1;
+    fprintf(out, "%s,%d,%d,%u,%u,%.0f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,"
+            "%.0f,%.0f,%.0f,%.0f\n", mode_names[mode], value, pwr, runs,
+            runs - ok, time_ms.sum/n, time_ms.worst, overshoot.sum/n,
+            overshoot.worst, error.sum/n, error.worst, drift.sum/n,
+            drift.worst, ctrl_ns.sum/runs, ctrl_ns_max.worst, stop_ms.sum/n,
+            stop_ms.worst);
+    fflush(out);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *out = stdout;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:b:Nl:PS:o:")) != -1){
+        if(opt == 'n'){
+            runs = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 's'){
+            seed = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'b'){
+            charge = atof(optarg);
+        }else if(opt == 'N'){
+            spread = 0;
+        }else if(opt == 'l'){
+            lag_ms = atof(optarg);
+        }else if(opt == 'P'){
+            interrupts = 0;
+        }else if(opt == 'S'){
+            for(stop = 0; stop < 3; stop++){
+                if(strcmp(optarg, stop_names[stop]) == 0) break;
+            }
+            if(stop == 3) usage();
+        }else if(opt == 'o'){
+            out = fopen(optarg, "w");
+            if(out == NULL){
+                perror(optarg);
+                return 1;
+            }
+        }else{
+            usage();
+        }
+    }
+    if(optind != argc || runs == 0) usage();
+
+    const int16_t distances[] = SIM_DISTANCES;
+    const int16_t angles[] = SIM_ANGLES;
+    const int16_t powers[] = SIM_POWERS;
+    const uint8_t distance_count = sizeof(distances)/sizeof(distances[0]);
+    const uint8_t angle_count = sizeof(angles)/sizeof(angles[0]);
+    const uint8_t power_count = sizeof(powers)/sizeof(powers[0]);
+
+    fprintf(out, "scenario,value,pwr,runs,timeouts,time_ms_mean,"
+            "time_ms_worst,overshoot_mean,overshoot_worst,error_mean,"
+            "error_worst,drift_mean,drift_worst,ctrl_ns_mean,"
+            "ctrl_ns_worst,stop_ms_mean,stop_ms_worst\n");
+
+    clock_t start = clock();
+
+    uint8_t i, j;
+    for(j = 0; j < power_count; j++){
+        for(i = 0; i < distance_count; i++){
+            sim_bench_scenario(out, SIM_DRIVE, distances[i], powers[j]);
+        }
+    }
+    for(j = 0; j < power_count; j++){
+        for(i = 0; i < angle_count; i++){
+            sim_bench_scenario(out, SIM_TURN, angles[i], powers[j]);
+            sim_bench_scenario(out, SIM_TURN, -angles[i], powers[j]);
+        }
+    }
+    for(j = 0; j < power_count; j++){
+        sim_bench_scenario(out, SIM_STRAIGHT, SIM_STRAIGHT_TIME, powers[j]);
+    }
+
+    fprintf(stderr, "%.1f s\n", (double) (clock() - start) / CLOCKS_PER_SEC);
+
+    if(out != stdout) fclose(out);
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+/**
+ * Closed loop drive simulation: runs the firmware's drive_mm, turn_deg or
+ * drive (see drive_control.c) against the simulated robot (see sim_plant.c)
+ * many times with different random robots and prints one CSV line per run.
+ *
+ * Usage:
+ *      sim_drive [options] drive <distance_mm> <pwr>
+ *      sim_drive [options] turn <deg> <pwr>
+ *      sim_drive [options] straight <time_ms> <pwr>
+ *
+ * Options:
+ *      -n runs - number of runs (default 1)
+ *      -s seed - random seed of the first run (default 1), every next run
+ *                uses the next seed
+ *      -b charge - battery state of charge 0...1 (default 1)
+ *      -N - nominal robot (no random gain and deadband mismatch)
+ *      -S stop - how drive and turn stop: coast (default), brake or reverse
+ *                (see drive_stop in drive_control.c)
+ *      -v - print every control step of every run to stderr
+ *
+ * The control step runs every SIM_CONTROL_PERIOD ms like the control task in
+ * main.c, the battery voltage is sampled every BATTC_PERIOD (see
+ * batt_control.c). After the command is done the robot is let to coast to a stop
+ * before the results are taken.
+ *
+ * The CSV columns: run, seed, time to done (ms, -1 on timeout), the
+ * firmware's view (encoder distances and the odometry pose - see
+ * update_pose) and the true pose of the robot, battery voltage at the end.
+ */
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "batt_control.h"
+#include "drive_control.h"
+#include "sim_hw.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Control step period in ms (see TASK_CONTROL in main.c) */
+#define SIM_CONTROL_PERIOD 2
+
+/* A command that is not done in SIM_TIMEOUT ms has failed */
+#define SIM_TIMEOUT 20000
+
+/* Coasting time after the command is done in ms */
+#define SIM_SETTLE 500
+
+/* ENUMS --------------------------------------------------------------------*/
+enum sim_mode_enum{
+    SIM_DRIVE = 0,
+    SIM_TURN = 1,
+    SIM_STRAIGHT = 2
+};
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+int32_t sim_drive_run(uint8_t mode, int32_t value, int16_t pwr, uint8_t stop,
+        uint8_t verbose);
+void usage();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The odometry pose in drive_control.c (reset between the runs) */
+extern int32_t pose_x;
+extern int32_t pose_y;
+extern int16_t pose_heading;
+extern int8_t pose_half;
+
+/* The stop modes (see drivec_stop_enum) */
+const char *stop_names[] = {"coast", "brake", "reverse"};
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+void usage()
+{
+    fprintf(stderr, "usage: sim_drive [-n runs] [-s seed] [-b charge] [-N] "
+            "[-S stop] [-v] drive|turn|straight <value> <pwr>\n");
+    exit(2);
+}
+
+/**
+ * Run one command to the end (or to SIM_TIMEOUT).
+ *
+ * Parameters:
+ *      mode - uint8_t, SIM_DRIVE, SIM_TURN or SIM_STRAIGHT
+ *      value - int32_t, distance in mm, angle in deg or time in ms
+ *      pwr - int16_t, motor power
+ *      stop - uint8_t, how drive_mm and turn_deg stop (see drivec_stop_enum)
+ *      verbose - uint8_t, 1 to print every control step to stderr
+ *
+ * Returns: int32_t, time in ms until the command was done, -1 on timeout
+ */
+int32_t sim_drive_run(uint8_t mode, int32_t value, int16_t pwr, uint8_t stop,
+        uint8_t verbose)
+{
+    int32_t done_ms = -1;
+    uint32_t t = 0;
+
+    for(; t < SIM_TIMEOUT; t += SIM_CONTROL_PERIOD){
+        if(t % BATTC_PERIOD == 0) batt_tick();
+        update_pose();
+
+        uint8_t done = 0;
+        if(mode == SIM_DRIVE){
+            done = drive_mm((int16_t) value, pwr, stop);
+        }else if(mode == SIM_TURN){
+            done = turn_deg(value, pwr, stop);
+        }else if(t < (uint32_t) value){
+            drive(pwr, pwr);
+        }else{
+            drive(0, 0);
+            done = 1;
+        }
+
+        if(verbose){
+            fprintf(stderr, "%u,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f\n", t,
+                    sim_plant.wheel[SIM_LEFT].pwr,
+                    sim_plant.wheel[SIM_RIGHT].pwr, get_left_enc(),
+                    get_right_enc(), error, sim_plant.x, sim_plant.y,
+                    sim_plant.heading*180/M_PI);
+        }
+
+        if(done){
+            done_ms = (int32_t) t;
+            break;
+        }
+
+        sim_run(SIM_CONTROL_PERIOD*1000);
+    }
+
+    motor_set(0, 0);
+    sim_run(SIM_SETTLE*1000);
+    update_pose();
+
+    return done_ms;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t runs = 1;
+    uint32_t seed = 1;
+    double charge = 1.0;
+    uint8_t spread = 1;
+    uint8_t stop = DRIVEC_STOP_COAST;
+    uint8_t verbose = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:b:NS:v")) != -1){
+        if(opt == 'n'){
+            runs = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 's'){
+            seed = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'b'){
+            charge = atof(optarg);
+        }else if(opt == 'N'){
+            spread = 0;
+        }else if(opt == 'S'){
+            for(stop = 0; stop < 3; stop++){
+                if(strcmp(optarg, stop_names[stop]) == 0) break;
+            }
+            if(stop == 3) usage();
+        }else if(opt == 'v'){
+            verbose = 1;
+        }else{
+            usage();
+        }
+    }
+
+    if(argc - optind != 3) usage();
+
+    uint8_t mode;
+    if(strcmp(argv[optind], "drive") == 0){
+        mode = SIM_DRIVE;
+    }else if(strcmp(argv[optind], "turn") == 0){
+        mode = SIM_TURN;
+    }else if(strcmp(argv[optind], "straight") == 0){
+        mode = SIM_STRAIGHT;
+    }else{
+        usage();
+    }
+    int32_t value = atol(argv[optind+1]);
+    int16_t pwr = (int16_t) atoi(argv[optind+2]);
+
+    printf("run,seed,done_ms,left_mm,right_mm,pose_x_mm,pose_y_mm,"
+            "pose_heading_deg,x_mm,y_mm,heading_deg,v_batt\n");
+
+    clock_t start = clock();
+    double sim_time = 0.0;
+
+    uint32_t run = 0;
+    for(; run < runs; run++){
+        sim_hw_init(seed + run, spread);
+        sim_plant.param.charge = charge;
+
+        board_init();
+        drive_control_init();
+        batt_control_init();
+        pose_x = 0;
+        pose_y = 0;
+        pose_heading = 0;
+        pose_half = 0;
+
+        int32_t done_ms = sim_drive_run(mode, value, pwr, stop, verbose);
+        sim_time += sim_time_us() / 1e6;
+
+        double heading = remainder(sim_plant.heading*180/M_PI, 360.0);
+        printf("%u,%u,%d,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.2f\n", run,
+                seed + run, done_ms, get_left_distance_mm(),
+                get_right_distance_mm(), get_pose_x_mm(), get_pose_y_mm(),
+                get_pose_heading_deg(), sim_plant.x, sim_plant.y, heading,
+                sim_plant.v_batt);
+    }
+
+    double cpu_time = (double) (clock() - start) / CLOCKS_PER_SEC;
+    fprintf(stderr, "%u runs, %.1f s simulated in %.2f s (%.0fx real "
+            "time)\n", runs, sim_time, cpu_time,
+            sim_time / (cpu_time > 0 ? cpu_time : 1e-6));
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * Included before every firmware source in the simulator build (see
+ * CMakeLists.txt).
+ *
+ * The firmware's main() is renamed to fw_main(), so a simulator can start it
+ * from its own main() (see sim_swarm.c), and the robot ID is a variable, so
+ * every simulated robot can have its own ID.
+ */
+#ifndef SIM_FW_H
+#define SIM_FW_H
+
+#include <stdint.h>
+
+#define main fw_main
+#define ROBOT_ID sim_robot_id
+
+extern uint8_t sim_robot_id;
+
+#endif
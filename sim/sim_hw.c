@@ -0,0 +1,1019 @@
+/**
+ * Simulated Pisibot hardware: the driver functions (see the headers in
+ * sim/shim/drivers) and the peripheral registers (see sim/shim/avr/io.h) the
+ * firmware uses, on top of the plant model (see sim_plant.c).
+ *
+ * Time only passes in sim_run() (and in the delays and sleep_cpu, which call
+ * it). The interrupts the firmware has enabled are run from sim_run() at the
+ * right simulated time, between the firmware's function calls:
+ *  * TCE0 overflow - the kill switch (see killsw_control.c)
+ *  * TCE0 compare A - the sleep wake-up alarm (see timer_control.c)
+ *  * USARTE0 data register empty - radio transmit (see radio_control.c),
+ *    one byte per byte time at the baud rate given to radio_init
+ *  * USARTE0 receive complete - radio receive (see radio_control.c), right
+ *    when sim_radio_rx is called
+ *  * TCC0 and TCD0 compare A - the target stop (see drive_control.c), at the
+ *    end of the plant step in which the encoder passed the compare value
+ *  * ADCA channel 0 - the battery voltage (see batt_control.c, board_init
+ *    sets the ADC up the way drivers/adc.c does), converted
+ *    at the end of the plant step in which the conversion was started (no
+ *    interrupt)
+ *  * TWIC master - the gyro transfers (see gyro_control.c and the TWI
+ *    master driver below, a port of Atmel's AVR1308 one), one for every
+ *    address or data byte at the TWI clock the BAUD register gives
+ *
+ * TCC0 and TCD0 are the quadrature decoders (see DRIVEC_QDEC_LEFT in
+ * drive_control.h): their CNT is what get_left_enc and get_right_enc read.
+ *
+ * The radio bytes go out through sim_radio_tx_hook (stdout by default) and
+ * come in with sim_radio_rx, both through the robot's XBee (see
+ * sim_xbee_tx): a byte at a different baud rate than the XBee's is garbled
+ * (SIM_XBEE_GARBLED) and "+++" between two guard times puts the XBee into
+ * the command mode (ATBD and ATCN, see baud_control.c). Without the receive
+ * interrupt (radio_control.c not linked or not initialized yet), like the
+ * Pisibot driver, radio_gets returns the received string once the end letter
+ * (SIM_RADIO_END) has arrived.
+ *
+ * The gyro on TWIC (see sim_twi_step) has the registers of an L3GD20
+ * (WHO_AM_I, CTRL_REG1...5 and the outputs) and measures the plant's
+ * turning rate exactly (no noise or offset) when it is powered up.
+ *
+ * The interrupt handlers are weak references, so a simulation links only
+ * the firmware modules it needs.
+ */
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include "drivers/board.h"
+#include "drivers/com.h"
+#include "drivers/motor.h"
+#include "drivers/drivers/twi_master_driver.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "sim_hw.h"
+#include "mem_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Timer ticks per plant step (the timers run at F_CPU/8) */
+#define SIM_TICKS_PER_STEP (SIM_STEP_US*(F_CPU/8/1000000))
+
+/* Radio receive buffer length (longer strings are dropped) */
+#define SIM_RADIO_RX_LEN 512
+
+/**
+ * The XBee: the baud rate it starts with (set with XCTU, see RADIOC_BAUD in
+ * radio_control.h), its guard time (GT, us), the longest command line and
+ * what a byte at the wrong baud rate turns into.
+ */
+#define SIM_XBEE_BAUD 57600
+#define SIM_XBEE_GT_US 1000000
+#define SIM_XBEE_LINE_LEN 32
+#define SIM_XBEE_GARBLED 0xFF
+
+/**
+ * The TWI: what ADDR holds while the firmware has not written it (no
+ * firmware writes the reserved address 0x7F) and the bit times of a start
+ * and an address or data byte (with the acknowledge).
+ */
+#define SIM_TWI_NO_ADDR 0xFF
+#define SIM_TWI_START_BITS 1
+#define SIM_TWI_BYTE_BITS 9
+
+/**
+ * The gyro: its bus address, register count, WHO_AM_I, the first control
+ * and output register, CTRL_REG1 power bit and CTRL_REG4 full scale bits.
+ */
+#define SIM_GYRO_ADDR 0x6B
+#define SIM_GYRO_REGS 0x40
+#define SIM_GYRO_WHO_AM_I 0x0F
+#define SIM_GYRO_ID 0xD4
+#define SIM_GYRO_CTRL1 0x20
+#define SIM_GYRO_CTRL4 0x23
+#define SIM_GYRO_OUT 0x28
+#define SIM_GYRO_POWER_bm 0x08
+#define SIM_GYRO_FS_gm 0x30
+#define SIM_GYRO_AUTOINC 0x80
+
+/* The TWI bus operation in progress (see sim_twi_step) */
+enum sim_twi_op_enum{
+    SIM_TWI_IDLE = 0,
+    SIM_TWI_ADDR = 1,
+    SIM_TWI_WRITE = 2,
+    SIM_TWI_READ = 3,
+    SIM_TWI_WAIT = 4
+};
+
+/**
+ * The battery voltage input: the board's divider, the ADC's reference
+ * (VCC/1.6) and its result at 0 V (see BATTC_ADC in batt_control.h).
+ */
+#define SIM_BATT_DIVIDER 3.0
+#define SIM_ADC_REF (3.3/1.6)
+#define SIM_ADC_OFFSET 205
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void sim_timer_step(TC0_t *tc, void (*ovf_vect)(void),
+        void (*cca_vect)(void));
+void sim_usart_step(USART_t *usart, void (*dre_vect)(void));
+void sim_qdec_step(TC0_t *tc, uint16_t cnt, void (*cca_vect)(void));
+uint8_t sim_int_enabled(uint8_t level);
+void sim_radio_tx_stdout(uint32_t time_us, uint8_t byte);
+void sim_xbee_tx(uint32_t time_us, uint8_t byte);
+void sim_xbee_command(const char *line);
+void sim_xbee_reply(const char *str);
+void sim_adc_step(ADC_t *adc);
+void sim_twi_step(TWI_t *twi, void (*twim_vect)(void));
+void sim_twi_next(TWI_t *twi, double start_us);
+void sim_twi_end(TWI_t *twi);
+uint8_t sim_gyro_byte(uint8_t write, uint8_t byte);
+void sim_gyro_sample();
+
+/* The interrupt handlers (NULL if the module is not linked) */
+void TCE0_OVF_vect(void) __attribute__((weak));
+void TCE0_CCA_vect(void) __attribute__((weak));
+void TCC0_CCA_vect(void) __attribute__((weak));
+void TCD0_CCA_vect(void) __attribute__((weak));
+void USARTE0_DRE_vect(void) __attribute__((weak));
+void USARTE0_RXC_vect(void) __attribute__((weak));
+void TWIC_TWIM_vect(void) __attribute__((weak));
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The peripheral registers */
+TC0_t TCC0, TCD0, TCE0;
+TC1_t TCC1, TCD1;
+PMIC_t PMIC;
+USART_t USARTC0, USARTC1, USARTD0, USARTD1, USARTE0;
+ADC_t ADCA;
+TWI_t TWIC, TWIE;
+RTC_t RTC;
+CLK_t CLK;
+
+/* The simulated robot */
+sim_plant_t sim_plant;
+
+/* The robot's ID (see sim_fw.h) */
+uint8_t sim_robot_id = 0x45;
+
+/* Global interrupt enable (see sei and cli) */
+uint8_t sim_sei = 0;
+
+/* Set when an interrupt has run (wakes sleep_cpu up) */
+uint8_t sim_woken = 0;
+
+/* Called after every plant step (e.g. for syncing with other processes) */
+void (*sim_step_hook)(void) = NULL;
+
+/* Radio */
+void (*sim_radio_tx_hook)(uint32_t time_us, uint8_t byte) =
+    sim_radio_tx_stdout;
+uint32_t sim_baud = 57600;
+double sim_tx_free_us = 0.0;
+char sim_rx_buf[SIM_RADIO_RX_LEN];
+uint16_t sim_rx_len = 0;
+char sim_rx_ready[SIM_RADIO_RX_LEN];
+uint8_t sim_rx_done = 0;
+uint16_t sim_rx_overruns = 0;
+
+/* The XBee: its baud rate (and the one ATBD has set), the last byte from the
+ * firmware, the "+" count and the command mode */
+uint32_t sim_xbee_baud = SIM_XBEE_BAUD;
+uint32_t sim_xbee_new_baud = SIM_XBEE_BAUD;
+double sim_xbee_last_us = -SIM_XBEE_GT_US;
+uint8_t sim_xbee_plus = 0;
+uint8_t sim_xbee_cmd_mode = 0;
+char sim_xbee_line[SIM_XBEE_LINE_LEN];
+uint8_t sim_xbee_line_len = 0;
+
+/* The TWI: the operation in progress, when it ends, the byte written and the
+ * slave's acknowledge */
+uint8_t sim_twi_op = SIM_TWI_IDLE;
+double sim_twi_done_us = 0.0;
+uint8_t sim_twi_byte = 0;
+uint8_t sim_twi_ack = 0;
+
+/* The gyro: the registers, the register pointer (and whether it steps) and
+ * whether the next written byte is the register address */
+uint8_t sim_gyro_regs[SIM_GYRO_REGS];
+uint8_t sim_gyro_ptr = 0;
+uint8_t sim_gyro_autoinc = 0;
+uint8_t sim_gyro_first = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the simulated hardware: a new robot standing at the origin with
+ * all the registers cleared.
+ *
+ * Parameters:
+ *      seed - uint32_t, Random seed for the plant (see sim_plant_init)
+ *      spread - uint8_t, 1 to vary the plant parameters randomly
+ */
+void sim_hw_init(uint32_t seed, uint8_t spread)
+{
+    sim_plant_init(&sim_plant, seed, spread);
+
+    TC0_t tc = {0};
+    TCC0 = tc;
+    TCD0 = tc;
+    TCE0 = tc;
+    TCC1 = tc;
+    TCD1 = tc;
+
+    PMIC_t pmic = {0};
+    PMIC = pmic;
+
+    USART_t usart = {0};
+    USARTC0 = usart;
+    USARTC1 = usart;
+    USARTD0 = usart;
+    USARTD1 = usart;
+    USARTE0 = usart;
+
+    ADC_t adc = {0};
+    ADCA = adc;
+
+    TWI_t twi = {0};
+    TWIC = twi;
+    TWIE = twi;
+    TWIC.MASTER.ADDR = SIM_TWI_NO_ADDR;
+
+    sim_sei = 0;
+    sim_tx_free_us = 0.0;
+    sim_rx_len = 0;
+    sim_rx_done = 0;
+    sim_rx_overruns = 0;
+
+    sim_xbee_baud = SIM_XBEE_BAUD;
+    sim_xbee_new_baud = SIM_XBEE_BAUD;
+    sim_xbee_last_us = -SIM_XBEE_GT_US;
+    sim_xbee_plus = 0;
+    sim_xbee_cmd_mode = 0;
+    sim_xbee_line_len = 0;
+
+    sim_twi_op = SIM_TWI_IDLE;
+    memset(sim_gyro_regs, 0, sizeof(sim_gyro_regs));
+    sim_gyro_regs[SIM_GYRO_WHO_AM_I] = SIM_GYRO_ID;
+    sim_gyro_regs[SIM_GYRO_CTRL1] = 0x07;
+    sim_gyro_ptr = 0;
+    sim_gyro_autoinc = 0;
+}
+
+/**
+ * Get the simulated time.
+ *
+ * Returns: uint32_t, time in us since sim_hw_init
+ */
+uint32_t sim_time_us()
+{
+    return (uint32_t) sim_plant.time_us;
+}
+
+/**
+ * Let the simulated time pass: run the plant and the enabled interrupts.
+ *
+ * Parameters: time_us - uint32_t, Time in us (rounded up to SIM_STEP_US)
+ */
+void sim_run(uint32_t time_us)
+{
+    do{
+        sim_plant_step(&sim_plant, SIM_STEP_US);
+        sim_qdec_step(&TCC0, (uint16_t) get_left_enc(), TCC0_CCA_vect);
+        sim_qdec_step(&TCD0, (uint16_t) get_right_enc(), TCD0_CCA_vect);
+        sim_timer_step(&TCE0, TCE0_OVF_vect, TCE0_CCA_vect);
+        sim_usart_step(&USARTE0, USARTE0_DRE_vect);
+        sim_adc_step(&ADCA);
+        sim_twi_step(&TWIC, TWIC_TWIM_vect);
+
+        if(sim_step_hook != NULL) sim_step_hook();
+
+        time_us = (time_us > SIM_STEP_US) ? time_us - SIM_STEP_US : 0;
+    }while(time_us > 0);
+}
+
+/**
+ * Check if an interrupt level is enabled (globally and in the PMIC).
+ *
+ * Parameters: level - uint8_t, Interrupt level (1 low, 2 medium, 3 high)
+ *
+ * Returns: 0 or 1 (uint8_t)
+ */
+uint8_t sim_int_enabled(uint8_t level)
+{
+    if(!sim_sei || level == 0) return 0;
+
+    return (PMIC.CTRL & (1 << (level-1))) ? 1 : 0;
+}
+
+/**
+ * Advance a timer by one plant step and run its interrupts.
+ *
+ * Parameters:
+ *      tc - TC0_t*, The timer
+ *      ovf_vect - overflow interrupt handler (or NULL)
+ *      cca_vect - compare A interrupt handler (or NULL)
+ */
+void sim_timer_step(TC0_t *tc, void (*ovf_vect)(void),
+        void (*cca_vect)(void))
+{
+    if((tc->CTRLA & TC_CLKSEL_gm) != TC_CLKSEL_DIV8_gc) return;
+
+    uint16_t cnt = tc->CNT;
+    tc->CNT = (uint16_t) (cnt + SIM_TICKS_PER_STEP);
+
+    /* Did the counter pass CCA? */
+    if((uint16_t) (tc->CCA - cnt - 1) < SIM_TICKS_PER_STEP){
+        tc->INTFLAGS |= TC0_CCAIF_bm;
+    }
+    if(tc->CNT < cnt){
+        tc->INTFLAGS |= TC0_OVFIF_bm;
+    }
+
+    if((tc->INTFLAGS & TC0_OVFIF_bm) && ovf_vect != NULL &&
+            sim_int_enabled(tc->INTCTRLA & TC_OVFINTLVL_gm)){
+        tc->INTFLAGS &= ~TC0_OVFIF_bm;
+        ovf_vect();
+        sim_woken = 1;
+    }
+    if((tc->INTFLAGS & TC0_CCAIF_bm) && cca_vect != NULL &&
+            sim_int_enabled(tc->INTCTRLB & TC_CCAINTLVL_gm)){
+        tc->INTFLAGS &= ~TC0_CCAIF_bm;
+        cca_vect();
+        sim_woken = 1;
+    }
+}
+
+/**
+ * Move a quadrature decoder's counter to the encoder and run its compare
+ * interrupt if the counter passed CCA (in either direction).
+ *
+ * Parameters:
+ *      tc - TC0_t*, The quadrature decoder's timer
+ *      cnt - uint16_t, The encoder count
+ *      cca_vect - compare A interrupt handler (or NULL)
+ */
+void sim_qdec_step(TC0_t *tc, uint16_t cnt, void (*cca_vect)(void))
+{
+    uint16_t last = tc->CNT;
+    int16_t moved = (int16_t) (cnt - last);
+    tc->CNT = cnt;
+
+    /* Only a pass in this step counts - the firmware clears the flag by
+     * writing 1 to it, which sets it in the plain memory registers */
+    if(!(moved > 0 && (uint16_t) (tc->CCA - last - 1) < (uint16_t) moved) &&
+            !(moved < 0 && (uint16_t) (last - tc->CCA - 1) <
+              (uint16_t) -moved)){
+        return;
+    }
+
+    tc->INTFLAGS |= TC0_CCAIF_bm;
+    if(cca_vect != NULL &&
+            sim_int_enabled(tc->INTCTRLB & TC0_CCAINTLVL_gm)){
+        tc->INTFLAGS &= ~TC0_CCAIF_bm;
+        cca_vect();
+        sim_woken = 1;
+    }
+}
+
+/**
+ * Run the data register empty interrupt of a USART for every byte time that
+ * has passed. A byte is sent when the interrupt writes DATA (and leaves the
+ * interrupt enabled).
+ *
+ * Parameters:
+ *      usart - USART_t*, The USART
+ *      dre_vect - data register empty interrupt handler (or NULL)
+ */
+void sim_usart_step(USART_t *usart, void (*dre_vect)(void))
+{
+    double now = (double) sim_plant.time_us;
+    double byte_us = 10e6 / sim_baud;
+
+    /* An idle transmitter can start right away */
+    if(sim_tx_free_us < now - SIM_STEP_US) sim_tx_free_us = now - SIM_STEP_US;
+
+    while(dre_vect != NULL && sim_tx_free_us <= now &&
+            sim_int_enabled(usart->CTRLA & USART_DREINTLVL_gm)){
+        dre_vect();
+        sim_woken = 1;
+
+        if(!(usart->CTRLA & USART_DREINTLVL_gm)) break;
+
+        sim_xbee_tx((uint32_t) sim_tx_free_us, usart->DATA);
+        sim_tx_free_us += byte_us;
+    }
+}
+
+/**
+ * Convert the battery voltage if the firmware has started a conversion on
+ * channel 0 (12 bit, unsigned mode - see SIM_ADC_OFFSET).
+ *
+ * Parameters: adc - ADC_t*, The ADC
+ */
+void sim_adc_step(ADC_t *adc)
+{
+    if(!(adc->CTRLA & ADC_ENABLE_bm) || !(adc->CH0.CTRL & ADC_CH_START_bm)){
+        return;
+    }
+
+    double res = SIM_ADC_OFFSET +
+        sim_plant.v_batt/SIM_BATT_DIVIDER/SIM_ADC_REF*4096;
+    adc->CH0.RES = (uint16_t) (res > 4095 ? 4095 : res);
+    adc->CH0.CTRL &= ~ADC_CH_START_bm;
+    adc->CH0.INTFLAGS |= ADC_CH_CHIF_bm;
+}
+
+/**
+ * Run the TWI master's bus operations that have ended by now: the master
+ * interrupt for each, then the next operation the firmware asked for in it.
+ * The bus holds (the clock is stretched) while the interrupt cannot run.
+ *
+ * The registers are plain memory, so the firmware's action is found from
+ * what changed: ADDR (set to SIM_TWI_NO_ADDR after it is taken) starts an
+ * address, a CTRLC command receives the next byte or stops, otherwise the
+ * interrupt has written DATA.
+ *
+ * Parameters:
+ *      twi - TWI_t*, The TWI (the gyro is the only slave)
+ *      twim_vect - master interrupt handler (or NULL)
+ */
+void sim_twi_step(TWI_t *twi, void (*twim_vect)(void))
+{
+    double now = (double) sim_plant.time_us;
+
+    if(!(twi->MASTER.CTRLA & TWI_MASTER_ENABLE_bm)){
+        sim_twi_op = SIM_TWI_IDLE;
+        return;
+    }
+
+    /* A start from the main loop */
+    if(sim_twi_op == SIM_TWI_IDLE){
+        if(twi->MASTER.ADDR == SIM_TWI_NO_ADDR) return;
+        sim_twi_next(twi, now - SIM_STEP_US);
+    }
+
+    while(sim_twi_op != SIM_TWI_IDLE){
+        if(sim_twi_op != SIM_TWI_WAIT){
+            if(sim_twi_done_us > now) return;
+            sim_twi_end(twi);
+        }
+
+        if(twim_vect == NULL ||
+                !sim_int_enabled((twi->MASTER.CTRLA &
+                        TWI_MASTER_INTLVL_gm) >> 6)){
+            return;
+        }
+
+        twi->MASTER.CTRLC &= ~TWI_MASTER_CMD_gm;
+        twim_vect();
+        sim_woken = 1;
+
+        /* From the end of the operation, unless the interrupt was late */
+        sim_twi_next(twi, sim_twi_done_us > now - SIM_STEP_US ?
+                sim_twi_done_us : now);
+    }
+}
+
+/**
+ * End the bus operation in progress: the byte to or from the gyro and the
+ * interrupt flag. The bus waits for the interrupt (SIM_TWI_WAIT).
+ *
+ * Parameters: twi - TWI_t*, The TWI
+ */
+void sim_twi_end(TWI_t *twi)
+{
+    uint8_t flag = TWI_MASTER_WIF_bm;
+
+    if(sim_twi_op == SIM_TWI_ADDR){
+        uint8_t addr = sim_twi_byte;
+        sim_twi_ack = (addr >> 1) == SIM_GYRO_ADDR;
+        sim_gyro_first = 1;
+
+        /* A read address is followed by the first byte */
+        if(sim_twi_ack && (addr & 0x01)){
+            twi->MASTER.DATA = sim_gyro_byte(0, 0);
+            flag = TWI_MASTER_RIF_bm;
+        }
+    }else if(sim_twi_op == SIM_TWI_WRITE){
+        sim_twi_ack = sim_gyro_byte(1, sim_twi_byte);
+    }else{
+        twi->MASTER.DATA = sim_gyro_byte(0, 0);
+        flag = TWI_MASTER_RIF_bm;
+    }
+
+    twi->MASTER.STATUS = flag | TWI_MASTER_BUSSTATE_OWNER_gc |
+        (sim_twi_ack ? 0 : TWI_MASTER_RXACK_bm);
+    sim_twi_op = SIM_TWI_WAIT;
+}
+
+/**
+ * Start the bus operation the firmware has asked for (see sim_twi_step).
+ *
+ * Parameters:
+ *      twi - TWI_t*, The TWI
+ *      start_us - double, When the operation starts
+ */
+void sim_twi_next(TWI_t *twi, double start_us)
+{
+    double bit_us = 1e6 / (F_CPU / (2.0*(twi->MASTER.BAUD + 5)));
+    uint8_t cmd = twi->MASTER.CTRLC & TWI_MASTER_CMD_gm;
+
+    twi->MASTER.STATUS = TWI_MASTER_BUSSTATE_OWNER_gc;
+
+    if(twi->MASTER.ADDR != SIM_TWI_NO_ADDR){
+        sim_twi_op = SIM_TWI_ADDR;
+        sim_twi_byte = twi->MASTER.ADDR;
+        twi->MASTER.ADDR = SIM_TWI_NO_ADDR;
+        sim_twi_done_us = start_us +
+            (SIM_TWI_START_BITS + SIM_TWI_BYTE_BITS)*bit_us;
+
+        /* The first byte of a read comes with the address */
+        if(sim_twi_byte & 0x01) sim_twi_done_us += SIM_TWI_BYTE_BITS*bit_us;
+    }else if(cmd == TWI_MASTER_CMD_STOP_gc){
+        sim_twi_op = SIM_TWI_IDLE;
+        twi->MASTER.STATUS = TWI_MASTER_BUSSTATE_IDLE_gc;
+    }else if(cmd == TWI_MASTER_CMD_RECVTRANS_gc){
+        sim_twi_op = SIM_TWI_READ;
+        sim_twi_done_us = start_us + SIM_TWI_BYTE_BITS*bit_us;
+    }else{
+        sim_twi_op = SIM_TWI_WRITE;
+        sim_twi_byte = twi->MASTER.DATA;
+        sim_twi_done_us = start_us + SIM_TWI_BYTE_BITS*bit_us;
+    }
+}
+
+/**
+ * A data byte to or from the gyro. The first byte written after the address
+ * is the register address (its MSB makes the pointer step after every
+ * byte).
+ *
+ * Parameters:
+ *      write - uint8_t, 1 for a byte from the master
+ *      byte - uint8_t, The byte from the master
+ *
+ * Returns: uint8_t, the byte to the master (a write: 1 if acknowledged)
+ */
+uint8_t sim_gyro_byte(uint8_t write, uint8_t byte)
+{
+    if(write && sim_gyro_first){
+        sim_gyro_first = 0;
+        sim_gyro_ptr = byte & (SIM_GYRO_REGS-1);
+        sim_gyro_autoinc = (byte & SIM_GYRO_AUTOINC) ? 1 : 0;
+        return 1;
+    }
+
+    uint8_t reg = sim_gyro_ptr;
+    if(sim_gyro_autoinc) sim_gyro_ptr = (sim_gyro_ptr + 1) & (SIM_GYRO_REGS-1);
+
+    if(write){
+        if(reg >= SIM_GYRO_CTRL1 && reg <= SIM_GYRO_CTRL1+4){
+            sim_gyro_regs[reg] = byte;
+        }
+        return 1;
+    }
+
+    if(reg == SIM_GYRO_OUT) sim_gyro_sample();
+    return sim_gyro_regs[reg];
+}
+
+/* Latch the plant's turning rate into the gyro's output registers */
+void sim_gyro_sample()
+{
+    static const double dps_per_digit[4] = {8.75e-3, 17.5e-3, 70e-3, 70e-3};
+    int16_t rate = 0;
+
+    if(sim_gyro_regs[SIM_GYRO_CTRL1] & SIM_GYRO_POWER_bm){
+        uint8_t fs = (sim_gyro_regs[SIM_GYRO_CTRL4] & SIM_GYRO_FS_gm) >> 4;
+        double digits = sim_plant.yaw_rate*180.0/M_PI / dps_per_digit[fs];
+
+        if(digits > INT16_MAX) digits = INT16_MAX;
+        if(digits < INT16_MIN) digits = INT16_MIN;
+        rate = (int16_t) lround(digits);
+    }
+
+    /* X and Y stay 0, Z is the turning rate (little endian) */
+    memset(&sim_gyro_regs[SIM_GYRO_OUT], 0, 4);
+    sim_gyro_regs[SIM_GYRO_OUT+4] = (uint8_t) rate;
+    sim_gyro_regs[SIM_GYRO_OUT+5] = (uint8_t) ((uint16_t) rate >> 8);
+}
+
+/**
+ * Receive a radio byte: the receive complete interrupt if it is enabled,
+ * otherwise the driver's receive interrupt. The driver collects the string
+ * until SIM_RADIO_END, then it is ready for radio_gets and the next string is
+ * collected.
+ *
+ * Parameters: byte - uint8_t, The received byte
+ */
+void sim_radio_rx(uint8_t byte)
+{
+    sim_woken = 1;
+    if(sim_baud != sim_xbee_baud) byte = SIM_XBEE_GARBLED;
+
+    if(USARTE0_RXC_vect != NULL &&
+            (USARTE0.CTRLA & USART_RXCINTLVL_gm) != 0){
+        /* The byte is lost if the interrupts are disabled (no RX FIFO) */
+        if(sim_int_enabled((USARTE0.CTRLA & USART_RXCINTLVL_gm) >> 4)){
+            USARTE0.DATA = byte;
+            USARTE0_RXC_vect();
+        }else{
+            sim_rx_overruns++;
+        }
+        return;
+    }
+
+    if(byte == SIM_RADIO_END){
+        /* The previous string has not been read yet - it is lost */
+        if(sim_rx_done) sim_rx_overruns++;
+
+        memcpy(sim_rx_ready, sim_rx_buf, sim_rx_len);
+        sim_rx_ready[sim_rx_len] = 0;
+        sim_rx_len = 0;
+        sim_rx_done = 1;
+    }else if(sim_rx_len < SIM_RADIO_RX_LEN-1){
+        sim_rx_buf[sim_rx_len++] = (char) byte;
+    }else{
+        sim_rx_overruns++;
+        sim_rx_len = 0;
+    }
+}
+
+/**
+ * A byte from the firmware to the XBee: on the air, or in the command mode a
+ * part of the command line.
+ *
+ * Parameters:
+ *      time_us - uint32_t, Time when the byte was sent
+ *      byte - uint8_t, The byte
+ */
+void sim_xbee_tx(uint32_t time_us, uint8_t byte)
+{
+    double since = time_us - sim_xbee_last_us;
+    sim_xbee_last_us = time_us;
+
+    if(sim_baud != sim_xbee_baud){
+        sim_xbee_plus = 0;
+        sim_radio_tx_hook(time_us, SIM_XBEE_GARBLED);
+        return;
+    }
+
+    /* "+++" and then the guard time - the command mode */
+    if(sim_xbee_plus == 3 && since >= SIM_XBEE_GT_US){
+        sim_xbee_cmd_mode = 1;
+        sim_xbee_line_len = 0;
+        sim_xbee_reply("OK\r");
+    }
+    if(sim_xbee_cmd_mode){
+        sim_xbee_plus = 0;
+        if(byte != '\r'){
+            if(sim_xbee_line_len < SIM_XBEE_LINE_LEN-1){
+                sim_xbee_line[sim_xbee_line_len++] = (char) byte;
+            }
+            return;
+        }
+
+        sim_xbee_line[sim_xbee_line_len] = 0;
+        sim_xbee_line_len = 0;
+        sim_xbee_command(sim_xbee_line);
+        return;
+    }
+
+    /* The pluses are sent like any other bytes */
+    if(byte == '+' && (sim_xbee_plus == 0 ? since >= SIM_XBEE_GT_US :
+                sim_xbee_plus < 3 && since < SIM_XBEE_GT_US)){
+        sim_xbee_plus++;
+    }else{
+        sim_xbee_plus = 0;
+    }
+    sim_radio_tx_hook(time_us, byte);
+}
+
+/**
+ * Run an XBee command line (e.g. "ATBD7,CN"): BD sets the baud rate (0...7
+ * the standard ones, otherwise the rate itself in hex), CN leaves the
+ * command mode and applies the rate.
+ *
+ * Parameters: line - string, The command line (without the carriage return)
+ */
+void sim_xbee_command(const char *line)
+{
+    static const uint32_t bd[8] = {1200, 2400, 4800, 9600, 19200, 38400,
+        57600, 115200};
+
+    if(strncmp(line, "AT", 2) != 0){
+        sim_xbee_reply("ERROR\r");
+        return;
+    }
+    line += 2;
+
+    while(*line != 0){
+        if(strncmp(line, "BD", 2) == 0){
+            char *end;
+            uint32_t value = (uint32_t) strtoul(line+2, &end, 16);
+            sim_xbee_new_baud = value < 8 ? bd[value] : value;
+            line = end;
+            sim_xbee_reply("OK\r");
+        }else if(strncmp(line, "CN", 2) == 0){
+            sim_xbee_reply("OK\r");
+            sim_xbee_cmd_mode = 0;
+            sim_xbee_baud = sim_xbee_new_baud;
+            line += 2;
+        }else{
+            sim_xbee_reply("ERROR\r");
+            return;
+        }
+
+        if(*line == ',') line++;
+    }
+}
+
+/* The XBee replies to the firmware */
+void sim_xbee_reply(const char *str)
+{
+    for(; *str != 0; str++){
+        sim_radio_rx((uint8_t) *str);
+    }
+}
+
+/* Default radio output */
+void sim_radio_tx_stdout(uint32_t time_us, uint8_t byte)
+{
+    (void) time_us;
+    putchar(byte);
+}
+
+/* Interrupts */
+void sei(void)
+{
+    sim_sei = 1;
+}
+
+void cli(void)
+{
+    sim_sei = 0;
+}
+
+/* Delays and sleep */
+void _delay_ms(double ms)
+{
+    sim_run((uint32_t) (ms*1000));
+}
+
+void _delay_us(double us)
+{
+    sim_run((uint32_t) us);
+}
+
+void set_sleep_mode(int mode)
+{
+    (void) mode;
+}
+
+void sleep_enable(void)
+{
+}
+
+void sleep_disable(void)
+{
+}
+
+/**
+ * Sleep until an interrupt has run (at most a second, so a firmware bug that
+ * sleeps with all the interrupts disabled does not hang the simulation).
+ */
+void sleep_cpu(void)
+{
+    uint32_t time_us = 0;
+
+    sim_woken = 0;
+    while(!sim_woken && time_us < 1000000){
+        sim_run(SIM_STEP_US);
+        time_us += SIM_STEP_US;
+    }
+}
+
+/* Board */
+void clock_init(void)
+{
+}
+
+/* The ADC as drivers/adc.c sets it up (channel 0 is batt_control.c's) */
+void board_init(void)
+{
+    ADCA.CTRLB = ADC_RESOLUTION_12BIT_gc;
+    ADCA.REFCTRL = ADC_REFSEL_INTVCC_gc;
+    ADCA.PRESCALER = ADC_PRESCALER_DIV256_gc;
+    ADCA.CTRLA = ADC_ENABLE_bm;
+}
+
+void rgb_set(uint8_t color)
+{
+    (void) color;
+}
+
+/* The button is always pressed */
+uint8_t sw1_read(void)
+{
+    return 1;
+}
+
+uint32_t millis(void)
+{
+    return (uint32_t) (sim_plant.time_us / 1000);
+}
+
+/* Motors and encoders */
+void motor_init(void)
+{
+}
+
+void motor_set(int16_t pwr_left, int16_t pwr_right)
+{
+    if(pwr_left > SIM_MAX_PWR) pwr_left = SIM_MAX_PWR;
+    if(pwr_left < -SIM_MAX_PWR) pwr_left = -SIM_MAX_PWR;
+    if(pwr_right > SIM_MAX_PWR) pwr_right = SIM_MAX_PWR;
+    if(pwr_right < -SIM_MAX_PWR) pwr_right = -SIM_MAX_PWR;
+
+    sim_plant.wheel[SIM_LEFT].pwr = pwr_left;
+    sim_plant.wheel[SIM_RIGHT].pwr = pwr_right;
+}
+
+void quadrature_init(void)
+{
+}
+
+/* The encoders count down when driving forward (see get_left_distance_mm) */
+int16_t get_left_enc(void)
+{
+    sim_wheel_t *wheel = &sim_plant.wheel[SIM_LEFT];
+    return (int16_t) -(wheel->enc - wheel->enc_zero);
+}
+
+int16_t get_right_enc(void)
+{
+    sim_wheel_t *wheel = &sim_plant.wheel[SIM_RIGHT];
+    return (int16_t) -(wheel->enc - wheel->enc_zero);
+}
+
+/**
+ * Set what the encoders read (e.g. recorded encoders, see sim_replay.c). They
+ * keep counting from there when the wheels turn.
+ *
+ * Parameters:
+ *      left - int16_t, Left encoder
+ *      right - int16_t, Right encoder
+ */
+void sim_enc_set(int16_t left, int16_t right)
+{
+    sim_plant.wheel[SIM_LEFT].enc_zero = sim_plant.wheel[SIM_LEFT].enc + left;
+    sim_plant.wheel[SIM_RIGHT].enc_zero =
+        sim_plant.wheel[SIM_RIGHT].enc + right;
+    TCC0.CNT = (uint16_t) get_left_enc();
+    TCD0.CNT = (uint16_t) get_right_enc();
+}
+
+void left_enc_reset(void)
+{
+    sim_plant.wheel[SIM_LEFT].enc_zero = sim_plant.wheel[SIM_LEFT].enc;
+    TCC0.CNT = 0;
+}
+
+void right_enc_reset(void)
+{
+    sim_plant.wheel[SIM_RIGHT].enc_zero = sim_plant.wheel[SIM_RIGHT].enc;
+    TCD0.CNT = 0;
+}
+
+/* Radio */
+void radio_init(uint32_t baud)
+{
+    sim_baud = baud;
+}
+
+/* Blocking send */
+void radio_puts(char *str)
+{
+    for(; *str != 0; str++){
+        sim_xbee_tx(sim_time_us(), (uint8_t) *str);
+        sim_run((uint32_t) (10e6 / sim_baud));
+    }
+}
+
+/**
+ * Get the received string (without the end letter).
+ *
+ * Returns: 0 or 1 (uint8_t) - 1 if a new string was copied to str
+ */
+uint8_t radio_gets(char *str)
+{
+    if(!sim_rx_done) return 0;
+
+    strcpy(str, sim_rx_ready);
+    sim_rx_done = 0;
+
+    return 1;
+}
+
+/* TWI master (AVR1308) - the transfer is the interrupt's state machine */
+void TWI_MasterInit(TWI_Master_t *twi, TWI_t *module, uint8_t intLevel,
+        uint8_t baudRateRegisterSetting)
+{
+    twi->interface = module;
+    module->MASTER.CTRLA = intLevel | TWI_MASTER_RIEN_bm | TWI_MASTER_WIEN_bm |
+        TWI_MASTER_ENABLE_bm;
+    module->MASTER.BAUD = baudRateRegisterSetting;
+    module->MASTER.STATUS = TWI_MASTER_BUSSTATE_IDLE_gc;
+}
+
+bool TWI_MasterWriteRead(TWI_Master_t *twi, uint8_t address,
+        uint8_t *writeData, uint8_t bytesToWrite, uint8_t bytesToRead)
+{
+    if(bytesToWrite > TWIM_WRITE_BUFFER_SIZE ||
+            bytesToRead > TWIM_READ_BUFFER_SIZE ||
+            twi->status != TWIM_STATUS_READY){
+        return false;
+    }
+
+    twi->status = TWIM_STATUS_BUSY;
+    twi->result = TWIM_RESULT_UNKNOWN;
+    twi->address = (uint8_t) (address << 1);
+    memcpy((uint8_t *) twi->writeData, writeData, bytesToWrite);
+    twi->bytesToWrite = bytesToWrite;
+    twi->bytesToRead = bytesToRead;
+    twi->bytesWritten = 0;
+    twi->bytesRead = 0;
+
+    if(bytesToWrite > 0){
+        twi->interface->MASTER.ADDR = twi->address & ~0x01;
+    }else if(bytesToRead > 0){
+        twi->interface->MASTER.ADDR = twi->address | 0x01;
+    }
+
+    return true;
+}
+
+void TWI_MasterInterruptHandler(TWI_Master_t *twi)
+{
+    TWI_MASTER_t *master = &twi->interface->MASTER;
+    uint8_t status = master->STATUS;
+
+    if(status & (TWI_MASTER_ARBLOST_bm | TWI_MASTER_BUSERR_bm)){
+        twi->result = (status & TWI_MASTER_BUSERR_bm) ?
+            TWIM_RESULT_BUS_ERROR : TWIM_RESULT_ARBITRATION_LOST;
+        master->STATUS = status | TWI_MASTER_ARBLOST_bm;
+        twi->status = TWIM_STATUS_READY;
+    }else if(status & TWI_MASTER_WIF_bm){
+        if(status & TWI_MASTER_RXACK_bm){
+            master->CTRLC = TWI_MASTER_CMD_STOP_gc;
+            twi->result = TWIM_RESULT_NACK_RECEIVED;
+            twi->status = TWIM_STATUS_READY;
+        }else if(twi->bytesWritten < twi->bytesToWrite){
+            master->DATA = twi->writeData[twi->bytesWritten++];
+        }else if(twi->bytesRead < twi->bytesToRead){
+            master->ADDR = twi->address | 0x01;
+        }else{
+            master->CTRLC = TWI_MASTER_CMD_STOP_gc;
+            twi->result = TWIM_RESULT_OK;
+            twi->status = TWIM_STATUS_READY;
+        }
+    }else if(status & TWI_MASTER_RIF_bm){
+        if(twi->bytesRead < TWIM_READ_BUFFER_SIZE){
+            twi->readData[twi->bytesRead++] = master->DATA;
+        }else{
+            master->CTRLC = TWI_MASTER_CMD_STOP_gc;
+            twi->result = TWIM_RESULT_BUFFER_OVERFLOW;
+            twi->status = TWIM_STATUS_READY;
+        }
+
+        if(twi->bytesRead < twi->bytesToRead){
+            master->CTRLC = TWI_MASTER_CMD_RECVTRANS_gc;
+        }else{
+            master->CTRLC = TWI_MASTER_ACKACT_bm | TWI_MASTER_CMD_STOP_gc;
+            twi->result = TWIM_RESULT_OK;
+            twi->status = TWIM_STATUS_READY;
+        }
+    }else{
+        twi->result = TWIM_RESULT_FAIL;
+        twi->status = TWIM_STATUS_READY;
+    }
+}
+
+/* Memory (the SRAM is not simulated, see mem_control.c) */
+uint16_t mem_get_static()
+{
+    return 0;
+}
+
+uint16_t mem_get_stack_max()
+{
+    return 0;
+}
+
+uint16_t mem_get_free_min()
+{
+    return 0;
+}
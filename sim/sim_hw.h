@@ -0,0 +1,28 @@
+#ifndef SIM_HW_H
+#define SIM_HW_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "sim_plant.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* The letter that ends a radio string (see radio_gets) */
+#define SIM_RADIO_END 'G'
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void sim_hw_init(uint32_t seed, uint8_t spread);
+void sim_run(uint32_t time_us);
+uint32_t sim_time_us();
+void sim_radio_rx(uint8_t byte);
+void sim_enc_set(int16_t left, int16_t right);
+
+extern uint8_t sim_robot_id;
+extern void (*sim_step_hook)(void);
+extern void (*sim_radio_tx_hook)(uint32_t time_us, uint8_t byte);
+extern uint32_t sim_baud;
+extern uint32_t sim_xbee_baud;
+extern uint16_t sim_rx_overruns;
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * Differential drive robot model (plant) for the host simulator.
+ *
+ * Models the things that make the real robot drive crooked and stop in the
+ * wrong place:
+ *  * motor lag - the wheel speed follows the motor power with a first order
+ *    lag (time constant tau), at power 0 the motor coasts (tau_coast)
+ *  * per wheel gain mismatch and a deadband under which the motor does not
+ *    turn at all
+ *  * quantized encoders - SIM_ENC_COUNTS counts per wheel revolution
+ *  * slip - the wheel slips when accelerating faster than the traction
+ *    allows, plus a slowly changing random slip (uneven floor)
+ *  * battery sag - the voltage drops with the load (internal resistance) and
+ *    with the used charge, the motor gets the power (PWM duty) times the
+ *    voltage
+ *
+ * The encoders see the wheel rim, the pose (x, y, heading) is where the robot
+ * really is - comparing the two shows what the odometry and the controller
+ * cannot see.
+ */
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "sim_plant.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Time constant of the random slip changes in s */
+#define SIM_SLIP_TAU 0.2
+
+/**
+ * Encoder counts per mm the firmware is calibrated to (see DRIVEC_CLICK_CONST
+ * in drive_control.h). The default wheel diameter is derived from it.
+ */
+#define SIM_CLICKS_PER_MM 7.744
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void sim_wheel_step(sim_plant_t *plant, sim_wheel_t *wheel, double gain,
+        double dt);
+void sim_battery_step(sim_plant_t *plant, double dt);
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Get a random number (xorshift32, so the runs are the same on every host).
+ *
+ * Parameters: rng - uint32_t*, Random generator state (must not be 0)
+ *
+ * Returns: double, random number in -1...1
+ */
+double sim_rand(uint32_t *rng)
+{
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+
+    return (double) x / 2147483648.0 - 1.0;
+}
+
+/**
+ * Initialize the plant: the robot stands still at (0, 0) heading along the x
+ * axis.
+ *
+ * Parameters:
+ *      plant - sim_plant_t*, The plant
+ *      seed - uint32_t, Random seed (the same seed gives the same run)
+ *      spread - uint8_t, 1 to vary the gains and the deadband randomly (see
+ *               SIM_GAIN_SPREAD and SIM_DEADBAND_SPREAD), 0 for the nominal
+ *               robot
+ */
+void sim_plant_init(sim_plant_t *plant, uint32_t seed, uint8_t spread)
+{
+    memset(plant, 0, sizeof(*plant));
+    plant->rng = (seed == 0) ? 1 : seed;
+
+    sim_param_t *p = &plant->param;
+    p->max_speed = 450.0;
+    p->tau = 0.04;
+    p->tau_coast = 0.1;
+    p->gain[SIM_LEFT] = 1.0;
+    p->gain[SIM_RIGHT] = 1.0;
+    p->deadband = 150;
+    p->wheel_d = SIM_ENC_COUNTS / (M_PI*SIM_CLICKS_PER_MM);
+    p->track = 89.3;
+    p->max_accel = 2500.0;
+    p->slip = 0.02;
+
+    /* 1S LiPo, 300 mAh */
+    p->v_full = 4.2;
+    p->v_empty = 3.3;
+    p->v_nom = 3.7;
+    p->r_int = 0.2;
+    p->i_idle = 0.06;
+    p->i_motor = 1.0;
+    p->capacity = 0.3*3600;
+    p->charge = 1.0;
+
+    if(spread){
+        p->gain[SIM_LEFT] *= 1.0 + SIM_GAIN_SPREAD*sim_rand(&plant->rng);
+        p->gain[SIM_RIGHT] *= 1.0 + SIM_GAIN_SPREAD*sim_rand(&plant->rng);
+        p->deadband = (int16_t) (p->deadband *
+                (1.0 + SIM_DEADBAND_SPREAD*sim_rand(&plant->rng)));
+    }
+
+    plant->wheel[SIM_LEFT].slip = p->slip*sim_rand(&plant->rng);
+    plant->wheel[SIM_RIGHT].slip = p->slip*sim_rand(&plant->rng);
+
+    sim_battery_step(plant, 0.0);
+}
+
+/**
+ * Advance the plant by dt_us. Long steps are split into SIM_STEP_US steps.
+ *
+ * Parameters:
+ *      plant - sim_plant_t*, The plant
+ *      dt_us - uint32_t, Time step in us
+ */
+void sim_plant_step(sim_plant_t *plant, uint32_t dt_us)
+{
+    while(dt_us > 0){
+        uint32_t step_us = (dt_us > SIM_STEP_US) ? SIM_STEP_US : dt_us;
+        double dt = step_us / 1e6;
+
+        sim_battery_step(plant, dt);
+        sim_wheel_step(plant, &plant->wheel[SIM_LEFT],
+                plant->param.gain[SIM_LEFT], dt);
+        sim_wheel_step(plant, &plant->wheel[SIM_RIGHT],
+                plant->param.gain[SIM_RIGHT], dt);
+
+        /* Move the robot (midpoint heading) */
+        double v = (plant->wheel[SIM_LEFT].ground_speed +
+                plant->wheel[SIM_RIGHT].ground_speed) / 2;
+        double w = (plant->wheel[SIM_RIGHT].ground_speed -
+                plant->wheel[SIM_LEFT].ground_speed) / plant->param.track;
+        double heading = plant->heading + w*dt/2;
+
+        plant->x += v*cos(heading)*dt;
+        plant->y += v*sin(heading)*dt;
+        plant->heading += w*dt;
+        plant->yaw_rate = w;
+
+        plant->time_us += step_us;
+        dt_us -= step_us;
+    }
+}
+
+/**
+ * Advance one wheel (motor, slip and encoder) by dt.
+ *
+ * Parameters:
+ *      plant - sim_plant_t*, The plant
+ *      wheel - sim_wheel_t*, The wheel
+ *      gain - double, The wheel's gain
+ *      dt - double, Time step in s
+ */
+void sim_wheel_step(sim_plant_t *plant, sim_wheel_t *wheel, double gain,
+        double dt)
+{
+    sim_param_t *p = &plant->param;
+
+    /* Motor: the power (PWM duty) times the battery voltage - as the power
+     * at the nominal voltage - the deadband and the first order lag */
+    double target = 0.0;
+    double pwr = abs(wheel->pwr) * plant->v_batt / p->v_nom;
+    if(pwr > p->deadband){
+        target = gain * p->max_speed * (pwr - p->deadband) /
+            (SIM_MAX_PWR - p->deadband);
+        if(wheel->pwr < 0) target = -target;
+    }
+    double tau = (wheel->pwr == 0) ? p->tau_coast : p->tau;
+    wheel->speed += (target - wheel->speed) * (1.0 - exp(-dt / tau));
+
+    /* Slip: slowly changing random part and the traction limit */
+    wheel->slip += (p->slip*sim_rand(&plant->rng) - wheel->slip) *
+        dt / SIM_SLIP_TAU;
+
+    double ground = wheel->speed * (1.0 - wheel->slip);
+    double max_change = p->max_accel*dt;
+    if(ground > wheel->ground_speed + max_change){
+        ground = wheel->ground_speed + max_change;
+    }else if(ground < wheel->ground_speed - max_change){
+        ground = wheel->ground_speed - max_change;
+    }
+    wheel->ground_speed = ground;
+
+    /* Encoder */
+    wheel->pos += wheel->speed*dt;
+    wheel->enc = (int32_t) floor(wheel->pos * SIM_ENC_COUNTS /
+            (M_PI*p->wheel_d));
+}
+
+/**
+ * Update the battery voltage and the used charge.
+ *
+ * Parameters:
+ *      plant - sim_plant_t*, The plant
+ *      dt - double, Time step in s
+ */
+void sim_battery_step(sim_plant_t *plant, double dt)
+{
+    sim_param_t *p = &plant->param;
+
+    double load = (double) (abs(plant->wheel[SIM_LEFT].pwr) +
+            abs(plant->wheel[SIM_RIGHT].pwr)) / (2*SIM_MAX_PWR);
+    double current = p->i_idle + p->i_motor*load;
+
+    plant->used += current*dt;
+
+    double charge = p->charge - plant->used / p->capacity;
+    if(charge < 0.0) charge = 0.0;
+
+    plant->v_batt = p->v_empty + (p->v_full - p->v_empty)*charge -
+        p->r_int*current;
+}
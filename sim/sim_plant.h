@@ -0,0 +1,135 @@
+#ifndef SIM_PLANT_H
+#define SIM_PLANT_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Encoder counts per wheel revolution */
+#define SIM_ENC_COUNTS 512
+
+/* The biggest motor power (see motor_set in the drivers) */
+#define SIM_MAX_PWR 1000
+
+/* Plant integration step in us */
+#define SIM_STEP_US 100
+
+/**
+ * How much the plant parameters differ from the nominal ones from run to run
+ * (see sim_plant_init), as a fraction of the nominal value.
+ */
+#define SIM_GAIN_SPREAD 0.05
+#define SIM_DEADBAND_SPREAD 0.2
+
+/* ENUMS --------------------------------------------------------------------*/
+enum sim_wheel_enum{
+    SIM_LEFT = 0,
+    SIM_RIGHT = 1
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * Plant (robot model) parameters. The defaults (see sim_plant_init) are for
+ * the Pisibot v5 with the small wheels.
+ *
+ * Fields:
+ *      max_speed - wheel speed in mm/s at full power and nominal voltage
+ *      tau - motor time constant in s (first order lag)
+ *      tau_coast - time constant in s of the motor slowing down at power 0
+ *                  (the H-bridge lets it coast, only the friction stops it)
+ *      gain - per wheel gain (left, right), the wheels are never quite equal
+ *      deadband - motor power (at the nominal voltage) under which the wheel
+ *                 does not turn
+ *      wheel_d - wheel diameter in mm
+ *      track - distance between the wheels in mm
+ *      max_accel - traction limit in mm/s^2, faster changes make the wheel
+ *                  slip
+ *      slip - random slip (fraction of the wheel speed, slowly changing)
+ *      v_full, v_empty - battery open circuit voltage when full/empty
+ *      v_nom - battery voltage at which max_speed is reached
+ *      r_int - battery internal resistance in ohm
+ *      i_idle - current drawn by the electronics in A
+ *      i_motor - current drawn by both motors at full power in A
+ *      capacity - battery capacity in As
+ *      charge - battery state of charge at the start (0...1)
+ */
+typedef struct sim_param_struct{
+    double max_speed;
+    double tau;
+    double tau_coast;
+    double gain[2];
+    int16_t deadband;
+    double wheel_d;
+    double track;
+    double max_accel;
+    double slip;
+    double v_full;
+    double v_empty;
+    double v_nom;
+    double r_int;
+    double i_idle;
+    double i_motor;
+    double capacity;
+    double charge;
+} sim_param_t;
+
+/**
+ * One wheel of the plant.
+ *
+ * Fields:
+ *      pwr - motor power (see motor_set)
+ *      speed - wheel rim speed in mm/s (what the encoder sees)
+ *      ground_speed - speed over the ground in mm/s (differs when slipping)
+ *      slip - current slip (see sim_param_t)
+ *      pos - distance the wheel rim has turned in mm
+ *      enc - encoder count (quantized pos)
+ *      enc_zero - encoder count at the last encoder reset
+ */
+typedef struct sim_wheel_struct{
+    int16_t pwr;
+    double speed;
+    double ground_speed;
+    double slip;
+    double pos;
+    int32_t enc;
+    int32_t enc_zero;
+} sim_wheel_t;
+
+/**
+ * The simulated robot.
+ *
+ * Fields:
+ *      param - plant parameters
+ *      wheel - left and right wheel
+ *      time_us - simulated time
+ *      x, y, heading - true pose in mm and rad (x axis is the starting
+ *                      direction, heading grows counter clockwise, the same
+ *                      as the firmware's pose - see update_pose)
+ *      yaw_rate - true turning rate in rad/s (what the gyro measures, see
+ *                 sim_hw.c)
+ *      used - battery charge used in As
+ *      v_batt - battery voltage
+ *      rng - random generator state
+ */
+typedef struct sim_plant_struct{
+    sim_param_t param;
+    sim_wheel_t wheel[2];
+    uint64_t time_us;
+    double x;
+    double y;
+    double heading;
+    double yaw_rate;
+    double used;
+    double v_batt;
+    uint32_t rng;
+} sim_plant_t;
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void sim_plant_init(sim_plant_t *plant, uint32_t seed, uint8_t spread);
+void sim_plant_step(sim_plant_t *plant, uint32_t dt_us);
+double sim_rand(uint32_t *rng);
+
+/* The plant the simulated drivers use (see sim_hw.c) */
+extern sim_plant_t sim_plant;
+
+#endif
@@ -0,0 +1,289 @@
+/**
+ * Replay an input recording (see tracec_rec_enum in trace_control.h) through
+ * the firmware: the recorded radio strings go to get_cmd (through the
+ * parser task of main.c) and the recorded encoders to the control task, in
+ * the recorded order. The result does not depend on the host or on the
+ * timing, so two firmware versions can be compared on the same recording
+ * (e.g. diff the outputs).
+ *
+ * The recordings come from the robot's flight recorder (TRACE_RECORD) or from
+ * a serial sniffer (see serial-control/record.py).
+ *
+ * Usage:
+ *      sim_replay [-v] [-b] recording.rec > replay.csv
+ *
+ * Options:
+ *      -v - print the radio strings and what the robot sends to stderr
+ *      -b - print the host time of the control and parser tasks to stderr
+ *
+ * One CSV line per record: time (ms), record, the encoders, the PID error
+ * and powers (see drive_control.h), the motor powers and the odometry pose
+ * after the firmware has handled the record.
+ *
+ * The replay starts from a robot that has just been switched on. The
+ * motors do not move the simulated robot - the encoders come from the
+ * recording.
+ */
+
+#define _GNU_SOURCE
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <avr/interrupt.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "cmd_control.h"
+#include "drive_control.h"
+#include "radio_control.h"
+#include "telem_control.h"
+#include "trace_control.h"
+#include "sim_hw.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* The baud rate of the firmware (see main.c) */
+#define SIM_REPLAY_BAUD 57600
+
+/* STURCTS ------------------------------------------------------------------*/
+/* Host time of a task */
+typedef struct sim_bench_struct{
+    uint32_t count;
+    double sum_ns;
+    double max_ns;
+} sim_bench_t;
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void usage();
+uint8_t *read_file(const char *path, size_t *len);
+void sim_replay_tx(uint32_t time_us, uint8_t byte);
+void sim_replay_task(void (*task)(void), sim_bench_t *bench);
+void sim_replay_print(uint32_t t, const char *record);
+
+/* The tasks of main.c */
+void control_task();
+void parser_task();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The kill switch flag in killsw_control.c */
+extern volatile uint8_t killsw_is_fired;
+
+uint8_t verbose = 0;
+
+sim_bench_t bench_control;
+sim_bench_t bench_parser;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+void usage()
+{
+    fprintf(stderr, "usage: sim_replay [-v] [-b] recording.rec\n");
+    exit(2);
+}
+
+/**
+ * Read a whole file.
+ *
+ * Parameters:
+ *      path - const char*, The file
+ *      len - size_t*, The length is written here
+ *
+ * Returns: uint8_t*, the contents (malloc), exits on errors
+ */
+uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if(f == NULL){
+        perror(path);
+        exit(1);
+    }
+
+    size_t size = 4096;
+    uint8_t *buf = malloc(size);
+    *len = 0;
+
+    size_t n;
+    while((n = fread(buf + *len, 1, size - *len, f)) > 0){
+        *len += n;
+        if(*len == size){
+            size *= 2;
+            buf = realloc(buf, size);
+        }
+    }
+    fclose(f);
+
+    return buf;
+}
+
+/* What the robot sends */
+void sim_replay_tx(uint32_t time_us, uint8_t byte)
+{
+    (void) time_us;
+    if(verbose) fputc(byte, stderr);
+}
+
+/**
+ * Run a task of main.c and measure its host time.
+ *
+ * Parameters:
+ *      task - the task function
+ *      bench - sim_bench_t*, The task's time
+ */
+void sim_replay_task(void (*task)(void), sim_bench_t *bench)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    task();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ns = (end.tv_sec - start.tv_sec)*1e9 +
+        (end.tv_nsec - start.tv_nsec);
+    bench->count++;
+    bench->sum_ns += ns;
+    if(ns > bench->max_ns) bench->max_ns = ns;
+}
+
+/* One CSV line (the state after the record) */
+void sim_replay_print(uint32_t t, const char *record)
+{
+    printf("%u,%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", t, record,
+            get_left_enc(), get_right_enc(), error, debug_pwr_left,
+            debug_pwr_right, sim_plant.wheel[SIM_LEFT].pwr,
+            sim_plant.wheel[SIM_RIGHT].pwr, get_pose_x_mm(), get_pose_y_mm(),
+            get_pose_heading_deg());
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t bench = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "vb")) != -1){
+        if(opt == 'v'){
+            verbose = 1;
+        }else if(opt == 'b'){
+            bench = 1;
+        }else{
+            usage();
+        }
+    }
+    if(argc - optind != 1) usage();
+
+    size_t len;
+    uint8_t *rec = read_file(argv[optind], &len);
+
+    /* A robot that does not move (the encoders come from the recording) */
+    sim_hw_init(1, 0);
+    sim_plant.param.max_speed = 0.0;
+    sim_radio_tx_hook = sim_replay_tx;
+
+    /* The same as main() without the timers (nothing runs by itself) */
+    drive_control_init();
+    init_cmd_control();
+    telem_control_init();
+    trace_control_init();
+    radio_init(SIM_REPLAY_BAUD);
+    radio_control_init();
+    /* The radio strings go through the receive interrupt */
+    sei();
+
+    printf("t_ms,record,left_enc,right_enc,error,pid_pwr_left,"
+            "pid_pwr_right,pwr_left,pwr_right,pose_x_mm,pose_y_mm,"
+            "pose_heading_deg\n");
+
+    uint32_t t = 0;
+    /* The recorded encoders (ENC records are changes from these) */
+    int16_t left = 0;
+    int16_t right = 0;
+    size_t i = 0;
+
+    while(i < len){
+        uint8_t type = rec[i] >> TRACEC_REC_TYPE_SHIFT;
+        t += rec[i] & TRACEC_REC_MAX_DT;
+        i++;
+
+        /* The record's length (without the header) */
+        size_t rec_len = 0;
+        if(type == TRACE_REC_ENC){
+            rec_len = 1;
+        }else if(type == TRACE_REC_KEY){
+            rec_len = 4;
+        }else if(type == TRACE_REC_RX){
+            rec_len = 2;
+            if(i + 2 <= len) rec_len += rec[i] | (rec[i+1] << 8);
+        }else if(type == TRACE_REC_TIME){
+            rec_len = 2;
+        }
+        if(i + rec_len > len){
+            fprintf(stderr, "%s: the last record is cut\n", argv[optind]);
+            break;
+        }
+        uint8_t *data = &rec[i];
+        i += rec_len;
+
+        if(type == TRACE_REC_TIME){
+            t += data[0] | (data[1] << 8);
+            continue;
+        }
+
+        /* The robot's time (so millis is right and the replies are sent) */
+        uint32_t now = sim_time_us();
+        if(now == 0){
+            sim_plant.time_us = (uint64_t) t*1000;
+        }else if(now < t*1000){
+            sim_run(t*1000 - now);
+        }
+
+        if(type == TRACE_REC_ENC || type == TRACE_REC_KEY ||
+                type == TRACE_REC_SAME){
+            if(type == TRACE_REC_ENC){
+                left += (int8_t) data[0] >> 4;
+                right += (int8_t) (data[0] << 4) >> 4;
+            }else if(type == TRACE_REC_KEY){
+                left = (int16_t) (data[0] | (data[1] << 8));
+                right = (int16_t) (data[2] | (data[3] << 8));
+            }
+            sim_enc_set(left, right);
+            sim_replay_task(control_task, &bench_control);
+            sim_replay_print(t, "ctrl");
+        }else if(type == TRACE_REC_RX){
+            uint16_t str_len = data[0] | (data[1] << 8);
+            if(str_len > 0){
+                if(verbose){
+                    fprintf(stderr, "%u: %.*s\n", t, str_len, data + 2);
+                }
+
+                uint16_t j = 0;
+                for(; j < str_len; j++) sim_radio_rx(data[2+j]);
+                sim_radio_rx(SIM_RADIO_END);
+            }
+            sim_replay_task(parser_task, &bench_parser);
+            sim_replay_print(t, "rx");
+        }else if(type == TRACE_REC_KILL){
+            motor_set(0, 0);
+            killsw_is_fired = 1;
+            sim_replay_print(t, "kill");
+        }else{
+            fprintf(stderr, "%s: unknown record %u at %zu\n", argv[optind],
+                    type, i - rec_len - 1);
+            break;
+        }
+    }
+
+    if(bench){
+        fprintf(stderr, "control: %u runs, avg %.0f ns, max %.0f ns\n",
+                bench_control.count, bench_control.sum_ns /
+                (bench_control.count ? bench_control.count : 1),
+                bench_control.max_ns);
+        fprintf(stderr, "parser: %u runs, avg %.0f ns, max %.0f ns\n",
+                bench_parser.count, bench_parser.sum_ns /
+                (bench_parser.count ? bench_parser.count : 1),
+                bench_parser.max_ns);
+    }
+
+    free(rec);
+
+    return 0;
+}
@@ -0,0 +1,1477 @@
+/**
+ * Multi-robot simulation: N robots running the whole firmware (main.c and
+ * everything) share one simulated radio channel, the way our robots share
+ * one XBee broadcast channel.
+ *
+ * Every robot is a child process (the firmware has one set of globals) with
+ * its own simulated hardware (see sim_hw.c). The processes run in lock step:
+ * every SIM_SYNC_US of simulated time a robot sends the bytes it has
+ * transmitted to this (parent) process and gets the bytes it receives during
+ * the next period.
+ *
+ * The channel: every byte is on the air for one byte time (10 bits at the
+ * channel baud rate) and is heard by all the other robots and the host.
+ * Bytes from different senders that are on the air at the same time collide
+ * (see -c). Every receiver can also lose a byte (-l) or get bit errors (-e).
+ * A byte arrives one byte time after it was sent, plus up to SIM_SYNC_US
+ * (the lock step).
+ *
+ * The host side of the channel (the camera computer):
+ *  * -p opens a pty - the camera software or serial-control.py can open it
+ *    like the XBee's serial port. The simulation then runs in real time.
+ *  * -g sends a CMD_DRIVE to every robot in turn, one every period ms, and
+ *    measures the command latency (from when the command was generated, the
+ *    wait for the host's turn included, until get_cmd in the robot returns
+ *    the command) and the delivery ratio per robot.
+ *  * -t subscribes all the robots to telemetry (broadcast CMD_TELEM), which
+ *    makes the robots transmit and the channel busy. The host counts the
+ *    valid messages it receives from every robot (uplink).
+ *  * -T frame_ms,down_ms,slot_ms divides the channel into transmit slots
+ *    (see slot_control.c): the host assigns every robot a slot_ms slot
+ *    after its own down_ms slot and sends a beacon every frame_ms. The
+ *    generated commands and the telemetry subscription wait for the host's
+ *    slot, the more urgent ones (the commands) first. A new command to a
+ *    robot replaces its command that is still waiting (superseded). The
+ *    pty (-p) is not scheduled.
+ *  * -E time_ms stops all the robots at time_ms with the emergency stop
+ *    (see RADIOC_ESTOP_MARK in radio_control.h), -E time_ms,cmd with a
+ *    broadcast CMD_END instead. The stop is sent right away (no slots) and
+ *    repeated a few times, and the commands are not generated any more. The
+ *    stop's task wait is from the arrival of the first stop's last byte
+ *    until the robot's motors are at zero for good (without the lock step).
+ *    The firmware runs in no simulated time, so this is only the wait for
+ *    the tasks' periods, not the stop latency on the robot.
+ *  * -B time_ms,baud switches the robots to another baud rate (CMD_BAUD, see
+ *    baud_control.c) one by one from time_ms on: the proposal until the
+ *    robot replies, then from SIM_BAUD_WAIT after the first proposal the
+ *    confirmation every SIM_BAUD_RETRY ms until the robot is done. No
+ *    commands are generated to a robot that is switching. -B time_ms,baud,noconfirm never
+ *    confirms, so the robots have to fall back. The robots' XBees are
+ *    simulated (see sim_hw.c), the host's is not - the channel stays at -b.
+ *
+ * The channel utilization is the share of the time the channel carried
+ * bytes (collided or not).
+ *
+ * Usage:
+ *      sim_swarm [-n robots] [-i first_id] [-d duration_ms] [-b baud]
+ *                [-l loss] [-e ber] [-c none|corrupt|drop] [-g period_ms]
+ *                [-t signals,decimation] [-T frame_ms,down_ms,slot_ms]
+ *                [-E time_ms[,cmd]] [-B time_ms,baud[,noconfirm]]
+ *                [-s seed] [-o file] [-p]
+ *
+ * e.g. sim_swarm -n 5 -g 20 -t 1,2 -c corrupt -d 20000
+ *      sim_swarm -n 5 -g 24 -t 16,12 -T 120,30,18 -d 20000
+ *      sim_swarm -n 5 -g 24 -t 16,12 -E 5000 -d 6000
+ *      sim_swarm -n 5 -g 24 -B 2000,115200 -d 9000
+ */
+
+#define _GNU_SOURCE
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "baud_control.h"
+#include "cmd_control.h"
+#include "radio_control.h"
+#include "sim_hw.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/* Lock step period in us */
+#define SIM_SYNC_US 1000
+
+#define SIM_MAX_ROBOTS 16
+
+/* The host's endpoint number (the robots are 0...SIM_MAX_ROBOTS-1) */
+#define SIM_HOST SIM_MAX_ROBOTS
+
+/**
+ * The generated traffic starts at SIM_BOOT_TIME (ms) - the robots wait a
+ * second after power-up (see main.c) - and stops SIM_DRAIN (ms) before the
+ * end, so that every generated command has had the time to arrive.
+ */
+#define SIM_BOOT_TIME 1500
+#define SIM_DRAIN 500
+
+/* Generated CMD_DRIVE power and the distance limit */
+#define SIM_GEN_PWR 300
+#define SIM_GEN_MAX_MM 1000
+
+/* Buffer lengths (must be powers of 2) */
+#define SIM_QUEUE_LEN 4096
+#define SIM_SENT_LEN 64
+
+/* Bytes on the air / per robot per lock step */
+#define SIM_AIR_LEN 4096
+#define SIM_TX_LEN 1024
+#define SIM_REPORT_LEN 64
+
+/* Longest generated frame */
+#define SIM_FRAME_LEN 64
+
+/* Longest radio string the host sends (see MAX_BURST_LEN in pisibot.py) */
+#define SIM_STRING_LEN 256
+
+/* Frames waiting for the host's slot (-T) */
+#define SIM_DOWN_LEN 64
+
+/**
+ * Time (ms) between the beacon and the commands. The robot parses the
+ * beacon in its next parser run (every 5 ms, see main.c) - a string that
+ * arrives before that replaces the beacon.
+ */
+#define SIM_TDMA_GAP 6
+
+/* A frame that has waited this many frames is sent first (no starvation) */
+#define SIM_MAX_WAIT 3
+
+/* Longest robot message the host receives */
+#define SIM_LINE_LEN 256
+
+/**
+ * The stop (-E) is sent SIM_STOP_COPIES times, every SIM_STOP_PERIOD ms. It
+ * does not wait for the host's slot (-T), so a copy can collide with a robot
+ * sending in its slot.
+ */
+#define SIM_STOP_COPIES 6
+#define SIM_STOP_PERIOD 20
+
+/**
+ * The baud rate switch (-B): the robots' proposals are SIM_BAUD_STAGGER ms
+ * apart (their replies would collide), a proposal or a confirmation without
+ * a reply is sent again after SIM_BAUD_RETRY ms and the confirmations start
+ * SIM_BAUD_WAIT ms after the first proposal (the robot's XBee's guard times,
+ * see BAUDC_GUARD_TIME in baud_control.h). SIM_BAUD_RETRY is not a multiple
+ * of SIM_BAUD_STAGGER, otherwise the retries to two robots would line up and
+ * the first robot's reply would collide with the second one's retry every
+ * time.
+ */
+#define SIM_BAUD_STAGGER 50
+#define SIM_BAUD_RETRY 110
+#define SIM_BAUD_WAIT 2300
+
+/* Report types that are not command types: the motors started or stopped,
+ * the firmware took an emergency stop */
+#define SIM_REPORT_MOTORS 0xFF
+#define SIM_REPORT_ESTOP 0xFE
+
+/* ENUMS --------------------------------------------------------------------*/
+/* Collision models */
+enum sim_coll_enum{
+    SIM_COLL_NONE = 0,
+    SIM_COLL_CORRUPT = 1,
+    SIM_COLL_DROP = 2
+};
+
+/* Priorities of the host's frames (-T), the smaller is sent first */
+enum sim_prio_enum{
+    SIM_PRIO_CMD = 0,
+    SIM_PRIO_CONFIG = 1,
+    SIM_PRIO_COUNT = 2
+};
+
+/* The host's side of a robot's baud rate switch (-B) */
+enum sim_baud_enum{
+    SIM_BAUD_IDLE = 0,
+    SIM_BAUD_PROPOSED = 1,
+    SIM_BAUD_SWITCHING = 2,
+    SIM_BAUD_DONE = 3
+};
+
+/* The robot's stop (-E) */
+enum sim_stop_enum{
+    SIM_STOP_PENDING = 0,
+    SIM_STOP_STOPPED = 1
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/* A byte with its time (send or arrival time) */
+typedef struct sim_byte_struct{
+    uint32_t time_us;
+    uint8_t byte;
+} sim_byte_t;
+
+/* A byte on the air */
+typedef struct sim_air_struct{
+    uint32_t time_us;
+    uint8_t byte;
+    uint8_t sender;
+    uint8_t resolved;
+} sim_air_t;
+
+/* A command the robot's get_cmd returned (or SIM_REPORT_MOTORS) */
+typedef struct sim_report_struct{
+    uint32_t time_us;
+    uint8_t type;
+    int16_t data[2];
+} sim_report_t;
+
+/* Robot -> parent message header (followed by the bytes and the reports) */
+typedef struct sim_sync_struct{
+    uint32_t time_us;
+    uint16_t tx_count;
+    uint16_t report_count;
+    uint16_t rx_overruns;
+    cmd_stats_t link;
+    uint32_t baud;
+} sim_sync_t;
+
+/* Bytes waiting for their arrival time */
+typedef struct sim_queue_struct{
+    sim_byte_t bytes[SIM_QUEUE_LEN];
+    uint16_t head;
+    uint16_t tail;
+} sim_queue_t;
+
+/* A frame waiting for the host's slot (-T) */
+typedef struct sim_down_struct{
+    uint8_t id;
+    uint8_t priority;
+    uint8_t waited;
+    uint16_t len;
+    char frame[SIM_FRAME_LEN];
+} sim_down_t;
+
+/* A generated command that has not arrived yet */
+typedef struct sim_sent_struct{
+    uint32_t time_us;
+    int16_t data[2];
+} sim_sent_t;
+
+typedef struct sim_robot_struct{
+    pid_t pid;
+    int fd;
+    uint8_t id;
+    sim_queue_t rx;
+
+    /* Generated commands (FIFO) */
+    sim_sent_t sent[SIM_SENT_LEN];
+    uint8_t sent_head;
+    uint8_t sent_count;
+    uint16_t seq;
+
+    /* Statistics */
+    uint32_t cmds;
+    uint32_t delivered;
+    uint64_t latency_sum;
+    uint32_t latency_max;
+    uint16_t rx_overruns;
+    uint32_t uplink;
+    cmd_stats_t link;
+
+    /* The motors are running, the stop (-E) */
+    uint8_t moving;
+    uint8_t stop_received;
+    uint8_t stop;
+    uint32_t stop_wait;
+    uint16_t restarts;
+
+    /* The baud rate switch (-B): the state, when it started, when the last
+     * request was sent, how long it took, the robot's rate (0 - its XBee
+     * has another one) */
+    uint8_t baud_state;
+    uint32_t baud_start;
+    uint32_t baud_sent;
+    uint32_t baud_done;
+    uint32_t baud;
+} sim_robot_t;
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void usage();
+void sim_write_all(int fd, const void *buf, size_t len);
+uint8_t sim_read_all(int fd, void *buf, size_t len);
+uint8_t sim_queue_push(sim_queue_t *queue, uint32_t time_us, uint8_t byte);
+void sim_child(sim_robot_t *robot, uint32_t seed);
+void sim_child_step();
+void sim_child_tx(uint32_t time_us, uint8_t byte);
+void sim_air_add(uint32_t time_us, uint8_t byte, uint8_t sender);
+void sim_air_resolve(uint32_t end_us);
+void sim_deliver(sim_air_t *air, uint8_t collided);
+void sim_host_send(const char *data, uint16_t len, uint32_t now_us);
+uint16_t sim_make_frame(char *buf, uint8_t id, uint8_t type, int16_t *data,
+        uint8_t data_len);
+void sim_host_queue(const char *frame, uint16_t len, uint8_t id,
+        uint8_t priority, uint32_t now_us);
+void sim_tdma_frame(uint32_t now_us);
+void sim_host_rx(uint8_t byte, uint32_t time_us);
+void sim_host_baud(sim_robot_t *robot, uint8_t robot_index, uint32_t now_us);
+void sim_host_baud_reply(sim_robot_t *robot, char *args, uint32_t time_us);
+void sim_report(sim_robot_t *robot, sim_report_t *report);
+void sim_report_motors(sim_robot_t *robot, sim_report_t *report);
+void sim_pty_open();
+void sim_print_stats();
+
+cmd_t *__real_get_cmd();
+void __real_motor_set(int16_t pwr_left, int16_t pwr_right);
+uint8_t __real_radio_estop_taken();
+int fw_main();
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* Options */
+uint8_t robot_count = 5;
+uint8_t first_id = ROBOT_ID;
+uint32_t duration = 10000;
+uint32_t baud = 57600;
+double loss = 0.0;
+double ber = 0.0;
+uint8_t coll_model = SIM_COLL_CORRUPT;
+uint32_t gen_period = 0;
+int16_t telem_data[2] = {0, 1};
+uint32_t seed = 1;
+uint8_t use_pty = 0;
+uint16_t tdma_frame = 0;
+uint16_t tdma_down = 0;
+uint16_t tdma_slot = 0;
+uint32_t stop_time = 0;
+uint8_t stop_by_cmd = 0;
+uint32_t switch_time = 0;
+uint32_t switch_baud = 0;
+uint8_t switch_confirm = 1;
+FILE *out = NULL;
+
+/* The robots and the host */
+sim_robot_t robots[SIM_MAX_ROBOTS];
+sim_queue_t host_rx;
+double host_tx_free_us = 0.0;
+
+/* Arrival of the host's last byte at the robots (see sim_deliver) */
+uint32_t host_tx_arrival = 0;
+
+int pty_fd = -1;
+int pty_slave_fd = -1;
+
+/* The host's frames waiting for its slot (-T) */
+sim_down_t down_queue[SIM_DOWN_LEN];
+uint8_t down_count = 0;
+
+/* The robot message the host is receiving */
+char host_line[SIM_LINE_LEN];
+uint16_t host_line_len = 0;
+
+/* The channel */
+sim_air_t air[SIM_AIR_LEN];
+uint16_t air_count = 0;
+double byte_us = 0.0;
+uint32_t rng = 1;
+
+/* Channel statistics (bytes) */
+uint32_t stat_bytes = 0;
+uint32_t stat_collided = 0;
+uint32_t stat_lost = 0;
+uint32_t stat_bit_errors = 0;
+uint32_t stat_down_dropped = 0;
+uint32_t stat_superseded = 0;
+
+/* Arrival of the stop's last byte (-E), 0 - not sent yet */
+uint32_t stop_arrival = 0;
+
+/* Child (robot) process state */
+int child_fd = -1;
+uint32_t child_next_sync = 0;
+sim_queue_t child_rx;
+sim_byte_t child_tx[SIM_TX_LEN];
+uint16_t child_tx_count = 0;
+sim_report_t child_reports[SIM_REPORT_LEN];
+uint16_t child_report_count = 0;
+uint8_t child_moving = 0;
+
+/* How late (us) the last byte was received (the lock step) */
+uint32_t child_rx_lag = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+void usage()
+{
+    fprintf(stderr, "usage: sim_swarm [-n robots] [-i first_id] "
+            "[-d duration_ms] [-b baud] [-l loss] [-e ber] "
+            "[-c none|corrupt|drop] [-g period_ms] [-t signals,decimation] "
+            "[-T frame_ms,down_ms,slot_ms] [-E time_ms[,cmd]] "
+            "[-B time_ms,baud[,noconfirm]] [-s seed] [-o file] [-p]\n");
+    exit(2);
+}
+
+void sim_write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while(len > 0){
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) _exit(1);
+
+        p += n;
+        len -= (size_t) n;
+    }
+}
+
+/**
+ * Read exactly len bytes.
+ *
+ * Returns: 0 or 1 (uint8_t) - 0 if the other end has closed the connection
+ */
+uint8_t sim_read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while(len > 0){
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return 0;
+
+        p += n;
+        len -= (size_t) n;
+    }
+
+    return 1;
+}
+
+/**
+ * Add a byte to a queue.
+ *
+ * Returns: 0 or 1 (uint8_t) - 0 if the queue was full (the byte is lost)
+ */
+uint8_t sim_queue_push(sim_queue_t *queue, uint32_t time_us, uint8_t byte)
+{
+    uint16_t head = (queue->head + 1) & (SIM_QUEUE_LEN-1);
+    if(head == queue->tail) return 0;
+
+    queue->bytes[queue->head].time_us = time_us;
+    queue->bytes[queue->head].byte = byte;
+    queue->head = head;
+
+    return 1;
+}
+
+/**
+ * Robot process: run the firmware. Never returns.
+ *
+ * Parameters:
+ *      robot - sim_robot_t*, The robot
+ *      seed - uint32_t, Random seed of the robot's plant
+ */
+void sim_child(sim_robot_t *robot, uint32_t seed)
+{
+    child_fd = robot->fd;
+    child_next_sync = SIM_SYNC_US;
+
+    sim_robot_id = robot->id;
+    sim_hw_init(seed, 1);
+    sim_radio_tx_hook = sim_child_tx;
+    sim_step_hook = sim_child_step;
+
+    fw_main();
+    _exit(0);
+}
+
+/* Robot process: a byte was transmitted */
+void sim_child_tx(uint32_t time_us, uint8_t byte)
+{
+    if(child_tx_count >= SIM_TX_LEN) return;
+
+    child_tx[child_tx_count].time_us = time_us;
+    child_tx[child_tx_count].byte = byte;
+    child_tx_count++;
+}
+
+/* Robot process: get_cmd is wrapped (-Wl,--wrap=get_cmd) to report it */
+cmd_t *__wrap_get_cmd()
+{
+    cmd_t *new_cmd = __real_get_cmd();
+
+    if(new_cmd != NULL && child_report_count < SIM_REPORT_LEN){
+        sim_report_t *report = &child_reports[child_report_count++];
+        report->time_us = sim_time_us();
+        report->type = new_cmd->type;
+        report->data[0] = new_cmd->data[0];
+        report->data[1] = new_cmd->data[1];
+    }
+
+    return new_cmd;
+}
+
+/* Robot process: radio_estop_taken is wrapped to report the stop */
+uint8_t __wrap_radio_estop_taken()
+{
+    uint8_t estop = __real_radio_estop_taken();
+
+    if(estop && child_report_count < SIM_REPORT_LEN){
+        sim_report_t *report = &child_reports[child_report_count++];
+        report->time_us = sim_time_us();
+        report->type = SIM_REPORT_ESTOP;
+    }
+
+    return estop;
+}
+
+/* Robot process: motor_set is wrapped (-Wl,--wrap=motor_set) to report it */
+void __wrap_motor_set(int16_t pwr_left, int16_t pwr_right)
+{
+    __real_motor_set(pwr_left, pwr_right);
+
+    uint8_t moving = (pwr_left != 0 || pwr_right != 0);
+    if(moving == child_moving || child_report_count >= SIM_REPORT_LEN) return;
+    child_moving = moving;
+
+    /* In the channel's time - the lock step does not count */
+    sim_report_t *report = &child_reports[child_report_count++];
+    report->time_us = sim_time_us() - child_rx_lag;
+    report->type = SIM_REPORT_MOTORS;
+    report->data[0] = pwr_left;
+    report->data[1] = pwr_right;
+}
+
+/**
+ * Robot process: after every plant step - receive the bytes that have
+ * arrived and sync with the parent process.
+ */
+void sim_child_step()
+{
+    uint32_t now = sim_time_us();
+
+    while(child_rx.tail != child_rx.head &&
+            child_rx.bytes[child_rx.tail].time_us <= now){
+        child_rx_lag = now - child_rx.bytes[child_rx.tail].time_us;
+        sim_radio_rx(child_rx.bytes[child_rx.tail].byte);
+        child_rx.tail = (child_rx.tail + 1) & (SIM_QUEUE_LEN-1);
+    }
+
+    if(now < child_next_sync) return;
+    child_next_sync += SIM_SYNC_US;
+
+    sim_sync_t sync = {
+        .time_us = now,
+        .tx_count = child_tx_count,
+        .report_count = child_report_count,
+        .rx_overruns = (uint16_t) (sim_rx_overruns + radio_get_rx_overruns()),
+        .link = *get_cmd_stats(),
+        .baud = sim_baud == sim_xbee_baud ? sim_baud : 0
+    };
+    sim_write_all(child_fd, &sync, sizeof(sync));
+    sim_write_all(child_fd, child_tx, child_tx_count*sizeof(sim_byte_t));
+    sim_write_all(child_fd, child_reports,
+            child_report_count*sizeof(sim_report_t));
+    child_tx_count = 0;
+    child_report_count = 0;
+
+    /* The bytes arriving during the next period */
+    uint16_t rx_count;
+    if(!sim_read_all(child_fd, &rx_count, sizeof(rx_count))) _exit(0);
+
+    uint16_t i = 0;
+    for(; i < rx_count; i++){
+        sim_byte_t byte;
+        if(!sim_read_all(child_fd, &byte, sizeof(byte))) _exit(0);
+        sim_queue_push(&child_rx, byte.time_us, byte.byte);
+    }
+}
+
+/**
+ * Put a byte on the air (the air is kept sorted by time).
+ *
+ * Parameters:
+ *      time_us - uint32_t, Time when the byte starts
+ *      byte - uint8_t, The byte
+ *      sender - uint8_t, Robot index or SIM_HOST
+ */
+void sim_air_add(uint32_t time_us, uint8_t byte, uint8_t sender)
+{
+    if(air_count >= SIM_AIR_LEN){
+        stat_lost++;
+        return;
+    }
+
+    uint16_t i = air_count;
+    while(i > 0 && air[i-1].time_us > time_us){
+        air[i] = air[i-1];
+        i--;
+    }
+
+    air[i].time_us = time_us;
+    air[i].byte = byte;
+    air[i].sender = sender;
+    air[i].resolved = 0;
+    air_count++;
+}
+
+/**
+ * Deliver the bytes on the air that nothing unknown can collide with any
+ * more (everything up to end_us is known).
+ *
+ * Parameters: end_us - uint32_t, Current time
+ */
+void sim_air_resolve(uint32_t end_us)
+{
+    uint16_t i = 0;
+    for(; i < air_count; i++){
+        if(air[i].resolved) continue;
+        if(air[i].time_us + byte_us > end_us) break;
+
+        uint8_t collided = 0;
+        uint16_t j = i;
+        while(j > 0 && air[i].time_us - air[j-1].time_us < byte_us){
+            j--;
+            if(air[j].sender != air[i].sender) collided = 1;
+        }
+        for(j = i+1; j < air_count &&
+                air[j].time_us - air[i].time_us < byte_us; j++){
+            if(air[j].sender != air[i].sender) collided = 1;
+        }
+
+        sim_deliver(&air[i], collided);
+        air[i].resolved = 1;
+    }
+
+    /* Forget the bytes that cannot collide with anything any more */
+    i = 0;
+    while(i < air_count && air[i].resolved &&
+            air[i].time_us + 2*byte_us < end_us){
+        i++;
+    }
+    memmove(air, air+i, (air_count-i)*sizeof(sim_air_t));
+    air_count -= i;
+}
+
+/**
+ * Deliver a byte to everyone but the sender (with loss and bit errors).
+ *
+ * Parameters:
+ *      byte - sim_air_t*, The byte
+ *      collided - uint8_t, 1 if the byte collided with another one
+ */
+void sim_deliver(sim_air_t *byte, uint8_t collided)
+{
+    uint8_t value = byte->byte;
+    uint32_t arrival = (uint32_t) (byte->time_us + byte_us);
+
+    stat_bytes++;
+    if(collided && coll_model != SIM_COLL_NONE){
+        stat_collided++;
+        if(coll_model == SIM_COLL_DROP) return;
+
+        value = (uint8_t) (sim_rand(&rng)*128 + 128);
+    }
+
+    uint8_t i = 0;
+    for(; i <= robot_count; i++){
+        uint8_t receiver = (i == robot_count) ? SIM_HOST : i;
+        if(receiver == byte->sender) continue;
+
+        if(loss > 0.0 && (sim_rand(&rng)+1)/2 < loss){
+            stat_lost++;
+            continue;
+        }
+
+        uint8_t received = value;
+        if(ber > 0.0){
+            uint8_t bit = 0;
+            for(; bit < 8; bit++){
+                if((sim_rand(&rng)+1)/2 < ber) received ^= (uint8_t) (1 << bit);
+            }
+            if(received != value) stat_bit_errors++;
+        }
+
+        sim_queue_t *queue = (receiver == SIM_HOST) ? &host_rx :
+            &robots[receiver].rx;
+        if(!sim_queue_push(queue, arrival, received)) stat_lost++;
+    }
+}
+
+/**
+ * Send bytes from the host (back to back at the channel baud rate).
+ *
+ * Parameters:
+ *      data - string, The bytes
+ *      len - uint16_t, Number of bytes
+ *      now_us - uint32_t, Current time
+ */
+void sim_host_send(const char *data, uint16_t len, uint32_t now_us)
+{
+    if(host_tx_free_us < now_us) host_tx_free_us = now_us;
+
+    uint16_t i = 0;
+    for(; i < len; i++){
+        sim_air_add((uint32_t) host_tx_free_us, (uint8_t) data[i], SIM_HOST);
+        host_tx_arrival = (uint32_t) ((uint32_t) host_tx_free_us + byte_us);
+        host_tx_free_us += byte_us;
+    }
+}
+
+/**
+ * Make a camera -> robot frame (see get_cmd in cmd_control.c), ending with
+ * SIM_RADIO_END.
+ *
+ * Returns: uint16_t, frame length
+ */
+uint16_t sim_make_frame(char *buf, uint8_t id, uint8_t type, int16_t *data,
+        uint8_t data_len)
+{
+    char data_str[SIM_FRAME_LEN/2] = "";
+    uint16_t len = 0;
+
+    uint8_t i = 0;
+    for(; i < data_len; i++){
+        len += (uint16_t) sprintf(data_str+len, "%s%s%X", i > 0 ? "," : "",
+                data[i] < 0 ? "-" : "", abs(data[i]));
+    }
+
+    len = (uint16_t) sprintf(buf, CMDC_PREAMBLE "%02X%02X%02X%s", id, type,
+            len, data_str);
+
+    uint16_t sum = 0;
+    for(i = 0; i+4 < len; i++){
+        sum += (uint8_t) buf[i+4];
+    }
+
+    return (uint16_t) (len + sprintf(buf+len, "%02X%c", sum % 255,
+                SIM_RADIO_END));
+}
+
+/**
+ * Send a frame (see sim_make_frame) from the host - right away, or with
+ * slots (-T) in the host's next slot.
+ *
+ * Parameters:
+ *      frame - string, The frame (ending with SIM_RADIO_END)
+ *      len - uint16_t, Frame length
+ *      id - uint8_t, The robot ID in the frame
+ *      priority - uint8_t, See sim_prio_enum
+ *      now_us - uint32_t, Current time
+ */
+void sim_host_queue(const char *frame, uint16_t len, uint8_t id,
+        uint8_t priority, uint32_t now_us)
+{
+    if(tdma_frame == 0){
+        sim_host_send(frame, len, now_us);
+        return;
+    }
+
+    if(len > SIM_FRAME_LEN){
+        stat_down_dropped++;
+        return;
+    }
+
+    /* A new command replaces the robot's command that is still waiting */
+    sim_down_t *down = NULL;
+    uint8_t i = 0;
+    for(; priority == SIM_PRIO_CMD && i < down_count; i++){
+        if(down_queue[i].id == id && down_queue[i].priority == priority){
+            down = &down_queue[i];
+            stat_superseded++;
+            break;
+        }
+    }
+
+    if(down == NULL){
+        if(down_count == SIM_DOWN_LEN){
+            stat_down_dropped++;
+            return;
+        }
+
+        down = &down_queue[down_count++];
+        down->waited = 0;
+    }
+
+    down->id = id;
+    down->priority = priority;
+    down->len = len;
+    memcpy(down->frame, frame, len);
+}
+
+/**
+ * The host's slot (-T): the beacon and then one radio string of the waiting
+ * frames (the robot parses a string at a time, see get_cmd). The string has
+ * at most one frame per robot (a broadcast is alone) and must be sent by the
+ * end of the slot, the rest waits for the next frame. The frames go in the
+ * order of priority, but the ones that have waited SIM_MAX_WAIT frames
+ * first.
+ *
+ * Parameters: now_us - uint32_t, Start of the frame
+ */
+void sim_tdma_frame(uint32_t now_us)
+{
+    char frame[SIM_FRAME_LEN];
+    int16_t data[1] = {(int16_t) tdma_frame};
+    uint16_t len = sim_make_frame(frame, 0xFF, CMD_SYNC, data, 1);
+    sim_host_send(frame, len, now_us);
+    host_tx_free_us += SIM_TDMA_GAP*1000;
+
+    double slot_end = now_us + tdma_down*1000.0;
+    char string[SIM_STRING_LEN];
+    uint16_t string_len = 0;
+    uint8_t taken[SIM_DOWN_LEN] = {0};
+    uint8_t ids[SIM_DOWN_LEN];
+    uint8_t id_count = 0;
+
+    /* Pass 0 - the frames that have waited too long, then by priority */
+    uint8_t pass = 0;
+    for(; pass <= SIM_PRIO_COUNT; pass++){
+        uint8_t i = 0;
+        for(; i < down_count; i++){
+            sim_down_t *down = &down_queue[i];
+            if(taken[i] || (pass == 0 && down->waited < SIM_MAX_WAIT) ||
+                    (pass > 0 && down->priority != pass-1)){
+                continue;
+            }
+
+            /* One frame per robot, the broadcasts alone */
+            uint8_t j = 0;
+            while(j < id_count && ids[j] != down->id) j++;
+            if(j < id_count || (id_count > 0 && (down->id == 0xFF ||
+                            ids[0] == 0xFF))){
+                continue;
+            }
+
+            /* Separator, the frame without its end letter, the end letter */
+            uint16_t new_len = (uint16_t) (string_len + (string_len > 0) +
+                    down->len);
+            if(new_len > SIM_STRING_LEN ||
+                    host_tx_free_us + new_len*byte_us > slot_end){
+                continue;
+            }
+
+            if(string_len > 0) string[string_len++] = ' ';
+            memcpy(string+string_len, down->frame, down->len-1);
+            string_len = (uint16_t) (string_len + down->len-1);
+            ids[id_count++] = down->id;
+            taken[i] = 1;
+        }
+    }
+
+    if(string_len > 0){
+        string[string_len++] = SIM_RADIO_END;
+        sim_host_send(string, string_len, now_us);
+    }
+
+    /* Remove the sent frames */
+    uint8_t left = 0;
+    uint8_t i = 0;
+    for(; i < down_count; i++){
+        if(taken[i]) continue;
+
+        if(down_queue[i].waited < UINT8_MAX) down_queue[i].waited++;
+        down_queue[left++] = down_queue[i];
+    }
+    down_count = left;
+}
+
+/**
+ * A byte the host received: count the valid robot messages (see make_msg in
+ * cmd_control.c) of every robot and take the replies to the baud rate switch
+ * (-B).
+ *
+ * Parameters:
+ *      byte - uint8_t, The byte
+ *      time_us - uint32_t, Arrival time
+ */
+void sim_host_rx(uint8_t byte, uint32_t time_us)
+{
+    if(byte != '\n'){
+        if(byte != '\r' && host_line_len < SIM_LINE_LEN-1){
+            host_line[host_line_len++] = (char) byte;
+        }
+        return;
+    }
+
+    /* The message starts at its preamble */
+    host_line[host_line_len] = 0;
+    char *msg = strstr(host_line, CMDC_PREAMBLE);
+    uint16_t len = msg != NULL ? (uint16_t) strlen(msg) : 0;
+    host_line_len = 0;
+    if(len < CMDC_MIN_BUF_LEN) return;
+
+    uint16_t sum = 0;
+    uint16_t i = OFFSET_ID;
+    for(; i+2 < len; i++){
+        sum += (uint8_t) msg[i];
+    }
+
+    char *end;
+    if(strtoul(msg+len-2, &end, 16) != sum % 255 || *end != 0) return;
+
+    char id_str[3] = {msg[OFFSET_ID], msg[OFFSET_ID+1], 0};
+    char type_str[3] = {msg[OFFSET_TYPE], msg[OFFSET_TYPE+1], 0};
+    uint8_t id = (uint8_t) strtoul(id_str, NULL, 16);
+    for(i = 0; i < robot_count; i++){
+        if(robots[i].id != id) continue;
+
+        robots[i].uplink++;
+        if(strtoul(type_str, NULL, 16) == CMD_BAUD){
+            msg[len-2] = 0;
+            sim_host_baud_reply(&robots[i], msg+OFFSET_DATA, time_us);
+        }
+    }
+}
+
+/**
+ * The host's side of a robot's baud rate switch (-B), every lock step.
+ *
+ * Parameters:
+ *      robot - sim_robot_t*, The robot
+ *      robot_index - uint8_t, Index of the robot (for the stagger)
+ *      now_us - uint32_t, Current time
+ */
+void sim_host_baud(sim_robot_t *robot, uint8_t robot_index, uint32_t now_us)
+{
+    char frame[SIM_FRAME_LEN];
+    int16_t data[2] = {(int16_t) (switch_baud/100), BAUDC_PROPOSE};
+    uint32_t now_ms = now_us / 1000;
+
+    if(robot->baud_state == SIM_BAUD_IDLE){
+        if(now_ms < switch_time + robot_index*SIM_BAUD_STAGGER) return;
+
+        robot->baud_state = SIM_BAUD_PROPOSED;
+        robot->baud_start = now_us;
+    }else if(robot->baud_state == SIM_BAUD_DONE ||
+            now_us - robot->baud_sent < SIM_BAUD_RETRY*1000){
+        return;
+    }else if(now_us - robot->baud_start >=
+            (2*SIM_BAUD_WAIT + BAUDC_TIMEOUT)*1000){
+        /* The robot has fallen back by now (or never got the proposal) */
+        robot->baud_state = SIM_BAUD_DONE;
+        return;
+    }else if(now_us - robot->baud_start >= SIM_BAUD_WAIT*1000){
+        /* Also without the reply - it could have been lost */
+        if(!switch_confirm) return;
+        data[1] = BAUDC_CONFIRM;
+    }else if(robot->baud_state == SIM_BAUD_SWITCHING){
+        return;
+    }
+
+    uint16_t len = sim_make_frame(frame, robot->id, CMD_BAUD, data, 2);
+    sim_host_send(frame, len, now_us);
+    robot->baud_sent = now_us;
+}
+
+/**
+ * A robot's CMD_BAUD reply (see baud_control.c).
+ *
+ * Parameters:
+ *      robot - sim_robot_t*, The robot
+ *      args - string, The arguments (rate/100,reply)
+ *      time_us - uint32_t, Arrival time
+ */
+void sim_host_baud_reply(sim_robot_t *robot, char *args, uint32_t time_us)
+{
+    char *end;
+    uint32_t rate = (uint32_t) strtoul(args, &end, 16)*100;
+    if(*end != ARG_DELIM) return;
+    uint8_t reply = (uint8_t) strtoul(end+1, NULL, 16);
+
+    if(robot->baud_state == SIM_BAUD_IDLE ||
+            robot->baud_state == SIM_BAUD_DONE){
+        return;
+    }
+
+    if(reply == BAUDC_REPLY_SWITCHING){
+        robot->baud_state = SIM_BAUD_SWITCHING;
+    }else{
+        /* At the new rate, fallen back to the old one or refused */
+        robot->baud_state = SIM_BAUD_DONE;
+        if(rate == switch_baud && reply == BAUDC_REPLY_DONE){
+            robot->baud_done = time_us - robot->baud_start;
+        }
+    }
+}
+
+/**
+ * Match a command the robot received to the generated ones.
+ *
+ * Parameters:
+ *      robot - sim_robot_t*, The robot
+ *      report - sim_report_t*, The received command
+ */
+void sim_report(sim_robot_t *robot, sim_report_t *report)
+{
+    if(report->type == SIM_REPORT_MOTORS){
+        sim_report_motors(robot, report);
+        return;
+    }
+    if(stop_arrival != 0 && (report->type == SIM_REPORT_ESTOP ||
+                (stop_by_cmd && report->type == CMD_END))){
+        robot->stop_received = 1;
+        return;
+    }
+    if(report->type != CMD_DRIVE) return;
+
+    uint8_t i = 0;
+    for(; i < robot->sent_count; i++){
+        sim_sent_t *sent = &robot->sent[(robot->sent_head + i) &
+            (SIM_SENT_LEN-1)];
+        if(sent->data[0] != report->data[0] ||
+                sent->data[1] != report->data[1]){
+            continue;
+        }
+
+        uint32_t latency = report->time_us - sent->time_us;
+        robot->delivered++;
+        robot->latency_sum += latency;
+        if(latency > robot->latency_max) robot->latency_max = latency;
+
+        /* The older ones did not arrive */
+        robot->sent_head = (uint8_t) ((robot->sent_head + i+1) &
+                (SIM_SENT_LEN-1));
+        robot->sent_count = (uint8_t) (robot->sent_count - (i+1));
+        return;
+    }
+}
+
+/**
+ * The robot's motors started or stopped: the stop's task wait (-E).
+ *
+ * Parameters:
+ *      robot - sim_robot_t*, The robot
+ *      report - sim_report_t*, The report (SIM_REPORT_MOTORS)
+ */
+void sim_report_motors(sim_robot_t *robot, sim_report_t *report)
+{
+    uint8_t moving = (report->data[0] != 0 || report->data[1] != 0);
+
+    /* The last stop counts (an older command can run in between) */
+    if(stop_arrival != 0 && report->time_us >= stop_arrival){
+        if(moving){
+            robot->restarts++;
+        }else if(robot->moving){
+            robot->stop = SIM_STOP_STOPPED;
+            robot->stop_wait = report->time_us - stop_arrival;
+        }
+    }
+
+    robot->moving = moving;
+}
+
+/**
+ * Open the host's pty (raw, non-blocking).
+ */
+void sim_pty_open()
+{
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(pty_fd < 0 || grantpt(pty_fd) != 0 || unlockpt(pty_fd) != 0){
+        perror("pty");
+        exit(1);
+    }
+
+    /* Keep the slave side open, so the pty lives when the client closes */
+    char *name = ptsname(pty_fd);
+    pty_slave_fd = open(name, O_RDWR | O_NOCTTY);
+
+    struct termios tio;
+    tcgetattr(pty_slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(pty_slave_fd, TCSANOW, &tio);
+
+    fcntl(pty_fd, F_SETFL, fcntl(pty_fd, F_GETFL) | O_NONBLOCK);
+    fprintf(stderr, "radio: %s\n", name);
+}
+
+void sim_print_stats()
+{
+    fprintf(out, "robot,id,cmds,delivered,ratio,latency_avg_ms,"
+            "latency_max_ms,rx_overruns,uplink\n");
+
+    uint32_t latency_max = 0;
+    uint8_t i = 0;
+    for(; i < robot_count; i++){
+        sim_robot_t *robot = &robots[i];
+        double avg = robot->delivered ?
+            robot->latency_sum / 1000.0 / robot->delivered : 0.0;
+        if(robot->latency_max > latency_max) latency_max = robot->latency_max;
+
+        fprintf(out, "%u,0x%02X,%u,%u,%.3f,%.2f,%.2f,%u,%u\n", i, robot->id,
+                robot->cmds, robot->delivered,
+                robot->cmds ? (double) robot->delivered / robot->cmds : 0.0,
+                avg, robot->latency_max / 1000.0, robot->rx_overruns,
+                robot->uplink);
+    }
+
+    fprintf(out, "channel: bytes %u, collided %u, lost %u, bit errors %u\n",
+            stat_bytes, stat_collided, stat_lost, stat_bit_errors);
+    fprintf(out, "utilization: %.1f%% (collided %.1f%%), worst latency "
+            "%.2f ms, host superseded %u, dropped %u\n",
+            100.0 * stat_bytes * byte_us / (duration*1000.0),
+            100.0 * stat_collided * byte_us / (duration*1000.0),
+            latency_max / 1000.0, stat_superseded, stat_down_dropped);
+
+    /* The robots' own count of the messages (QUERY_RADIO) */
+    uint32_t accepted = 0, foreign = 0, dropped[CMDC_DROP_COUNT] = {0};
+    for(i = 0; i < robot_count; i++){
+        accepted += robots[i].link.accepted;
+        foreign += robots[i].link.foreign;
+        uint8_t j = 0;
+        for(; j < CMDC_DROP_COUNT; j++) dropped[j] += robots[i].link.dropped[j];
+    }
+    fprintf(out, "robots: accepted %u, other %u, dropped short %u, "
+            "preamble %u, len %u, checksum %u, type %u, data %u\n",
+            accepted, foreign, dropped[CMDC_DROP_SHORT],
+            dropped[CMDC_DROP_PREAMBLE], dropped[CMDC_DROP_LEN],
+            dropped[CMDC_DROP_CHECKSUM], dropped[CMDC_DROP_TYPE],
+            dropped[CMDC_DROP_DATA]);
+
+    if(switch_time != 0){
+        /* Where the robots ended up (0 - the robot's and its XBee's rates
+         * differ, the robot is lost) */
+        uint8_t switched = 0, old = 0, lost = 0;
+        uint32_t done_sum = 0, done_max = 0;
+        for(i = 0; i < robot_count; i++){
+            sim_robot_t *robot = &robots[i];
+            if(robot->baud == switch_baud){
+                switched++;
+                done_sum += robot->baud_done;
+                if(robot->baud_done > done_max) done_max = robot->baud_done;
+            }else if(robot->baud == 0){
+                lost++;
+            }else{
+                old++;
+            }
+        }
+
+        fprintf(out, "baud (%u%s): switched %u, at the old rate %u, lost %u, "
+                "switch time avg %.0f ms, max %.0f ms\n", switch_baud,
+                switch_confirm ? "" : ", not confirmed", switched, old, lost,
+                switched ? done_sum / 1000.0 / switched : 0.0,
+                done_max / 1000.0);
+    }
+
+    if(stop_time == 0) return;
+
+    /*
+     * A robot that was not moving at the stop has nothing to stop. A robot
+     * that did not get the stop stops at the end of its command.
+     */
+    uint8_t received = 0, stopped = 0, running = 0;
+    uint16_t restarts = 0;
+    uint32_t stop_sum = 0, stop_max = 0;
+    for(i = 0; i < robot_count; i++){
+        sim_robot_t *robot = &robots[i];
+        restarts = (uint16_t) (restarts + robot->restarts);
+        received = (uint8_t) (received + robot->stop_received);
+        if(robot->stop == SIM_STOP_STOPPED){
+            stopped++;
+            stop_sum += robot->stop_wait;
+            if(robot->stop_wait > stop_max) stop_max = robot->stop_wait;
+        }else if(robot->moving){
+            running++;
+        }
+    }
+
+    fprintf(out, "stop (%s): received %u, stopped %u, not stopped %u, "
+            "restarted %u, task wait avg %.3f ms, max %.3f ms (the "
+            "firmware's run time is not simulated)\n",
+            stop_by_cmd ? "CMD_END" : "emergency", received, stopped, running,
+            restarts,
+            stopped ? stop_sum / 1000.0 / stopped : 0.0, stop_max / 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while((opt = getopt(argc, argv, "n:i:d:b:l:e:c:g:t:T:E:B:s:o:p")) != -1){
+        if(opt == 'n'){
+            robot_count = (uint8_t) atoi(optarg);
+        }else if(opt == 'i'){
+            first_id = (uint8_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'd'){
+            duration = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'b'){
+            baud = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'l'){
+            loss = atof(optarg);
+        }else if(opt == 'e'){
+            ber = atof(optarg);
+        }else if(opt == 'c'){
+            if(strcmp(optarg, "none") == 0){
+                coll_model = SIM_COLL_NONE;
+            }else if(strcmp(optarg, "corrupt") == 0){
+                coll_model = SIM_COLL_CORRUPT;
+            }else if(strcmp(optarg, "drop") == 0){
+                coll_model = SIM_COLL_DROP;
+            }else{
+                usage();
+            }
+        }else if(opt == 'g'){
+            gen_period = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 't'){
+            char *end;
+            telem_data[0] = (int16_t) strtol(optarg, &end, 0);
+            if(*end == ',') telem_data[1] = (int16_t) strtol(end+1, NULL, 0);
+        }else if(opt == 'T'){
+            if(sscanf(optarg, "%hu,%hu,%hu", &tdma_frame, &tdma_down,
+                        &tdma_slot) != 3){
+                usage();
+            }
+        }else if(opt == 'E'){
+            char *end;
+            stop_time = (uint32_t) strtoul(optarg, &end, 0);
+            if(strcmp(end, ",cmd") == 0){
+                stop_by_cmd = 1;
+            }else if(*end != 0){
+                usage();
+            }
+        }else if(opt == 'B'){
+            char mode[16] = "";
+            if(sscanf(optarg, "%u,%u,%15s", &switch_time, &switch_baud,
+                        mode) < 2 || switch_time == 0 ||
+                    (mode[0] != 0 && strcmp(mode, "noconfirm") != 0)){
+                usage();
+            }
+            switch_confirm = (mode[0] == 0);
+        }else if(opt == 's'){
+            seed = (uint32_t) strtoul(optarg, NULL, 0);
+        }else if(opt == 'o'){
+            out = fopen(optarg, "w");
+            if(out == NULL){
+                perror(optarg);
+                return 1;
+            }
+        }else if(opt == 'p'){
+            use_pty = 1;
+        }else{
+            usage();
+        }
+    }
+
+    if(optind != argc || robot_count == 0 || robot_count > SIM_MAX_ROBOTS ||
+            baud == 0){
+        usage();
+    }
+    if(tdma_frame != 0 && (tdma_slot == 0 ||
+                tdma_down + robot_count*tdma_slot > tdma_frame)){
+        fprintf(stderr, "sim_swarm: the slots do not fit into the frame\n");
+        return 2;
+    }
+    if(tdma_frame != 0 && switch_time != 0){
+        fprintf(stderr, "sim_swarm: -B drops the slots, it cannot be used "
+                "with -T\n");
+        return 2;
+    }
+    if(out == NULL) out = stdout;
+
+    rng = (seed == 0) ? 1 : seed;
+    byte_us = 10e6 / baud;
+    if(use_pty) sim_pty_open();
+
+    /* Start the robots */
+    uint8_t i = 0;
+    for(; i < robot_count; i++){
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0){
+            perror("socketpair");
+            return 1;
+        }
+
+        robots[i].id = (uint8_t) (first_id + i);
+        fflush(stdout);
+
+        pid_t pid = fork();
+        if(pid == 0){
+            /* Only this robot's socket, so the robot sees the parent exit */
+            uint8_t j = 0;
+            for(; j < i; j++){
+                close(robots[j].fd);
+            }
+            close(fds[0]);
+            robots[i].fd = fds[1];
+            sim_child(&robots[i], seed*SIM_MAX_ROBOTS + i);
+        }
+
+        close(fds[1]);
+        robots[i].pid = pid;
+        robots[i].fd = fds[0];
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint32_t gen_next = SIM_BOOT_TIME;
+    uint8_t gen_robot = 0;
+    uint32_t now = 0;
+
+    while(duration == 0 || now < duration*1000){
+        now += SIM_SYNC_US;
+
+        /* Robots */
+        for(i = 0; i < robot_count; i++){
+            sim_robot_t *robot = &robots[i];
+            sim_sync_t sync;
+            if(!sim_read_all(robot->fd, &sync, sizeof(sync))){
+                int status = 0;
+                waitpid(robot->pid, &status, 0);
+                fprintf(stderr, "robot 0x%02X has stopped at %u ms (%s %d)\n",
+                        robot->id, now / 1000, WIFSIGNALED(status) ?
+                        "signal" : "exit", WIFSIGNALED(status) ?
+                        WTERMSIG(status) : WEXITSTATUS(status));
+                return 1;
+            }
+            robot->rx_overruns = sync.rx_overruns;
+            robot->link = sync.link;
+            robot->baud = sync.baud;
+
+            uint16_t j = 0;
+            for(; j < sync.tx_count; j++){
+                sim_byte_t byte;
+                sim_read_all(robot->fd, &byte, sizeof(byte));
+                sim_air_add(byte.time_us, byte.byte, i);
+            }
+            for(j = 0; j < sync.report_count; j++){
+                sim_report_t report;
+                sim_read_all(robot->fd, &report, sizeof(report));
+                sim_report(robot, &report);
+            }
+        }
+
+        /* Host */
+        char frame[SIM_FRAME_LEN];
+        if(now == SIM_BOOT_TIME*1000){
+            /* The slots: the host's first, then the robots' in order */
+            for(i = 0; tdma_frame != 0 && i < robot_count; i++){
+                int16_t slot[2] = {(int16_t) (tdma_down + i*tdma_slot),
+                    (int16_t) tdma_slot};
+                uint16_t len = sim_make_frame(frame, robots[i].id, CMD_SLOT,
+                        slot, 2);
+                sim_host_queue(frame, len, robots[i].id, SIM_PRIO_CONFIG,
+                        now);
+            }
+
+            if(telem_data[0] != 0){
+                uint16_t len = sim_make_frame(frame, 0xFF, CMD_TELEM,
+                        telem_data, 2);
+                sim_host_queue(frame, len, 0xFF, SIM_PRIO_CONFIG, now);
+            }
+        }
+
+        uint32_t now_ms = now / 1000;
+        sim_robot_t *robot = NULL;
+        if(gen_period > 0 && now_ms >= gen_next &&
+                (duration == 0 || now_ms + SIM_DRAIN < duration) &&
+                (stop_time == 0 || now_ms < stop_time)){
+            robot = &robots[gen_robot];
+            gen_robot = (uint8_t) ((gen_robot + 1) % robot_count);
+            gen_next += gen_period;
+
+            /* A robot that is switching its baud rate misses its turn */
+            if(robot->baud_state == SIM_BAUD_PROPOSED ||
+                    robot->baud_state == SIM_BAUD_SWITCHING){
+                robot = NULL;
+            }
+        }
+        if(robot != NULL){
+            robot->seq = (uint16_t) (robot->seq % SIM_GEN_MAX_MM + 1);
+            int16_t data[2] = {(int16_t) robot->seq, SIM_GEN_PWR};
+            uint16_t len = sim_make_frame(frame, robot->id, CMD_DRIVE, data,
+                    2);
+
+            if(robot->sent_count == SIM_SENT_LEN){
+                robot->sent_head = (robot->sent_head + 1) & (SIM_SENT_LEN-1);
+                robot->sent_count--;
+            }
+            sim_sent_t *sent = &robot->sent[(robot->sent_head +
+                    robot->sent_count) & (SIM_SENT_LEN-1)];
+            sent->time_us = now;
+            sent->data[0] = data[0];
+            sent->data[1] = data[1];
+            robot->sent_count++;
+            robot->cmds++;
+
+            sim_host_queue(frame, len, robot->id, SIM_PRIO_CMD, now);
+        }
+
+        /* The stop (-E), the arrival is when the last byte has been sent */
+        if(stop_time != 0 && now_ms >= stop_time &&
+                now_ms < stop_time + SIM_STOP_COPIES*SIM_STOP_PERIOD &&
+                (now_ms - stop_time) % SIM_STOP_PERIOD == 0){
+            uint16_t len;
+            if(stop_by_cmd){
+                int16_t data[1] = {0};
+                len = sim_make_frame(frame, 0xFF, CMD_END, data, 1);
+            }else{
+                len = (uint16_t) sprintf(frame, "%c%c%02X%02X",
+                        RADIOC_ESTOP_MARK, RADIOC_ESTOP_MARK,
+                        RADIOC_ESTOP_BROADCAST, 0xFF-RADIOC_ESTOP_BROADCAST);
+            }
+            sim_host_send(frame, len, now);
+            if(stop_arrival == 0) stop_arrival = host_tx_arrival;
+
+            /* The commands still waiting for the host's slot are dropped */
+            down_count = 0;
+        }
+
+        /* The baud rate switch (-B) */
+        for(i = 0; switch_time != 0 && i < robot_count; i++){
+            sim_host_baud(&robots[i], i, now);
+        }
+
+        if(tdma_frame != 0 && now_ms >= SIM_BOOT_TIME && now % 1000 == 0 &&
+                (now_ms - SIM_BOOT_TIME) % tdma_frame == 0){
+            sim_tdma_frame(now);
+        }
+
+        if(pty_fd >= 0){
+            char buf[64];
+            ssize_t n = read(pty_fd, buf, sizeof(buf));
+            if(n > 0) sim_host_send(buf, (uint16_t) n, now);
+        }
+
+        /* Channel */
+        sim_air_resolve(now);
+
+        for(i = 0; i < robot_count; i++){
+            sim_queue_t *queue = &robots[i].rx;
+            uint16_t count = 0;
+            uint16_t tail = queue->tail;
+            while(tail != queue->head &&
+                    queue->bytes[tail].time_us < now + SIM_SYNC_US){
+                count++;
+                tail = (tail + 1) & (SIM_QUEUE_LEN-1);
+            }
+
+            sim_write_all(robots[i].fd, &count, sizeof(count));
+            for(; count > 0; count--){
+                sim_write_all(robots[i].fd, &queue->bytes[queue->tail],
+                        sizeof(sim_byte_t));
+                queue->tail = (queue->tail + 1) & (SIM_QUEUE_LEN-1);
+            }
+        }
+
+        while(host_rx.tail != host_rx.head &&
+                host_rx.bytes[host_rx.tail].time_us < now){
+            sim_host_rx(host_rx.bytes[host_rx.tail].byte,
+                    host_rx.bytes[host_rx.tail].time_us);
+            if(pty_fd >= 0){
+                if(write(pty_fd, &host_rx.bytes[host_rx.tail].byte, 1) != 1){
+                    stat_lost++;
+                }
+            }
+            host_rx.tail = (host_rx.tail + 1) & (SIM_QUEUE_LEN-1);
+        }
+
+        /* With a pty the simulation runs in real time */
+        if(pty_fd >= 0){
+            struct timespec until = start;
+            until.tv_sec += now / 1000000;
+            until.tv_nsec += (long) (now % 1000000) * 1000;
+            if(until.tv_nsec >= 1000000000){
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+        }
+    }
+
+    for(i = 0; i < robot_count; i++){
+        kill(robots[i].pid, SIGKILL);
+        waitpid(robots[i].pid, NULL, 0);
+    }
+
+    sim_print_stats();
+
+    return 0;
+}
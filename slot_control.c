@@ -0,0 +1,141 @@
+/**
+ * Transmit slots (TDMA) on the shared radio channel.
+ *
+ * All the robots and the camera computer share one XBee channel. Without
+ * slots a robot sends whenever it has something to send (telemetry, query
+ * replies), so the robots' messages collide with each other and with the
+ * commands. With slots the channel is divided into frames:
+ *
+ *      | beacon + commands | robot 1 | robot 2 | ... | beacon + commands |
+ *
+ * The camera computer sends the beacon (broadcast CMD_SYNC) at the start of
+ * every frame and its commands right after it. Every robot sends only in
+ * its own slot, which the camera assigns with CMD_SLOT (the times are from
+ * the beacon):
+ *
+ *      CMD_SLOT: start_ms,len_ms (len_ms 0 - no slot, send freely)
+ *      CMD_SYNC: frame_ms
+ *
+ * e.g. 00004508052C,123C gives robot 0x45 the slot 44...62 ms and
+ * 0000FF090264C2G starts a 100 ms frame. The beacon must be alone in
+ * its radio string (ending with G), otherwise it is seen late (a string is
+ * parsed only after its end letter has arrived).
+ *
+ * The messages wait in the transmit buffer (see radio_control.c) until the
+ * slot, and only whole messages that fit into the rest of the slot (minus
+ * SLOTC_GUARD) are sent. A message longer than the whole slot is dropped.
+ * The slot is kept after a lost beacon (the frame length is known), so only
+ * a link that has been gone for SLOTC_MAX_MISSED frames turns the slots off.
+ *
+ * See serial-control/pisibot.py for the camera side and sim/sim_swarm.c (-T)
+ * for the simulation.
+ */
+
+#include "slot_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The slot (ms from the beacon), slot_len 0 - no slot */
+uint16_t slot_start = 0;
+uint16_t slot_len = 0;
+
+/* Frame length (ms) and the time (millis) of the last beacon */
+uint16_t slot_frame = 0;
+uint32_t slot_sync_time = 0;
+
+/* Set when the slots are in use (a beacon has arrived) */
+uint8_t slot_synced = 0;
+
+/* Set while the slot is open */
+uint8_t slot_is_open = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the slots (no slot - the robot sends freely).
+ */
+void slot_control_init()
+{
+    slot_assign(0, 0);
+}
+
+/**
+ * Assign the robot's transmit slot (CMD_SLOT). The slot is used from the
+ * next beacon on.
+ *
+ * Parameters:
+ *      start_ms - int16_t, Start of the slot (ms from the beacon)
+ *      len_ms - int16_t, Length of the slot. NOTE: 0 (or anything not
+ *               longer than SLOTC_GUARD) turns the slots off.
+ */
+void slot_assign(int16_t start_ms, int16_t len_ms)
+{
+    if(start_ms < 0 || len_ms <= SLOTC_GUARD){
+        slot_len = 0;
+        slot_synced = 0;
+        slot_is_open = 0;
+        radio_tx_gate(0);
+        return;
+    }
+
+    slot_start = (uint16_t) start_ms;
+    slot_len = (uint16_t) len_ms;
+}
+
+/**
+ * A beacon (CMD_SYNC) - a new frame starts now.
+ *
+ * Parameters: frame_ms - int16_t, Frame length (ms). NOTE: A frame that does
+ *                        not contain the robot's slot is ignored.
+ */
+void slot_sync(int16_t frame_ms)
+{
+    if(slot_len == 0 || frame_ms < (int32_t) slot_start + slot_len) return;
+
+    slot_frame = (uint16_t) frame_ms;
+    slot_sync_time = millis();
+
+    if(slot_is_open){
+        slot_is_open = 0;
+        radio_tx_hold();
+    }
+
+    if(!slot_synced){
+        slot_synced = 1;
+        radio_tx_gate(1);
+    }
+}
+
+/**
+ * Open and close the slot. Should be called every few ms (the slot opens up
+ * to one period late, see SLOTC_GUARD).
+ */
+void slot_tick()
+{
+    if(!slot_synced) return;
+
+    uint32_t since = millis() - slot_sync_time;
+    if(since >= (uint32_t) slot_frame*SLOTC_MAX_MISSED){
+        /* The beacons have stopped - send freely again */
+        slot_synced = 0;
+        slot_is_open = 0;
+        radio_tx_gate(0);
+        return;
+    }
+
+    uint16_t phase = (uint16_t) (since % slot_frame);
+    uint16_t end = slot_start + slot_len - SLOTC_GUARD;
+
+    if(phase >= slot_start && phase < end){
+        if(!slot_is_open){
+            slot_is_open = 1;
+            uint32_t whole = SLOTC_BYTES(end - slot_start);
+            radio_tx_drop_long((uint8_t) (whole > 255 ? 255 : whole));
+        }
+
+        /* Also the messages queued during the slot */
+        uint32_t budget = SLOTC_BYTES(end - phase);
+        radio_tx_release((uint8_t) (budget > 255 ? 255 : budget));
+    }else if(slot_is_open){
+        slot_is_open = 0;
+        radio_tx_hold();
+    }
+}
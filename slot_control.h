@@ -0,0 +1,35 @@
+#ifndef SLOT_CONTROL_H
+#define SLOT_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include "drivers/board.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "radio_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The robot stops releasing messages SLOTC_GUARD (ms) before the end of its
+ * slot. The beacon is seen up to one parser period (5 ms) late and the slot
+ * task runs every 2 ms, so the slots of two robots can be shifted by that
+ * much.
+ */
+#define SLOTC_GUARD 8
+
+/**
+ * If no beacon has arrived in SLOTC_MAX_MISSED frames, then the robot sends
+ * freely again (e.g. the camera software has been restarted without slots).
+ */
+#define SLOTC_MAX_MISSED 5
+
+/* Bytes sent in ms milliseconds (10 bits per byte) at the current rate */
+#define SLOTC_BYTES(ms) ((uint32_t) (ms)*radio_get_baud()/10000)
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void slot_control_init();
+void slot_assign(int16_t start_ms, int16_t len_ms);
+void slot_sync(int16_t frame_ms);
+void slot_tick();
+
+#endif
@@ -0,0 +1,171 @@
+/**
+ * Cooperative fixed-period task scheduler for the main loop.
+ *
+ * Every task in the task table has its own period, deadline and priority.
+ * task_run() is called from the main loop over and over again; every call
+ * runs at most one task (the most urgent one of the tasks that are ready) and
+ * then returns, so a long task can delay other tasks but never interrupt
+ * them.
+ *
+ * A task is ready when its release time has come (periodic tasks) or when
+ * task_trigger() has been called for it (any task - periodic tasks can also
+ * be triggered early, event tasks with period TASKC_EVENT can only be
+ * triggered).
+ *
+ * NOTE: If a task finishes later than release+deadline, then it counts as an
+ *       overrun. If a periodic task has fallen behind by more than one period,
+ *       then the missed releases are skipped (they are not run in a burst
+ *       later) and that also counts as an overrun.
+ */
+
+#include "task_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The task table (see task_control_init) */
+task_t *task_table = NULL;
+uint8_t task_table_len = 0;
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the scheduler.
+ *
+ * Parameters:
+ *      table - task_t*, The task table. The fn, period, deadline and priority
+ *              fields must be filled in. The table must stay valid for the
+ *              whole program run (should be static).
+ *      task_count - uint8_t, Number of tasks in the table. NOTE: Limited to
+ *                   TASKC_MAX_TASKS (see task_control.h)
+ */
+void task_control_init(task_t *table, uint8_t task_count)
+{
+    if(task_count > TASKC_MAX_TASKS) task_count = TASKC_MAX_TASKS;
+
+    task_table = table;
+    task_table_len = task_count;
+
+    uint32_t now = millis();
+    uint8_t i = 0;
+    for(; i < task_table_len; i++){
+        task_table[i].release = now;
+        task_table[i].pending = 0;
+        task_table[i].runs = 0;
+        task_table[i].overruns = 0;
+    }
+}
+
+/**
+ * Trigger a task - the task will be run as soon as no more urgent task is
+ * ready. Safe to call from an interrupt.
+ *
+ * Parameters: task_id - uint8_t, Index of the task in the task table
+ */
+void task_trigger(uint8_t task_id)
+{
+    if(task_id >= task_table_len) return;
+
+    task_table[task_id].pending = 1;
+}
+
+/**
+ * Get a task from the task table (e.g. for reading its run and overrun
+ * counters).
+ *
+ * Parameters: task_id - uint8_t, Index of the task in the task table
+ *
+ * Returns: pointer to task_t or NULL if there is no such task
+ */
+task_t *task_get(uint8_t task_id)
+{
+    if(task_id >= task_table_len) return NULL;
+
+    return &task_table[task_id];
+}
+
+/**
+ * Run the most urgent ready task (if there is any).
+ *
+ * NOTE: Time differences are calculated as signed values, so the millis()
+ *       wrap-around (after ~49 days) does not break the scheduling.
+ *
+ * Returns: 0 or 1 (uint8_t) - 0 indicating that no task was ready (the caller
+ *          can idle); 1 indicating that a task was run
+ */
+uint8_t task_run()
+{
+    uint32_t now = millis();
+    task_t *task = NULL;
+
+    /* Find the most urgent ready task */
+    uint8_t i = 0;
+    for(; i < task_table_len; i++){
+        task_t *t = &task_table[i];
+
+        uint8_t ready = t->pending;
+        if(t->period != TASKC_EVENT && (int32_t) (now - t->release) >= 0){
+            ready = 1;
+        }
+
+        if(ready && (task == NULL || t->priority < task->priority)){
+            task = t;
+        }
+    }
+
+    if(task == NULL) return 0;
+
+    /* Event triggered runs are released at the moment they are noticed */
+    if(task->pending && (task->period == TASKC_EVENT
+                || (int32_t) (now - task->release) < 0)){
+        task->release = now;
+    }
+    task->pending = 0;
+
+    task->fn();
+    task->runs++;
+
+    uint32_t end = millis();
+    if((end - task->release) > task->deadline && task->overruns < UINT16_MAX){
+        task->overruns++;
+    }
+
+    /* Schedule the next release */
+    if(task->period != TASKC_EVENT){
+        task->release += task->period;
+
+        if((int32_t) (end - task->release) >= (int32_t) task->period){
+            /* Fallen behind by more than a period - skip the missed ones */
+            task->release = end + task->period;
+            if(task->overruns < UINT16_MAX) task->overruns++;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Get the time until the next periodic task release, i.e. how long the caller
+ * can idle (see power_idle in power_control.c). Event triggered tasks can be
+ * triggered at any time by an interrupt, which also wakes the CPU up.
+ *
+ * Returns: uint16_t, time in ms until the next release (0 if some task is
+ *          ready already; UINT16_MAX if there are no periodic tasks)
+ */
+uint16_t task_idle_time()
+{
+    uint32_t now = millis();
+    uint16_t idle_time = UINT16_MAX;
+
+    uint8_t i = 0;
+    for(; i < task_table_len; i++){
+        task_t *t = &task_table[i];
+
+        if(t->pending) return 0;
+        if(t->period == TASKC_EVENT) continue;
+
+        int32_t until_release = (int32_t) (t->release - now);
+        if(until_release <= 0) return 0;
+
+        if(until_release < idle_time) idle_time = (uint16_t) until_release;
+    }
+
+    return idle_time;
+}
@@ -0,0 +1,61 @@
+#ifndef TASK_CONTROL_H
+#define TASK_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <stdlib.h>
+#include "drivers/board.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * Maximum number of tasks in one task table. The table itself lives with the
+ * code that owns the tasks (see main.c), the scheduler only keeps a pointer.
+ */
+#define TASKC_MAX_TASKS 8
+
+/**
+ * Period value for event triggered tasks. Such a task runs only after
+ * task_trigger() has been called for it.
+ */
+#define TASKC_EVENT 0
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * One entry of the task table.
+ *
+ * NOTE: period, deadline and priority are configuration and should be filled
+ *       in the (static) task table initializer. release, pending, runs and
+ *       overruns are the scheduler's bookkeeping and are set up by
+ *       task_control_init.
+ *
+ * Fields:
+ *      fn - the task function
+ *      period - release period in ms (TASKC_EVENT for event triggered tasks)
+ *      deadline - time in ms after the release by which the task must have
+ *                 finished. If the task finishes later, overruns is increased.
+ *      priority - smaller value means more urgent. If several tasks are ready
+ *                 at the same time, the most urgent one runs first.
+ *      release - time (millis) of the next/current release
+ *      pending - set by task_trigger, cleared when the task runs
+ *      runs - how many times the task has run (wraps around)
+ *      overruns - how many times the task missed its deadline (saturates)
+ */
+typedef struct task_struct{
+    void (*fn)(void);
+    uint16_t period;
+    uint16_t deadline;
+    uint8_t priority;
+    uint32_t release;
+    volatile uint8_t pending;
+    uint16_t runs;
+    uint16_t overruns;
+} task_t;
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void task_control_init(task_t *table, uint8_t task_count);
+uint8_t task_run();
+void task_trigger(uint8_t task_id);
+task_t *task_get(uint8_t task_id);
+uint16_t task_idle_time();
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * Telemetry subscriptions.
+ *
+ * The camera computer chooses which signals it wants (see telemc_signal_enum
+ * in telem_control.h) and how often with a CMD_TELEM command:
+ *
+ *      CMD_TELEM: signals,decimation
+ *
+ * Every decimation-th telemetry period (see TELEMC_PERIOD) the robot sends
+ * one message of type CMD_TELEM (in the same format as the commands, see
+ * make_msg in cmd_control.c). The first argument of the message is the
+ * signal mask, the second the time (millis) and then the signals themselves.
+ * Decimation 0 (or no signals) stops the telemetry.
+ *
+ * Example - encoders and PID error (5 = TELEM_ENC | TELEM_PID) every 50 ms
+ * (decimation 5):
+ *      00004505035,5C8
+ * gives messages like this (signals, time, encoders, error, checksum):
+ *      00004505105,1A2B,12C,12A,27A
+ */
+
+#include "telem_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The subscription */
+uint8_t telem_signals = 0;
+uint8_t telem_decimation = 0;
+
+/* Telemetry periods since the last message */
+uint8_t telem_ticks = 0;
+
+/* Message buffer */
+char telem_buf[TELEMC_BUF_LEN];
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize telemetry (no subscription).
+ */
+void telem_control_init()
+{
+    telem_subscribe(0, 0);
+}
+
+/**
+ * Subscribe to telemetry signals (replaces the previous subscription).
+ *
+ * Parameters:
+ *      signals - uint8_t, Signal mask (see telemc_signal_enum)
+ *      decimation - uint8_t, Send a message every decimation-th telemetry
+ *                   period (see TELEMC_PERIOD). 0 stops the telemetry.
+ */
+void telem_subscribe(uint8_t signals, uint8_t decimation)
+{
+    telem_signals = signals;
+    telem_decimation = decimation;
+    telem_ticks = 0;
+}
+
+/**
+ * Telemetry period - send a message if it is time for it. Must be called
+ * every TELEMC_PERIOD.
+ */
+void telem_tick()
+{
+    if(telem_decimation == 0 || telem_signals == 0) return;
+
+    if(++telem_ticks < telem_decimation) return;
+    telem_ticks = 0;
+
+    int32_t data[TELEMC_MAX_ARGS];
+    uint8_t len = 0;
+
+    data[len++] = telem_signals;
+    data[len++] = (int32_t) millis();
+
+    if(telem_signals & TELEM_ENC){
+        data[len++] = -get_left_enc();
+        data[len++] = -get_right_enc();
+    }
+
+    if(telem_signals & TELEM_DIST){
+        data[len++] = get_left_distance_mm();
+        data[len++] = get_right_distance_mm();
+    }
+
+    if(telem_signals & TELEM_PID){
+        data[len++] = error;
+    }
+
+    if(telem_signals & TELEM_PWR){
+        data[len++] = debug_pwr_left;
+        data[len++] = debug_pwr_right;
+    }
+
+    if(telem_signals & TELEM_POSE){
+        data[len++] = get_pose_x_mm();
+        data[len++] = get_pose_y_mm();
+        data[len++] = get_pose_heading_deg();
+    }
+
+    if(telem_signals & TELEM_TIMING){
+        data[len++] = power_get_idle_permille();
+#if PROF_ENABLED
+        data[len++] = prof_get_loop_hz();
+#else
+        data[len++] = 0;
+#endif
+
+        int32_t overruns = 0;
+        uint8_t i = 0;
+        for(; i < TASKC_MAX_TASKS; i++){
+            task_t *task = task_get(i);
+            if(task != NULL) overruns += task->overruns;
+        }
+        data[len++] = overruns;
+    }
+
+    if(telem_signals & TELEM_GYRO){
+        data[len++] = gyro_get_z_mdps();
+    }
+
+    if(telem_signals & TELEM_BATT){
+        data[len++] = batt_get_mv();
+    }
+
+    if(make_msg(telem_buf, TELEMC_BUF_LEN, CMD_TELEM, data, len)){
+        radio_send(telem_buf);
+    }
+}
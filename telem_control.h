@@ -0,0 +1,64 @@
+#ifndef TELEM_CONTROL_H
+#define TELEM_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include "drivers/board.h"
+#include "drivers/motor.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "cmd_control.h"
+#include "batt_control.h"
+#include "drive_control.h"
+#include "gyro_control.h"
+#include "power_control.h"
+#include "prof_control.h"
+#include "radio_control.h"
+#include "task_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The base period (ms) of telemetry - telem_tick should be called with this
+ * period. The decimation of the subscription is in these periods.
+ */
+#define TELEMC_PERIOD 10
+
+/* Buffer for one telemetry message (see make_msg in cmd_control.c) */
+#define TELEMC_BUF_LEN 180
+
+/* The maximum number of arguments in one telemetry message */
+#define TELEMC_MAX_ARGS 17
+
+/* ENUMS --------------------------------------------------------------------*/
+/**
+ * The telemetry signals (bits of the subscription mask). The signals are in
+ * the message in the same order as the bits here:
+ *      TELEM_ENC - left and right encoder (clicks)
+ *      TELEM_DIST - left and right distance (mm)
+ *      TELEM_PID - PID control error (clicks)
+ *      TELEM_PWR - left and right PID controlled power
+ *      TELEM_POSE - x (mm), y (mm), heading (deg) (see update_pose)
+ *      TELEM_TIMING - idle time (per mille), main loop frequency (Hz, only
+ *                     with PROF_ENABLED) and the sum of all task overruns
+ *      TELEM_GYRO - gyro turning rate (mdeg/s, counter clockwise, see
+ *                   gyro_get_z_mdps)
+ *      TELEM_BATT - battery voltage (mV, see batt_get_mv), 0 if there is no
+ *                   compensation (see batt_get_ok)
+ */
+enum telemc_signal_enum{
+    TELEM_ENC = 0x01,
+    TELEM_DIST = 0x02,
+    TELEM_PID = 0x04,
+    TELEM_PWR = 0x08,
+    TELEM_POSE = 0x10,
+    TELEM_TIMING = 0x20,
+    TELEM_GYRO = 0x40,
+    TELEM_BATT = 0x80
+};
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void telem_control_init();
+void telem_subscribe(uint8_t signals, uint8_t decimation);
+void telem_tick();
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Free-running fine timebase (see TIMERC_TC in timer_control.h).
+ *
+ * millis() is too coarse for measuring things that take microseconds, so
+ * TIMERC_TC just counts at F_CPU/8 and wraps around. Differences of two
+ * timer_ticks() values are correct as long as the measured time is shorter
+ * than the wrap-around time (~16.4 ms).
+ *
+ * The timer's compare channel A is used as a one-shot alarm for waking the
+ * CPU up from sleep (see power_control.c).
+ */
+
+#include "timer_control.h"
+#include "prof_control.h"
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the timebase (start the timer).
+ */
+void timer_control_init()
+{
+    TIMERC_TC.CTRLA = TC_CLKSEL_OFF_gc;
+    TIMERC_TC.CTRLB = TC_WGMODE_NORMAL_gc;
+    TIMERC_TC.INTCTRLA = TC_OVFINTLVL_OFF_gc;
+    TIMERC_TC.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+    TIMERC_TC.PER = 0xFFFF;
+    TIMERC_TC.CNT = 0;
+    TIMERC_TC.CTRLA = TC_CLKSEL_DIV8_gc;
+
+    /* The alarm uses a low level interrupt */
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+}
+
+/**
+ * Get the current timer value.
+ *
+ * NOTE: 16 bit timer registers are read through a shared TEMP register, so
+ *       the read has to be atomic.
+ *
+ * Returns: uint16_t, timer ticks (see TIMERC_TICKS_PER_US)
+ */
+uint16_t timer_ticks()
+{
+    uint16_t ticks;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        ticks = TIMERC_TC.CNT;
+    }
+
+    return ticks;
+}
+
+/**
+ * Set a one-shot alarm - an interrupt that fires when the timer reaches the
+ * given value. The interrupt itself does nothing, it is only used to wake the
+ * CPU up.
+ *
+ * Parameters: ticks - uint16_t, Timer value when the alarm fires (e.g.
+ *                     timer_ticks() + 2*TIMERC_TICKS_PER_MS)
+ */
+void timer_set_alarm(uint16_t ticks)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        TIMERC_TC.CCA = ticks;
+        TIMERC_TC.INTFLAGS = TC0_CCAIF_bm;
+        TIMERC_TC.INTCTRLB = TC_CCAINTLVL_LO_gc;
+    }
+}
+
+/**
+ * Alarm interrupt - disarm the alarm (one-shot).
+ */
+ISR(TIMERC_CCA_vect)
+{
+    PROF_ISR_BEGIN();
+
+    TIMERC_TC.INTCTRLB = TC_CCAINTLVL_OFF_gc;
+
+    PROF_ISR_END(PROF_ISR_TIMER);
+}
@@ -0,0 +1,37 @@
+#ifndef TIMER_CONTROL_H
+#define TIMER_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * The timer/counter used as free-running fine timebase. It must not be used
+ * by the drivers (motors, encoders and millis use their own timers).
+ */
+#define TIMERC_TC TCE0
+#define TIMERC_CCA_vect TCE0_CCA_vect
+#define TIMERC_OVF_vect TCE0_OVF_vect
+
+/**
+ * Timer ticks per microsecond. The timer runs at F_CPU/8 = 4 MHz, so one tick
+ * is 0.25 us (8 CPU cycles) and the 16 bit counter wraps around after
+ * ~16.4 ms.
+ */
+#define TIMERC_TICKS_PER_US 4
+
+/* Timer ticks per millisecond */
+#define TIMERC_TICKS_PER_MS (1000*TIMERC_TICKS_PER_US)
+
+/* Timer overflow (wrap-around) period in us */
+#define TIMERC_OVF_US (65536UL/TIMERC_TICKS_PER_US)
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void timer_control_init();
+uint16_t timer_ticks();
+void timer_set_alarm(uint16_t ticks);
+
+#endif
@@ -0,0 +1,371 @@
+/**
+ * In-RAM flight recorder.
+ *
+ * When armed, every control step is recorded into a ring buffer (see
+ * trace_sample_t in trace_control.h). When one of the chosen triggers fires
+ * (command completion, kill switch, PID error over a threshold or a manual
+ * trigger), post_count more samples are recorded and then the buffer is
+ * frozen, so it holds what happened before and after the trigger. The frozen
+ * buffer can be dumped over the radio afterwards (see
+ * serial-control/trace2csv.py).
+ *
+ * Commands (CMD_TRACE):
+ *      TRACE_ARM: 0,triggers,error_threshold,post_count (the last three
+ *                 are optional, without triggers only TRACE_TRIGGER fires)
+ *      TRACE_TRIGGER: 1
+ *      TRACE_DUMP: 2
+ *      TRACE_STOP: 3
+ *      TRACE_RECORD: 4 (input recording, see below)
+ *
+ * The dump is one header message and then one message per sample (all of
+ * type CMD_TRACE, see make_msg in cmd_control.c):
+ *      header: -1,sample_count,trigger_source,TRACE_MODE_SAMPLES
+ *      sample: index,t,left_enc,right_enc,error,u,pwr_left,pwr_right
+ * The samples are sent oldest first and only as fast as the radio transmit
+ * buffer allows (see trace_dump_step).
+ *
+ * Input recording (TRACE_RECORD) uses the same buffer for a different
+ * thing: everything the firmware gets from the outside - the radio strings
+ * and the encoders of every control step - so that the host can replay it
+ * through the same firmware (see sim/sim_replay.c and
+ * serial-control/record.py). The records (see tracec_rec_enum in
+ * trace_control.h) are written until the buffer is full or TRACE_STOP. The
+ * dump has the same header and then the recorded bytes:
+ *      header: -1,byte_count,0,TRACE_MODE_INPUT
+ *      bytes: offset,bytes,bytes,... (TRACEC_REC_DUMP_BYTES bytes, 3 bytes
+ *             per argument, the first byte lowest)
+ */
+
+#include "trace_control.h"
+
+/* PRIVATE GLOBALS ----------------------------------------------------------*/
+/* The ring buffer: next is where the next sample goes */
+trace_sample_t trace_buf[TRACEC_LEN];
+uint8_t trace_next = 0;
+uint8_t trace_count = 0;
+
+/* State and configuration */
+uint8_t trace_state = TRACE_OFF;
+uint8_t trace_triggers = 0;
+int16_t trace_error_threshold = 0;
+uint8_t trace_post_count = TRACEC_POST_TRIGGER;
+
+/* Samples left to record after the trigger and what triggered */
+uint8_t trace_post_left = 0;
+uint8_t trace_source = 0;
+
+/* What the buffer holds (see tracec_mode_enum) */
+uint8_t trace_mode = TRACE_MODE_SAMPLES;
+
+/**
+ * Input recording: length, time of the last record and the encoders of the
+ * last control step. trace_rec_key is set until the first control step.
+ */
+uint16_t trace_rec_len = 0;
+uint16_t trace_rec_t = 0;
+int16_t trace_rec_left = 0;
+int16_t trace_rec_right = 0;
+uint8_t trace_rec_key = 0;
+uint8_t trace_rec_killed = 0;
+
+/* Dump progress (-1 is the header) */
+int16_t trace_dump_i = TRACEC_NOT_DUMPING;
+char trace_msg_buf[TRACEC_MSG_BUF_LEN];
+
+/* PRIVATE PROTOTYPES -------------------------------------------------------*/
+void trace_rec_step();
+uint8_t *trace_rec_alloc(uint8_t type, uint16_t len);
+
+/* FUNCTIONS ----------------------------------------------------------------*/
+/**
+ * Initialize the flight recorder (not armed).
+ */
+void trace_control_init()
+{
+    trace_stop();
+}
+
+/**
+ * Clear the buffer and start recording.
+ *
+ * Parameters:
+ *      triggers - uint8_t, Trigger mask (see tracec_trigger_enum). The manual
+ *                 trigger works always.
+ *      error_threshold - int16_t, Absolute PID error for TRACE_TRIG_ERROR
+ *      post_count - uint8_t, Samples recorded after the trigger. If 0 or
+ *                   too big, TRACEC_POST_TRIGGER is used.
+ */
+void trace_arm(uint8_t triggers, int16_t error_threshold, uint8_t post_count)
+{
+    if(post_count == 0 || post_count >= TRACEC_LEN){
+        post_count = TRACEC_POST_TRIGGER;
+    }
+
+    trace_triggers = triggers | TRACE_TRIG_MANUAL;
+    trace_error_threshold = abs(error_threshold);
+    trace_post_count = post_count;
+
+    trace_next = 0;
+    trace_count = 0;
+    trace_source = 0;
+    trace_mode = TRACE_MODE_SAMPLES;
+    trace_dump_i = TRACEC_NOT_DUMPING;
+    trace_state = TRACE_ARMED;
+}
+
+/**
+ * Stop recording (the buffer is kept, so it can still be dumped).
+ */
+void trace_stop()
+{
+    trace_state = TRACE_OFF;
+}
+
+/**
+ * Fire a trigger. Ignored if the source is not in the trigger mask (see
+ * trace_arm) or the trace is not armed.
+ *
+ * Parameters: source - uint8_t, The trigger (see tracec_trigger_enum)
+ */
+void trace_trigger(uint8_t source)
+{
+    if(trace_state != TRACE_ARMED || !(trace_triggers & source)) return;
+
+    trace_source = source;
+    trace_post_left = trace_post_count;
+    trace_state = TRACE_TRIGGERED;
+}
+
+/**
+ * Record one sample. Should be called every control step, before the motion
+ * control (see control_task in main.c) - so the sample has the encoders and
+ * the outputs of the previous control step.
+ */
+void trace_record()
+{
+    if(trace_state == TRACE_RECORDING){
+        trace_rec_step();
+        return;
+    }
+    if(trace_state != TRACE_ARMED && trace_state != TRACE_TRIGGERED) return;
+
+    trace_sample_t *sample = &trace_buf[trace_next];
+    sample->t = (uint16_t) millis();
+    sample->left_enc = -get_left_enc();
+    sample->right_enc = -get_right_enc();
+    sample->error = error;
+    sample->u = debug_u;
+    sample->pwr_left = debug_pwr_left;
+    sample->pwr_right = debug_pwr_right;
+
+    if(++trace_next >= TRACEC_LEN) trace_next = 0;
+    if(trace_count < TRACEC_LEN) trace_count++;
+
+    if(trace_state == TRACE_ARMED){
+        if(abs(error) >= trace_error_threshold){
+            trace_trigger(TRACE_TRIG_ERROR);
+        }
+    }else if(--trace_post_left == 0){
+        trace_state = TRACE_FROZEN;
+    }
+}
+
+/**
+ * Start dumping the buffer over the radio. Recording is stopped (if the
+ * trace was not frozen yet).
+ */
+void trace_dump()
+{
+    if(trace_state != TRACE_FROZEN) trace_stop();
+
+    trace_dump_i = -1;
+}
+
+/**
+ * Send the next part of the dump - as many messages as fit into the radio
+ * transmit buffer. Should be called regularly (see telemetry_task in main.c).
+ */
+void trace_dump_step()
+{
+    uint16_t count = trace_count;
+    if(trace_mode == TRACE_MODE_INPUT) count = trace_rec_len;
+
+    while(trace_dump_i < (int16_t) count){
+        int32_t data[8];
+        uint8_t len = 0;
+        uint8_t step = 1;
+
+        if(trace_dump_i < 0){
+            data[len++] = -1;
+            data[len++] = count;
+            data[len++] = trace_source;
+            data[len++] = trace_mode;
+        }else if(trace_mode == TRACE_MODE_INPUT){
+            uint8_t *rec = (uint8_t *) trace_buf + trace_dump_i;
+
+            data[len++] = trace_dump_i;
+            for(step = 0; step < TRACEC_REC_DUMP_BYTES &&
+                    trace_dump_i + step < (int16_t) count; step++){
+                if(step % 3 == 0) data[len++] = 0;
+                data[len-1] |= (int32_t) rec[step] << (8*(step % 3));
+            }
+        }else{
+            /* Oldest sample first */
+            uint8_t i = trace_dump_i;
+            if(trace_count == TRACEC_LEN){
+                i = (uint8_t) ((trace_next + i) % TRACEC_LEN);
+            }
+            trace_sample_t *sample = &trace_buf[i];
+
+            data[len++] = trace_dump_i;
+            data[len++] = sample->t;
+            data[len++] = sample->left_enc;
+            data[len++] = sample->right_enc;
+            data[len++] = sample->error;
+            data[len++] = sample->u;
+            data[len++] = sample->pwr_left;
+            data[len++] = sample->pwr_right;
+        }
+
+        uint16_t msg_len = make_msg(trace_msg_buf, TRACEC_MSG_BUF_LEN,
+                CMD_TRACE, data, len);
+        if(msg_len > radio_tx_free()) return;
+
+        radio_send(trace_msg_buf);
+        trace_dump_i += step;
+    }
+
+    trace_dump_i = TRACEC_NOT_DUMPING;
+}
+
+/**
+ * Get the flight recorder state.
+ *
+ * Returns: uint8_t, the state (see tracec_state_enum)
+ */
+uint8_t trace_get_state()
+{
+    return trace_state;
+}
+
+/**
+ * Start recording the input (see tracec_rec_enum in trace_control.h). The
+ * replay starts from a robot that has just been switched on, so the
+ * recording should be started before the commands of interest.
+ */
+void trace_rec_start()
+{
+    trace_mode = TRACE_MODE_INPUT;
+    trace_source = 0;
+    trace_dump_i = TRACEC_NOT_DUMPING;
+    trace_rec_len = 0;
+    trace_rec_key = 1;
+    trace_rec_killed = killsw_fired();
+    trace_state = TRACE_RECORDING;
+
+    /* The start time */
+    trace_rec_t = (uint16_t) millis();
+    uint8_t *rec = trace_rec_alloc(TRACE_REC_TIME, 2);
+    rec[0] = (uint8_t) trace_rec_t;
+    rec[1] = (uint8_t) (trace_rec_t >> 8);
+}
+
+/**
+ * Record one control step (see trace_record): the kill switch and the
+ * encoders.
+ */
+void trace_rec_step()
+{
+    uint8_t killed = killsw_fired();
+    if(killed && !trace_rec_killed) trace_rec_alloc(TRACE_REC_KILL, 0);
+    trace_rec_killed = killed;
+
+    int16_t left = get_left_enc();
+    int16_t right = get_right_enc();
+    int16_t d_left = left - trace_rec_left;
+    int16_t d_right = right - trace_rec_right;
+    uint8_t *rec;
+
+    if(!trace_rec_key && d_left == 0 && d_right == 0){
+        /* Most of the steps (standing or cruising slowly) */
+        trace_rec_alloc(TRACE_REC_SAME, 0);
+    }else if(!trace_rec_key && d_left >= -8 && d_left <= 7 &&
+            d_right >= -8 && d_right <= 7){
+        rec = trace_rec_alloc(TRACE_REC_ENC, 1);
+        if(rec == NULL) return;
+
+        rec[0] = (uint8_t) ((d_left << 4) | (d_right & 0x0F));
+    }else{
+        rec = trace_rec_alloc(TRACE_REC_KEY, 4);
+        if(rec == NULL) return;
+
+        rec[0] = (uint8_t) left;
+        rec[1] = (uint8_t) (left >> 8);
+        rec[2] = (uint8_t) right;
+        rec[3] = (uint8_t) (right >> 8);
+        trace_rec_key = 0;
+    }
+
+    trace_rec_left = left;
+    trace_rec_right = right;
+}
+
+/**
+ * Record the string get_cmd got from the radio. Should be called by get_cmd
+ * every time it parses - with "" when it parses the rest of the previous
+ * string.
+ *
+ * Parameters: str - const char*, The string
+ */
+void trace_rec_rx(const char *str)
+{
+    if(trace_state != TRACE_RECORDING) return;
+
+    uint16_t len = strlen(str);
+    uint8_t *rec = trace_rec_alloc(TRACE_REC_RX, len + 2);
+    if(rec == NULL) return;
+
+    rec[0] = (uint8_t) len;
+    rec[1] = (uint8_t) (len >> 8);
+    memcpy(rec + 2, str, len);
+}
+
+/**
+ * Add a record to the input recording. The recording is frozen when the
+ * record does not fit, so the recording never ends with a part of a record.
+ *
+ * Parameters:
+ *      type - uint8_t, Record type (see tracec_rec_enum)
+ *      len - uint16_t, Length of the record (without the header)
+ *
+ * Returns: uint8_t*, where the rest of the record goes (NULL if not
+ *          recording)
+ */
+uint8_t *trace_rec_alloc(uint8_t type, uint16_t len)
+{
+    if(trace_state != TRACE_RECORDING) return NULL;
+
+    uint16_t now = (uint16_t) millis();
+    uint16_t dt = now - trace_rec_t;
+    uint16_t rec_len = len + 1;
+    if(dt > TRACEC_REC_MAX_DT) rec_len += 3;
+
+    if(rec_len > TRACEC_REC_LEN - trace_rec_len){
+        trace_state = TRACE_FROZEN;
+        return NULL;
+    }
+
+    uint8_t *rec = (uint8_t *) trace_buf + trace_rec_len;
+    if(dt > TRACEC_REC_MAX_DT){
+        *rec++ = TRACE_REC_TIME << TRACEC_REC_TYPE_SHIFT;
+        *rec++ = (uint8_t) dt;
+        *rec++ = (uint8_t) (dt >> 8);
+        dt = 0;
+    }
+    *rec++ = (uint8_t) ((type << TRACEC_REC_TYPE_SHIFT) | dt);
+
+    trace_rec_len += rec_len;
+    trace_rec_t = now;
+
+    return rec;
+}
@@ -0,0 +1,140 @@
+#ifndef TRACE_CONTROL_H
+#define TRACE_CONTROL_H
+
+/* LIBRARY INCLUDES ---------------------------------------------------------*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "drivers/board.h"
+#include "drivers/motor.h"
+
+/* CUSTOM INCLUDES ----------------------------------------------------------*/
+#include "cmd_control.h"
+#include "drive_control.h"
+#include "killsw_control.h"
+#include "radio_control.h"
+
+/* CONSTANTS ----------------------------------------------------------------*/
+/**
+ * Trace buffer length in samples (one sample per control step, see
+ * trace_sample_t). At 2 ms control period 48 samples is ~100 ms.
+ */
+#define TRACEC_LEN 48
+
+/* Default count of samples recorded after the trigger */
+#define TRACEC_POST_TRIGGER (TRACEC_LEN/4)
+
+/* Buffer for one dump message (see make_msg in cmd_control.c) */
+#define TRACEC_MSG_BUF_LEN 96
+
+/* Input recording length in bytes - the sample buffer (see trace_rec_start) */
+#define TRACEC_REC_LEN (TRACEC_LEN*sizeof(trace_sample_t))
+
+/* Input record header: the type in the upper bits, the time (ms) below */
+#define TRACEC_REC_TYPE_SHIFT 5
+#define TRACEC_REC_MAX_DT 0x1F
+
+/**
+ * Recorded bytes per dump message, 3 bytes per argument (the message has as
+ * many arguments as a sample)
+ */
+#define TRACEC_REC_DUMP_BYTES 21
+
+/* trace_dump_step has nothing to send */
+#define TRACEC_NOT_DUMPING INT16_MAX
+
+/* ENUMS --------------------------------------------------------------------*/
+/* CMD_TRACE actions (the first argument of the command) */
+enum tracec_action_enum{
+    TRACE_ARM = 0,
+    TRACE_TRIGGER = 1,
+    TRACE_DUMP = 2,
+    TRACE_STOP = 3,
+    TRACE_RECORD = 4
+};
+
+/* Trigger sources (bits of the trigger mask) */
+enum tracec_trigger_enum{
+    TRACE_TRIG_MANUAL = 0x01,
+    TRACE_TRIG_DONE = 0x02,
+    TRACE_TRIG_KILL = 0x04,
+    TRACE_TRIG_ERROR = 0x08
+};
+
+/* Trace states */
+enum tracec_state_enum{
+    TRACE_OFF = 0,
+    TRACE_ARMED = 1,
+    TRACE_TRIGGERED = 2,
+    TRACE_FROZEN = 3,
+    TRACE_RECORDING = 4
+};
+
+/* What the buffer holds */
+enum tracec_mode_enum{
+    TRACE_MODE_SAMPLES = 0,
+    TRACE_MODE_INPUT = 1
+};
+
+/**
+ * Input record types (see trace_rec_start). Every record starts with a byte:
+ * the type (upper 3 bits) and the time since the previous record (ms, lower
+ * 5 bits). The type is followed by:
+ *      TRACE_REC_ENC - the encoder changes since the previous control step,
+ *                      left in the upper and right in the lower 4 bits
+ *                      (signed)
+ *      TRACE_REC_KEY - the encoders: int16_t left, int16_t right
+ *      TRACE_REC_RX - the string get_cmd got from radio_gets: uint16_t
+ *                     length and the letters. Length 0 means that get_cmd
+ *                     parsed the rest of the previous string.
+ *      TRACE_REC_KILL - nothing, the kill switch has fired
+ *      TRACE_REC_TIME - uint16_t ms, for the times that do not fit into the
+ *                       header (the first record is the start time)
+ *      TRACE_REC_SAME - nothing, the encoders have not changed since the
+ *                       previous control step
+ * The numbers are little endian. ENC, KEY and SAME are one control step
+ * each, the first control step is always KEY.
+ */
+enum tracec_rec_enum{
+    TRACE_REC_ENC = 0,
+    TRACE_REC_KEY = 1,
+    TRACE_REC_RX = 2,
+    TRACE_REC_KILL = 3,
+    TRACE_REC_TIME = 5,
+    TRACE_REC_SAME = 6
+};
+
+/* STURCTS ------------------------------------------------------------------*/
+/**
+ * One trace sample (one control step).
+ *
+ * Fields:
+ *      t - time (millis, lower 16 bits)
+ *      left_enc, right_enc - encoders (clicks, forward is positive)
+ *      error - PID control error (see pid_control in drive_control.c)
+ *      u - PID control output
+ *      pwr_left, pwr_right - PID controlled powers
+ */
+typedef struct trace_sample_struct{
+    uint16_t t;
+    int16_t left_enc;
+    int16_t right_enc;
+    int16_t error;
+    int16_t u;
+    int16_t pwr_left;
+    int16_t pwr_right;
+} trace_sample_t;
+
+/* PUBLIC PROTOTYPES --------------------------------------------------------*/
+void trace_control_init();
+void trace_arm(uint8_t triggers, int16_t error_threshold, uint8_t post_count);
+void trace_stop();
+void trace_trigger(uint8_t source);
+void trace_record();
+void trace_dump();
+void trace_dump_step();
+uint8_t trace_get_state();
+void trace_rec_start();
+void trace_rec_rx(const char *str);
+
+#endif